@@ -2,13 +2,28 @@ DROP SCHEMA IF EXISTS service_schema CASCADE;
 
 CREATE SCHEMA IF NOT EXISTS service_schema;
 
+-- A random value per creation of the schema. Local state derived from the
+-- tables, such as cache dumps, is only valid for the same epoch.
+CREATE TABLE IF NOT EXISTS service_schema.schema_epoch
+(
+    epoch BIGINT NOT NULL
+);
+
+INSERT INTO service_schema.schema_epoch (epoch)
+VALUES (CAST(floor(random() * 9223372036854775807) as BIGINT));
+
+-- Row versions of couriers and orders, a new value on every change of
+-- their public representation. ETags are derived from them.
+CREATE SEQUENCE IF NOT EXISTS service_schema.row_version;
+
 CREATE TABLE IF NOT EXISTS service_schema.couriers
 (
     courier_id BIGINT PRIMARY KEY,
     courier_type TEXT,
     regions INTEGER [],
     working_hours TEXT [],
-    completed_orders BIGINT [] default NULL
+    completed_orders BIGINT [] default NULL,
+    version BIGINT NOT NULL DEFAULT nextval('service_schema.row_version')
 );
 
 CREATE TABLE IF NOT EXISTS service_schema.orders
@@ -18,7 +33,31 @@ CREATE TABLE IF NOT EXISTS service_schema.orders
     regions INTEGER,
     delivery_hours TEXT [],
     cost INTEGER,
-    complete_time TIMESTAMP DEFAULT NULL
+    complete_time TIMESTAMP DEFAULT NULL,
+    courier_id BIGINT DEFAULT NULL,
+    version BIGINT NOT NULL DEFAULT nextval('service_schema.row_version')
+);
+
+CREATE INDEX IF NOT EXISTS orders_courier_id_complete_time_idx
+    ON service_schema.orders (courier_id, complete_time);
+
+CREATE INDEX IF NOT EXISTS orders_complete_time_idx
+    ON service_schema.orders (complete_time);
+
+CREATE INDEX IF NOT EXISTS orders_regions_order_id_idx
+    ON service_schema.orders (regions, order_id);
+
+CREATE INDEX IF NOT EXISTS orders_open_order_id_idx
+    ON service_schema.orders (order_id) WHERE complete_time IS NULL;
+
+CREATE TABLE IF NOT EXISTS service_schema.change_log
+(
+    event_id BIGSERIAL PRIMARY KEY,
+    entity TEXT NOT NULL,
+    entity_id BIGINT NOT NULL,
+    kind TEXT NOT NULL,
+    payload JSONB DEFAULT NULL,
+    created_at TIMESTAMP NOT NULL DEFAULT now()
 );
 
 CREATE FUNCTION service_schema.CastTextToTimestamp(my_text TEXT) RETURNS TEXT as $$
@@ -43,6 +82,16 @@ CREATE FUNCTION service_schema.ReturnCurrentDate() RETURNS TEXT as $$
 select CAST((SELECT CURRENT_DATE) as TEXT);
 $$ LANGUAGE sql;
 
+-- A field of a CSV line, quoted the way COPY ... CSV does it.
+CREATE FUNCTION service_schema.CsvField(value_ TEXT) RETURNS TEXT as $$
+select case
+        WHEN value_ IS NULL then ''
+        WHEN value_ = '' or value_ ~ '[",\r\n]'
+            then '"' || replace(value_, '"', '""') || '"'
+            else value_
+        end
+$$ LANGUAGE SQL IMMUTABLE;
+
 CREATE FUNCTION service_schema.AddSomeMinutes(time_ TIMESTAMP, interval_ INTERVAL) RETURNS TEXT as $$
 SELECT CAST((time_ +  interval_) as TEXT);
 $$ LANGUAGE SQL;
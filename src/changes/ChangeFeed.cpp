@@ -0,0 +1,87 @@
+#include "ChangeFeed.h"
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+
+namespace lavka {
+
+// The lock is taken by the CTE before the rows, and so their event ids,
+// are produced.
+const userver::storages::postgres::Query kRecordCreated{
+    "WITH lock AS (SELECT pg_advisory_xact_lock(hashtext('change_log'))) "
+    "INSERT INTO service_schema.change_log (entity, entity_id, kind) "
+    "SELECT $1, u.entity_id, 'created' "
+    "FROM lock, unnest($2::BIGINT[]) AS u(entity_id)",
+    userver::storages::postgres::Query::Name{"record_created"},
+};
+
+const userver::storages::postgres::Query kRecordCompleted{
+    "WITH lock AS (SELECT pg_advisory_xact_lock(hashtext('change_log'))) "
+    "INSERT INTO service_schema.change_log (entity, entity_id, kind, payload) "
+    "SELECT 'order', u.order_id, 'completed', "
+    "jsonb_build_object('courier_id', u.courier_id, "
+    "'complete_time', CAST(CAST(u.complete_time as TIMESTAMP) as TEXT)) "
+    "FROM lock, unnest($1::BIGINT[], $2::BIGINT[], $3::TEXT[]) "
+    "AS u(order_id, courier_id, complete_time)",
+    userver::storages::postgres::Query::Name{"record_completed"},
+};
+
+ChangeFeedConfig Parse(const userver::formats::json::Value& value,
+                       userver::formats::parse::To<ChangeFeedConfig>) {
+  ChangeFeedConfig config;
+  config.poll_interval = std::chrono::milliseconds{
+      value["poll_interval_ms"].As<int64_t>(config.poll_interval.count())};
+  config.max_wait = std::chrono::milliseconds{
+      value["max_wait_ms"].As<int64_t>(config.max_wait.count())};
+  config.max_batch = value["max_batch"].As<size_t>(config.max_batch);
+  return config;
+}
+
+ChangeFeedConfig ParseChangeFeedConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_CHANGE_FEED").As<ChangeFeedConfig>();
+}
+
+ChangeFeed::ChangeFeed(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()) {
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter("lavka-change-feed",
+                          [this](userver::utils::statistics::Writer& writer) {
+                            writer["notifications"] = version_.load();
+                            writer["waiting"] = waiting_.load();
+                          });
+}
+
+ChangeFeed::~ChangeFeed() { statistics_holder_.Unregister(); }
+
+ChangeFeedConfig ChangeFeed::GetConfig() const {
+  return config_source_.GetCopy(kChangeFeedConfig);
+}
+
+void ChangeFeed::Notify() {
+  {
+    std::lock_guard lock{mutex_};
+    ++version_;
+  }
+  changed_cv_.NotifyAll();
+}
+
+bool ChangeFeed::WaitForChanges(uint64_t version,
+                                userver::engine::Deadline deadline) {
+  ++waiting_;
+  std::unique_lock lock{mutex_};
+  const auto changed = changed_cv_.WaitUntil(
+      lock, deadline, [&] { return version_.load() != version; });
+  --waiting_;
+  return changed;
+}
+
+}  // namespace lavka
@@ -0,0 +1,79 @@
+#ifndef LAVKA_CHANGEFEED_H
+#define LAVKA_CHANGEFEED_H
+
+#include <atomic>
+#include <chrono>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/condition_variable.hpp>
+#include <userver/engine/deadline.hpp>
+#include <userver/engine/mutex.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+struct ChangeFeedConfig {
+  // Long-polls re-read the log at least this often to notice the changes
+  // committed by other instances.
+  std::chrono::milliseconds poll_interval{1000};
+  std::chrono::milliseconds max_wait{25000};
+  size_t max_batch{500};
+};
+
+ChangeFeedConfig Parse(const userver::formats::json::Value& value,
+                       userver::formats::parse::To<ChangeFeedConfig>);
+
+ChangeFeedConfig ParseChangeFeedConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseChangeFeedConfig>
+    kChangeFeedConfig;
+
+// Appends "created" events of the given entity ("order" or "courier") for
+// $2::BIGINT[] ids. Must run in the transaction of the mutation.
+extern const userver::storages::postgres::Query kRecordCreated;
+
+// Appends "completed" order events for unnest($1 order_id, $2 courier_id,
+// $3 complete_time).
+extern const userver::storages::postgres::Query kRecordCompleted;
+
+// Ordered log of order and courier mutations in service_schema.change_log.
+// Writers append to it in the transaction of the mutation under a
+// transaction-level advisory lock, so event ids are assigned in commit
+// order and a reader never sees an id after a larger one: the event id is
+// a resumable cursor. After a commit writers call Notify to wake the
+// long-polls of this instance.
+class ChangeFeed final : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-change-feed";
+
+  ChangeFeed(const userver::components::ComponentConfig& config,
+             const userver::components::ComponentContext& component_context);
+  ~ChangeFeed() override;
+
+  ChangeFeedConfig GetConfig() const;
+
+  uint64_t GetVersion() const { return version_.load(); }
+
+  void Notify();
+
+  // Waits until Notify is called after `version` was read, or until the
+  // deadline. Returns whether anything was committed meanwhile.
+  bool WaitForChanges(uint64_t version, userver::engine::Deadline deadline);
+
+ private:
+  userver::dynamic_config::Source config_source_;
+
+  userver::engine::Mutex mutex_;
+  userver::engine::ConditionVariable changed_cv_;
+  std::atomic<uint64_t> version_{0};
+  std::atomic<uint64_t> waiting_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_CHANGEFEED_H
@@ -0,0 +1,170 @@
+#include "ChangesHandler.h"
+
+#include <algorithm>
+
+#include "ChangeFeed.h"
+#include "InvalidationListener.h"
+
+#include "../formats/BodyFormat.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
+namespace lavka {
+
+namespace {
+
+struct ChangeEventDto {
+  int64_t event_id;
+  std::string entity;
+  int64_t entity_id;
+  std::string kind;
+  std::optional<std::string> payload;
+  std::string created_at;
+};
+
+// Part of the request budget kept to respond after the wait.
+constexpr std::chrono::milliseconds kResponseMargin{500};
+
+class ChangesHandler final
+    : public userver::server::handlers::HttpHandlerBase {
+ public:
+  static constexpr std::string_view kName = "handler-changes";
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ChangeFeed& change_feed_;
+
+  ChangesHandler(const userver::components::ComponentConfig& config,
+                 const userver::components::ComponentContext& component_context)
+      : HttpHandlerBase(config, component_context),
+        pg_cluster_(
+            component_context
+                .FindComponent<userver::components::Postgres>("postgres-db-1")
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        change_feed_(component_context.FindComponent<ChangeFeed>()){};
+
+  // Long-polls spend most of their time waiting, they are not counted by
+  // the concurrency limiter.
+  std::string HandleRequestThrow(
+      const userver::server::http::HttpRequest& request,
+      userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    RequestScope scope{request, statistics_, metrics_,
+                       ConcurrencyLimiter::Slot{}};
+    switch (request.GetMethod()) {
+      case userver::server::http::HttpMethod::kGet:
+        return GetChanges(request, scope);
+      default:
+        throw userver::server::handlers::ClientError(
+            userver::server::handlers::ExternalBody{
+                fmt::format("Unsupported method {}", request.GetMethod())});
+    }
+  }
+
+  const userver::storages::postgres::Query kSelectChanges{
+      "SELECT event_id, entity, entity_id, kind, CAST(payload as TEXT), "
+      "CAST(created_at as TEXT) FROM service_schema.change_log "
+      "WHERE event_id > $1 ORDER BY event_id LIMIT $2",
+      userver::storages::postgres::Query::Name{"select_changes"},
+  };
+
+  // GET /changes?cursor=..&limit=..&timeout_ms=..
+  // Responds with the events after the cursor as soon as there are any,
+  // or with an empty batch after timeout_ms. The next request passes the
+  // returned cursor.
+  std::string GetChanges(const userver::server::http::HttpRequest& request,
+                         RequestScope& scope) const {
+    const auto config = change_feed_.GetConfig();
+
+    int64_t cursor = 0;
+    int64_t limit = config.max_batch;
+    int64_t timeout_ms = config.max_wait.count();
+    int realArgCount = 0;
+    try {
+      if (request.HasArg("cursor")) {
+        cursor = std::stoll(request.GetArg("cursor"));
+        ++realArgCount;
+      }
+      if (request.HasArg("limit")) {
+        limit = std::stoll(request.GetArg("limit"));
+        ++realArgCount;
+      }
+      if (request.HasArg("timeout_ms")) {
+        timeout_ms = std::stoll(request.GetArg("timeout_ms"));
+        ++realArgCount;
+      }
+    } catch (...) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+    if (request.ArgCount() > realArgCount || cursor < 0 || limit <= 0 ||
+        timeout_ms < 0) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+    limit = std::min<int64_t>(limit, config.max_batch);
+
+    using Clock = userver::engine::Deadline::Clock;
+    const auto wait_until = std::min(
+        Clock::now() + std::min(std::chrono::milliseconds{timeout_ms},
+                                config.max_wait),
+        scope.GetDeadline().GetTimePoint() - kResponseMargin);
+
+    std::vector<ChangeEventDto> events;
+    while (true) {
+      // Read before the query, so that a commit notified while the query
+      // runs is not missed.
+      const auto version = change_feed_.GetVersion();
+      events = scope
+                   .Execute(pg_cluster_,
+                            userver::storages::postgres::ClusterHostType::kSlave,
+                            kSelectChanges, cursor, limit)
+                   .AsContainer<std::vector<ChangeEventDto>>(
+                       userver::storages::postgres::kRowTag);
+      if (!events.empty() || Clock::now() >= wait_until) break;
+
+      change_feed_.WaitForChanges(
+          version, userver::engine::Deadline::FromTimePoint(std::min(
+                       Clock::now() + config.poll_interval, wait_until)));
+      scope.CheckDeadline();
+    }
+
+    const auto timer = scope.Time(Stage::kSerialize);
+    userver::formats::json::ValueBuilder eventsJson{
+        userver::formats::common::Type::kArray};
+    for (const auto& event : events) {
+      userver::formats::json::ValueBuilder eventJson;
+      eventJson["event_id"] = event.event_id;
+      eventJson["entity"] = event.entity;
+      eventJson["entity_id"] = event.entity_id;
+      eventJson["kind"] = event.kind;
+      eventJson["created_at"] = event.created_at;
+      if (event.payload.has_value()) {
+        eventJson["payload"] =
+            userver::formats::json::FromString(event.payload.value());
+      }
+      eventsJson.PushBack(eventJson.ExtractValue());
+      cursor = event.event_id;
+    }
+
+    userver::formats::json::ValueBuilder responseJson;
+    responseJson["events"] = eventsJson.ExtractValue();
+    responseJson["cursor"] = cursor;
+    return WriteBody(request, responseJson.ExtractValue());
+  }
+};
+
+}  // namespace
+
+void AppendChanges(userver::components::ComponentList& component_list) {
+  component_list.Append<InvalidationListener>();
+  component_list.Append<ChangesHandler>();
+}
+
+}  // namespace lavka
@@ -0,0 +1,12 @@
+#ifndef LAVKA_CHANGESHANDLER_H
+#define LAVKA_CHANGESHANDLER_H
+
+#include "../lavka.h"
+
+namespace lavka {
+
+void AppendChanges(userver::components::ComponentList& component_list);
+
+}  // namespace lavka
+
+#endif  // LAVKA_CHANGESHANDLER_H
@@ -0,0 +1,148 @@
+#include "InvalidationListener.h"
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+#include <userver/engine/sleep.hpp>
+#include <userver/engine/task/cancel.hpp>
+#include <userver/logging/log.hpp>
+
+#include "ChangeFeed.h"
+
+#include "../couriers/MetaInfoCache.h"
+#include "../statistics/QueryAccounting.h"
+
+namespace lavka {
+
+namespace {
+
+struct InvalidationDto {
+  int64_t event_id;
+  std::string kind;
+  std::optional<int64_t> courier_id;
+  std::optional<std::string> complete_time;
+};
+
+const userver::storages::postgres::Query kSelectLastEventId{
+    "SELECT COALESCE(MAX(event_id), 0) FROM service_schema.change_log",
+    userver::storages::postgres::Query::Name{"select_last_event_id"},
+};
+
+const userver::storages::postgres::Query kSelectInvalidations{
+    "SELECT event_id, kind, CAST(payload->>'courier_id' as BIGINT), "
+    "payload->>'complete_time' FROM service_schema.change_log "
+    "WHERE event_id > $1 ORDER BY event_id LIMIT $2",
+    userver::storages::postgres::Query::Name{"select_invalidations"},
+};
+
+}  // namespace
+
+InvalidationListenerConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<InvalidationListenerConfig>) {
+  InvalidationListenerConfig config;
+  config.enabled = value["enabled"].As<bool>(config.enabled);
+  config.poll_interval = std::chrono::milliseconds{
+      value["poll_interval_ms"].As<int64_t>(config.poll_interval.count())};
+  config.max_batch = value["max_batch"].As<size_t>(config.max_batch);
+  return config;
+}
+
+InvalidationListenerConfig ParseInvalidationListenerConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_INVALIDATION_LISTENER")
+      .As<InvalidationListenerConfig>();
+}
+
+InvalidationListener::InvalidationListener(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()),
+      pg_cluster_(
+          component_context
+              .FindComponent<userver::components::Postgres>("postgres-db-1")
+              .GetCluster()),
+      statistics_(component_context.FindComponent<Statistics>()),
+      meta_info_cache_(component_context.FindComponent<MetaInfoCache>()),
+      change_feed_(component_context.FindComponent<ChangeFeed>()) {
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-invalidation-listener",
+              [this](userver::utils::statistics::Writer& writer) {
+                writer["events"] = events_.load();
+                writer["invalidations"] = invalidations_.load();
+                writer["resyncs"] = resyncs_.load();
+              });
+
+  task_ = userver::engine::CriticalAsyncNoSpan([this] { Run(); });
+}
+
+InvalidationListener::~InvalidationListener() {
+  task_.SyncCancel();
+  statistics_holder_.Unregister();
+}
+
+void InvalidationListener::Run() {
+  while (!userver::engine::current_task::ShouldCancel()) {
+    const auto config = config_source_.GetCopy(kInvalidationListenerConfig);
+    size_t applied = 0;
+    if (!config.enabled) {
+      last_event_id_.reset();
+    } else {
+      try {
+        applied = Poll(config);
+      } catch (const std::exception& e) {
+        if (userver::engine::current_task::ShouldCancel()) return;
+        LOG_WARNING() << "Failed to read the change log, resyncing: " << e;
+        last_event_id_.reset();
+      }
+    }
+
+    // A full batch means the listener is behind, catch up without sleeping.
+    if (applied < config.max_batch) {
+      userver::engine::InterruptibleSleepFor(config.poll_interval);
+    }
+  }
+}
+
+size_t InvalidationListener::Poll(const InvalidationListenerConfig& config) {
+  if (!last_event_id_.has_value()) {
+    last_event_id_ =
+        ExecuteAccounted(statistics_, pg_cluster_,
+                         userver::storages::postgres::ClusterHostType::kMaster,
+                         kSelectLastEventId)
+            .AsSingleRow<int64_t>();
+    meta_info_cache_.InvalidateAll();
+    change_feed_.Notify();
+    ++resyncs_;
+  }
+
+  const auto rows =
+      ExecuteAccounted(statistics_, pg_cluster_,
+                       userver::storages::postgres::ClusterHostType::kMaster,
+                       kSelectInvalidations, last_event_id_.value(),
+                       static_cast<int64_t>(config.max_batch))
+          .AsContainer<std::vector<InvalidationDto>>(
+              userver::storages::postgres::kRowTag);
+  if (rows.empty()) return 0;
+
+  for (const auto& row : rows) {
+    if (row.kind == "completed" && row.courier_id.has_value() &&
+        row.complete_time.has_value()) {
+      meta_info_cache_.Invalidate(row.courier_id.value(),
+                                  row.complete_time.value());
+      ++invalidations_;
+    }
+  }
+  events_ += rows.size();
+  last_event_id_ = rows.back().event_id;
+  change_feed_.Notify();
+  return rows.size();
+}
+
+}  // namespace lavka
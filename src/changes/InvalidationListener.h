@@ -0,0 +1,76 @@
+#ifndef LAVKA_INVALIDATIONLISTENER_H
+#define LAVKA_INVALIDATIONLISTENER_H
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/task/task_with_result.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+class ChangeFeed;
+class MetaInfoCache;
+class Statistics;
+
+struct InvalidationListenerConfig {
+  bool enabled{true};
+  std::chrono::milliseconds poll_interval{100};
+  size_t max_batch{1000};
+};
+
+InvalidationListenerConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<InvalidationListenerConfig>);
+
+InvalidationListenerConfig ParseInvalidationListenerConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseInvalidationListenerConfig>
+    kInvalidationListenerConfig;
+
+// Applies the writes of every instance to the in-memory state of this one.
+// A background task tails service_schema.change_log on the master from the
+// last event it has seen: completions invalidate the MetaInfoCache entries
+// they affect and any new event wakes the /changes long-polls. On start and
+// after a failed read it can not know what it missed, so it drops the
+// whole cache and resumes from the end of the log.
+class InvalidationListener final
+    : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-invalidation-listener";
+
+  InvalidationListener(
+      const userver::components::ComponentConfig& config,
+      const userver::components::ComponentContext& component_context);
+  ~InvalidationListener() override;
+
+ private:
+  void Run();
+  // Returns the number of events applied.
+  size_t Poll(const InvalidationListenerConfig& config);
+
+  userver::dynamic_config::Source config_source_;
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  MetaInfoCache& meta_info_cache_;
+  ChangeFeed& change_feed_;
+
+  std::optional<int64_t> last_event_id_;
+
+  std::atomic<uint64_t> events_{0};
+  std::atomic<uint64_t> invalidations_{0};
+  std::atomic<uint64_t> resyncs_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+
+  userver::engine::TaskWithResult<void> task_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_INVALIDATIONLISTENER_H
@@ -0,0 +1,311 @@
+#include "ResponseCompressor.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <variant>
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+
+namespace lavka {
+
+namespace {
+
+constexpr size_t kOutputStep = 16 * 1024;
+
+std::string_view Trim(std::string_view value) {
+  while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+  while (!value.empty() && value.back() == ' ') value.remove_suffix(1);
+  return value;
+}
+
+bool EqualsIgnoreCase(std::string_view lhs, std::string_view rhs) {
+  return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                    [](char l, char r) {
+                      return std::tolower(static_cast<unsigned char>(l)) ==
+                             std::tolower(static_cast<unsigned char>(r));
+                    });
+}
+
+// Quality of a `coding;q=0.5` entry, 1 if there is no q parameter and 0
+// if it is malformed.
+double Quality(std::string_view params) {
+  while (!params.empty()) {
+    const auto semicolon = params.find(';');
+    const auto param = Trim(params.substr(0, semicolon));
+    if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') &&
+        param[1] == '=') {
+      try {
+        return std::stod(std::string{param.substr(2)});
+      } catch (...) {
+        return 0;
+      }
+    }
+    if (semicolon == std::string_view::npos) break;
+    params.remove_prefix(semicolon + 1);
+  }
+  return 1;
+}
+
+struct GzipStream {
+  z_stream stream{};
+};
+
+struct ZstdStream {
+  ZSTD_CCtx* context{nullptr};
+};
+
+}  // namespace
+
+std::string_view ToString(Encoding encoding) {
+  switch (encoding) {
+    case Encoding::kIdentity:
+      return "identity";
+    case Encoding::kGzip:
+      return "gzip";
+    case Encoding::kZstd:
+      return "zstd";
+  }
+  return "identity";
+}
+
+Encoding NegotiateEncoding(std::string_view accept_encoding) {
+  double gzip = 0, zstd = 0, any = 0;
+  bool gzip_listed = false, zstd_listed = false;
+  while (!accept_encoding.empty()) {
+    const auto comma = accept_encoding.find(',');
+    const auto entry = accept_encoding.substr(0, comma);
+    const auto semicolon = entry.find(';');
+    const auto coding = Trim(entry.substr(0, semicolon));
+    const auto quality = semicolon == std::string_view::npos
+                             ? 1.0
+                             : Quality(entry.substr(semicolon + 1));
+    if (EqualsIgnoreCase(coding, "gzip") ||
+        EqualsIgnoreCase(coding, "x-gzip")) {
+      gzip = quality;
+      gzip_listed = true;
+    } else if (EqualsIgnoreCase(coding, "zstd")) {
+      zstd = quality;
+      zstd_listed = true;
+    } else if (coding == "*") {
+      any = quality;
+    }
+    if (comma == std::string_view::npos) break;
+    accept_encoding.remove_prefix(comma + 1);
+  }
+  if (!gzip_listed) gzip = any;
+  if (!zstd_listed) zstd = any;
+
+  if (zstd > 0 && zstd >= gzip) return Encoding::kZstd;
+  if (gzip > 0) return Encoding::kGzip;
+  return Encoding::kIdentity;
+}
+
+struct StreamCompressor::Impl {
+  Encoding encoding;
+  std::variant<GzipStream, ZstdStream> state;
+  size_t bytes_in{0};
+  size_t bytes_out{0};
+
+  Impl(Encoding encoding, int level) : encoding(encoding) {
+    if (encoding == Encoding::kGzip) {
+      auto& gzip = state.emplace<GzipStream>();
+      // 16 + MAX_WBITS: a gzip header and trailer instead of a zlib one.
+      if (deflateInit2(&gzip.stream, level, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error{"deflateInit2 failed"};
+      }
+    } else if (encoding == Encoding::kZstd) {
+      auto& zstd = state.emplace<ZstdStream>();
+      zstd.context = ZSTD_createCCtx();
+      if (!zstd.context) throw std::runtime_error{"ZSTD_createCCtx failed"};
+      ZSTD_CCtx_setParameter(zstd.context, ZSTD_c_compressionLevel, level);
+    } else {
+      throw std::logic_error{"no compressor for identity encoding"};
+    }
+  }
+
+  ~Impl() {
+    if (auto* gzip = std::get_if<GzipStream>(&state)) {
+      deflateEnd(&gzip->stream);
+    } else if (auto* zstd = std::get_if<ZstdStream>(&state)) {
+      ZSTD_freeCCtx(zstd->context);
+    }
+  }
+
+  std::string Process(std::string_view chunk, bool last) {
+    bytes_in += chunk.size();
+    std::string out;
+    if (auto* gzip = std::get_if<GzipStream>(&state)) {
+      auto& stream = gzip->stream;
+      stream.next_in =
+          reinterpret_cast<Bytef*>(const_cast<char*>(chunk.data()));
+      stream.avail_in = chunk.size();
+      const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+      while (true) {
+        const auto offset = out.size();
+        out.resize(offset + kOutputStep);
+        stream.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+        stream.avail_out = kOutputStep;
+        const auto result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR) throw std::runtime_error{"deflate failed"};
+        out.resize(out.size() - stream.avail_out);
+        if (last ? result == Z_STREAM_END : stream.avail_out != 0) break;
+      }
+    } else {
+      auto* context = std::get<ZstdStream>(state).context;
+      ZSTD_inBuffer input{chunk.data(), chunk.size(), 0};
+      const auto mode = last ? ZSTD_e_end : ZSTD_e_flush;
+      while (true) {
+        const auto offset = out.size();
+        out.resize(offset + kOutputStep);
+        ZSTD_outBuffer output{out.data() + offset, kOutputStep, 0};
+        const auto remaining =
+            ZSTD_compressStream2(context, &output, &input, mode);
+        if (ZSTD_isError(remaining)) {
+          throw std::runtime_error{ZSTD_getErrorName(remaining)};
+        }
+        out.resize(offset + output.pos);
+        if (remaining == 0) break;
+      }
+    }
+    bytes_out += out.size();
+    return out;
+  }
+};
+
+StreamCompressor::StreamCompressor(Encoding encoding, int level)
+    : impl_(std::make_unique<Impl>(encoding, level)) {}
+
+StreamCompressor::StreamCompressor(StreamCompressor&&) noexcept = default;
+StreamCompressor& StreamCompressor::operator=(StreamCompressor&&) noexcept =
+    default;
+StreamCompressor::~StreamCompressor() = default;
+
+std::string StreamCompressor::Compress(std::string_view chunk) {
+  return impl_->Process(chunk, false);
+}
+
+std::string StreamCompressor::Finish(std::string_view chunk) {
+  return impl_->Process(chunk, true);
+}
+
+Encoding StreamCompressor::GetEncoding() const { return impl_->encoding; }
+size_t StreamCompressor::BytesIn() const { return impl_->bytes_in; }
+size_t StreamCompressor::BytesOut() const { return impl_->bytes_out; }
+
+ResponseCompressionConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<ResponseCompressionConfig>) {
+  ResponseCompressionConfig config;
+  config.enabled = value["enabled"].As<bool>(config.enabled);
+  config.min_size = value["min_size_bytes"].As<size_t>(config.min_size);
+  config.gzip_level = std::clamp(
+      value["gzip_level"].As<int>(config.gzip_level), 1, 9);
+  config.zstd_level = std::clamp(
+      value["zstd_level"].As<int>(config.zstd_level), 1, 19);
+  return config;
+}
+
+ResponseCompressionConfig ParseResponseCompressionConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_RESPONSE_COMPRESSION")
+      .As<ResponseCompressionConfig>();
+}
+
+ResponseCompressor::ResponseCompressor(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()) {
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-response-compression",
+              [this](userver::utils::statistics::Writer& writer) {
+                for (const auto encoding : {Encoding::kGzip, Encoding::kZstd}) {
+                  const auto& stats = StatsFor(encoding);
+                  const userver::utils::statistics::LabelView label{
+                      "encoding", ToString(encoding)};
+                  writer["responses"].ValueWithLabels(stats.responses.load(),
+                                                      {label});
+                  writer["bytes-in"].ValueWithLabels(stats.bytes_in.load(),
+                                                     {label});
+                  writer["bytes-out"].ValueWithLabels(stats.bytes_out.load(),
+                                                      {label});
+                }
+                writer["skipped-small"] = skipped_small_.load();
+              });
+}
+
+ResponseCompressor::~ResponseCompressor() { statistics_holder_.Unregister(); }
+
+std::string ResponseCompressor::Compress(
+    const userver::server::http::HttpRequest& request, std::string body) {
+  const auto config = config_source_.GetCopy(kResponseCompressionConfig);
+  const auto encoding = Negotiate(request, config);
+  if (!encoding.has_value()) return body;
+  if (body.size() < config.min_size) {
+    ++skipped_small_;
+    return body;
+  }
+  SetContentEncoding(request, encoding.value());
+
+  StreamCompressor stream{
+      encoding.value(), encoding == Encoding::kGzip ? config.gzip_level
+                                                     : config.zstd_level};
+  auto compressed = stream.Finish(body);
+  Account(stream);
+  return compressed;
+}
+
+std::optional<StreamCompressor> ResponseCompressor::StartStream(
+    const userver::server::http::HttpRequest& request) {
+  const auto config = config_source_.GetCopy(kResponseCompressionConfig);
+  const auto encoding = Negotiate(request, config);
+  if (!encoding.has_value()) return std::nullopt;
+  SetContentEncoding(request, encoding.value());
+  return StreamCompressor{encoding.value(), encoding == Encoding::kGzip
+                                                ? config.gzip_level
+                                                : config.zstd_level};
+}
+
+void ResponseCompressor::Account(const StreamCompressor& stream) {
+  auto& stats = StatsFor(stream.GetEncoding());
+  ++stats.responses;
+  stats.bytes_in += stream.BytesIn();
+  stats.bytes_out += stream.BytesOut();
+}
+
+std::optional<Encoding> ResponseCompressor::Negotiate(
+    const userver::server::http::HttpRequest& request,
+    const ResponseCompressionConfig& config) const {
+  AddVary(request, "Accept-Encoding");
+  if (!config.enabled) return std::nullopt;
+
+  const auto encoding =
+      NegotiateEncoding(request.GetHeader("Accept-Encoding"));
+  if (encoding == Encoding::kIdentity) return std::nullopt;
+  return encoding;
+}
+
+void ResponseCompressor::SetContentEncoding(
+    const userver::server::http::HttpRequest& request, Encoding encoding) {
+  request.GetHttpResponse().SetHeader(std::string{"Content-Encoding"},
+                                      std::string{ToString(encoding)});
+}
+
+ResponseCompressor::EncodingStats& ResponseCompressor::StatsFor(
+    Encoding encoding) {
+  return encoding == Encoding::kGzip ? gzip_ : zstd_;
+}
+
+}  // namespace lavka
@@ -0,0 +1,115 @@
+#ifndef LAVKA_RESPONSECOMPRESSOR_H
+#define LAVKA_RESPONSECOMPRESSOR_H
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+enum class Encoding { kIdentity, kGzip, kZstd };
+
+std::string_view ToString(Encoding encoding);
+
+// The best of the encodings we support that the Accept-Encoding header
+// allows, zstd is preferred over gzip at equal quality.
+Encoding NegotiateEncoding(std::string_view accept_encoding);
+
+// gzip or zstd stream. Every Compress flushes, so the client can decode a
+// streamed response as it arrives.
+class StreamCompressor final {
+ public:
+  StreamCompressor(Encoding encoding, int level);
+  StreamCompressor(StreamCompressor&&) noexcept;
+  StreamCompressor& operator=(StreamCompressor&&) noexcept;
+  ~StreamCompressor();
+
+  std::string Compress(std::string_view chunk);
+  // Ends the stream, the compressor can not be used afterwards.
+  std::string Finish(std::string_view chunk = {});
+
+  Encoding GetEncoding() const;
+  size_t BytesIn() const;
+  size_t BytesOut() const;
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+struct ResponseCompressionConfig {
+  bool enabled{true};
+  // Smaller bodies are sent as is.
+  size_t min_size{1024};
+  int gzip_level{6};
+  int zstd_level{3};
+};
+
+ResponseCompressionConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<ResponseCompressionConfig>);
+
+ResponseCompressionConfig ParseResponseCompressionConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseResponseCompressionConfig>
+    kResponseCompressionConfig;
+
+// Compresses response bodies with the encoding negotiated from the request
+// headers, setting Content-Encoding and Vary. Tuned by
+// LAVKA_RESPONSE_COMPRESSION.
+class ResponseCompressor final
+    : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-response-compressor";
+
+  ResponseCompressor(
+      const userver::components::ComponentConfig& config,
+      const userver::components::ComponentContext& component_context);
+  ~ResponseCompressor() override;
+
+  std::string Compress(const userver::server::http::HttpRequest& request,
+                       std::string body);
+
+  // For streamed responses, call before the end of headers. nullopt if the
+  // body is to be sent as is.
+  std::optional<StreamCompressor> StartStream(
+      const userver::server::http::HttpRequest& request);
+
+  // Accounts a finished stream.
+  void Account(const StreamCompressor& stream);
+
+ private:
+  std::optional<Encoding> Negotiate(
+      const userver::server::http::HttpRequest& request,
+      const ResponseCompressionConfig& config) const;
+
+  struct EncodingStats {
+    std::atomic<uint64_t> responses{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> bytes_out{0};
+  };
+
+  static void SetContentEncoding(
+      const userver::server::http::HttpRequest& request, Encoding encoding);
+
+  EncodingStats& StatsFor(Encoding encoding);
+
+  userver::dynamic_config::Source config_source_;
+  EncodingStats gzip_;
+  EncodingStats zstd_;
+  std::atomic<uint64_t> skipped_small_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_RESPONSECOMPRESSOR_H
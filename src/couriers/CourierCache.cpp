@@ -0,0 +1,464 @@
+#include "CourierCache.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+#include <userver/engine/sleep.hpp>
+#include <userver/engine/task/cancel.hpp>
+#include <userver/fs/read.hpp>
+#include <userver/fs/write.hpp>
+#include <userver/logging/log.hpp>
+#include <userver/yaml_config/merge_schemas.hpp>
+
+#include "../statistics/QueryAccounting.h"
+
+namespace lavka {
+
+namespace {
+
+const userver::storages::postgres::Query kSelectLastEventId{
+    "SELECT COALESCE(MAX(event_id), 0) FROM service_schema.change_log",
+    userver::storages::postgres::Query::Name{"select_last_event_id"},
+};
+
+const userver::storages::postgres::Query kSelectSchemaEpoch{
+    "SELECT COALESCE(MAX(epoch), 0) FROM service_schema.schema_epoch",
+    userver::storages::postgres::Query::Name{"select_schema_epoch"},
+};
+
+const userver::storages::postgres::Query kSelectAllCouriers{
+    "SELECT courier_id, courier_type, regions, working_hours, "
+    "NULL::BIGINT[], version FROM service_schema.couriers",
+    userver::storages::postgres::Query::Name{"select_all_couriers"},
+};
+
+const userver::storages::postgres::Query kSelectChanges{
+    "SELECT event_id, entity, entity_id FROM service_schema.change_log "
+    "WHERE event_id > $1 ORDER BY event_id LIMIT $2",
+    userver::storages::postgres::Query::Name{"select_courier_cache_changes"},
+};
+
+const userver::storages::postgres::Query kSelectCouriersByIds{
+    "SELECT courier_id, courier_type, regions, working_hours, "
+    "NULL::BIGINT[], version FROM service_schema.couriers "
+    "WHERE courier_id = ANY($1)",
+    userver::storages::postgres::Query::Name{
+        "select_couriers_by_ids_for_cache"},
+};
+
+struct ChangeDto {
+  int64_t event_id;
+  std::string entity;
+  int64_t entity_id;
+};
+
+const userver::storages::postgres::TransactionOptions kSnapshotRead{
+    userver::storages::postgres::IsolationLevel::kRepeatableRead,
+    userver::storages::postgres::TransactionOptions::kReadOnly};
+
+// Dump layout, native byte order: magic, version, schema_epoch,
+// last_event_id, count,
+// then per courier its id, row version, type, regions and working hours
+// (strings and arrays are prefixed with their size), then the FNV-1a hash
+// of all the preceding bytes. Bump kDumpVersion on any change of the layout.
+constexpr uint32_t kDumpMagic = 0x434b564c;  // "LVKC"
+constexpr uint32_t kDumpVersion = 3;
+
+uint64_t Fnv1a(std::string_view data) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+class DumpWriter final {
+ public:
+  template <typename T>
+  void Write(T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void Write(std::string_view value) {
+    Write(static_cast<uint32_t>(value.size()));
+    data_.append(value);
+  }
+
+  std::string Finish() && {
+    Write(Fnv1a(data_));
+    return std::move(data_);
+  }
+
+ private:
+  std::string data_;
+};
+
+class DumpReader final {
+ public:
+  explicit DumpReader(std::string_view data) : data_(data) {
+    if (data_.size() < sizeof(uint64_t)) throw std::runtime_error{"truncated"};
+    const auto body = data_.substr(0, data_.size() - sizeof(uint64_t));
+    uint64_t checksum = 0;
+    std::memcpy(&checksum, data_.data() + body.size(), sizeof(checksum));
+    if (checksum != Fnv1a(body)) throw std::runtime_error{"bad checksum"};
+    data_ = body;
+  }
+
+  template <typename T>
+  T Read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    std::memcpy(&value, Take(sizeof(T)).data(), sizeof(T));
+    return value;
+  }
+
+  std::string ReadString() { return std::string{Take(Read<uint32_t>())}; }
+
+  bool Done() const { return data_.empty(); }
+
+ private:
+  std::string_view Take(size_t size) {
+    if (data_.size() < size) throw std::runtime_error{"truncated"};
+    const auto result = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return result;
+  }
+
+  std::string_view data_;
+};
+
+std::string Serialize(const CouriersSnapshot& snapshot) {
+  DumpWriter writer;
+  writer.Write(kDumpMagic);
+  writer.Write(kDumpVersion);
+  writer.Write(snapshot.schema_epoch);
+  writer.Write(snapshot.last_event_id);
+  writer.Write(static_cast<uint64_t>(snapshot.couriers->size()));
+  for (const auto& [courier_id, courier] : *snapshot.couriers) {
+    writer.Write(courier_id);
+    writer.Write(courier.version);
+    writer.Write(std::string_view{courier.courier_type});
+    writer.Write(static_cast<uint32_t>(courier.regions.size()));
+    for (const auto region : courier.regions) writer.Write(region);
+    writer.Write(static_cast<uint32_t>(courier.working_hours.size()));
+    for (const auto& hours : courier.working_hours) {
+      writer.Write(std::string_view{hours});
+    }
+  }
+  return std::move(writer).Finish();
+}
+
+CouriersSnapshot Deserialize(std::string_view data) {
+  DumpReader reader{data};
+  if (reader.Read<uint32_t>() != kDumpMagic) {
+    throw std::runtime_error{"not a courier cache dump"};
+  }
+  if (const auto version = reader.Read<uint32_t>(); version != kDumpVersion) {
+    throw std::runtime_error{fmt::format("dump version {}", version)};
+  }
+
+  CouriersSnapshot snapshot;
+  snapshot.schema_epoch = reader.Read<int64_t>();
+  snapshot.last_event_id = reader.Read<int64_t>();
+  const auto count = reader.Read<uint64_t>();
+  CouriersById couriers;
+  couriers.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    CourierDto courier;
+    courier.courier_id = reader.Read<int64_t>();
+    courier.version = reader.Read<int64_t>();
+    courier.courier_type = reader.ReadString();
+    courier.regions.resize(reader.Read<uint32_t>());
+    for (auto& region : courier.regions) region = reader.Read<int>();
+    courier.working_hours.resize(reader.Read<uint32_t>());
+    for (auto& hours : courier.working_hours) hours = reader.ReadString();
+    couriers.emplace(courier.courier_id, std::move(courier));
+  }
+  if (!reader.Done()) throw std::runtime_error{"trailing data"};
+  snapshot.couriers = std::make_shared<const CouriersById>(std::move(couriers));
+  return snapshot;
+}
+
+}  // namespace
+
+CourierCacheConfig Parse(const userver::formats::json::Value& value,
+                         userver::formats::parse::To<CourierCacheConfig>) {
+  CourierCacheConfig config;
+  config.update_interval = std::chrono::milliseconds{
+      value["update_interval_ms"].As<int64_t>(config.update_interval.count())};
+  config.dump_interval = std::chrono::milliseconds{
+      value["dump_interval_ms"].As<int64_t>(config.dump_interval.count())};
+  config.max_events = value["max_events"].As<size_t>(config.max_events);
+  return config;
+}
+
+CourierCacheConfig ParseCourierCacheConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_COURIER_CACHE").As<CourierCacheConfig>();
+}
+
+CourierCache::CourierCache(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()),
+      pg_cluster_(
+          component_context
+              .FindComponent<userver::components::Postgres>("postgres-db-1")
+              .GetCluster()),
+      statistics_(component_context.FindComponent<Statistics>()),
+      fs_task_processor_(component_context.GetTaskProcessor(
+          config["fs-task-processor"].As<std::string>())),
+      dump_path_(config["dump-path"].As<std::string>()),
+      snapshot_(std::make_shared<const CouriersSnapshot>()) {
+  if (auto dump = ReadDump(); dump && MatchesDatabase(dump.value())) {
+    dumped_event_id_ = dump->last_event_id;
+    snapshot_.Assign(
+        std::make_shared<const CouriersSnapshot>(std::move(dump.value())));
+    loaded_ = true;
+    ++dump_loads_;
+  } else {
+    try {
+      FullLoad();
+    } catch (const std::exception& e) {
+      // Lookups fall back to the DB until the background task loads it.
+      LOG_ERROR() << "Failed to load the courier cache: " << e;
+      ++update_errors_;
+    }
+  }
+
+  // Catch up before the service is ready.
+  const auto cache_config = config_source_.GetCopy(kCourierCacheConfig);
+  try {
+    while (loaded_ && Update(cache_config)) {
+    }
+  } catch (const std::exception& e) {
+    LOG_WARNING() << "Failed to catch up the courier cache: " << e;
+    ++update_errors_;
+  }
+
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-courier-cache",
+              [this](userver::utils::statistics::Writer& writer) {
+                const auto snapshot = Get();
+                writer["couriers"] = snapshot->couriers->size();
+                writer["last-event-id"] = snapshot->last_event_id;
+                writer["full-loads"] = full_loads_.load();
+                writer["dump-loads"] = dump_loads_.load();
+                writer["dump-errors"] = dump_errors_.load();
+                writer["dumps-rejected"] = dumps_rejected_.load();
+                writer["dumps-written"] = dumps_written_.load();
+                writer["update-errors"] = update_errors_.load();
+              });
+
+  task_ = userver::engine::CriticalAsyncNoSpan([this] { Run(); });
+}
+
+CourierCache::~CourierCache() {
+  task_.SyncCancel();
+  statistics_holder_.Unregister();
+  // The next start of the instance catches up from here.
+  try {
+    WriteDump();
+  } catch (const std::exception& e) {
+    LOG_WARNING() << "Failed to dump the courier cache: " << e;
+  }
+}
+
+userver::yaml_config::Schema CourierCache::GetStaticConfigSchema() {
+  return userver::yaml_config::MergeSchemas<LoggableComponentBase>(R"(
+type: object
+description: In-memory couriers by id with dumps to local disk
+additionalProperties: false
+properties:
+    dump-path:
+        type: string
+        description: file the snapshot is dumped to and loaded from on start
+    fs-task-processor:
+        type: string
+        description: task processor for the dump file operations
+)");
+}
+
+void CourierCache::Run() {
+  auto next_dump = std::chrono::steady_clock::now();
+  while (!userver::engine::current_task::ShouldCancel()) {
+    const auto config = config_source_.GetCopy(kCourierCacheConfig);
+    bool behind = false;
+    try {
+      if (!loaded_) FullLoad();
+      behind = Update(config);
+    } catch (const std::exception& e) {
+      if (userver::engine::current_task::ShouldCancel()) return;
+      LOG_WARNING() << "Failed to update the courier cache: " << e;
+      ++update_errors_;
+    }
+
+    if (std::chrono::steady_clock::now() >= next_dump) {
+      try {
+        WriteDump();
+      } catch (const std::exception& e) {
+        LOG_WARNING() << "Failed to dump the courier cache: " << e;
+        ++dump_errors_;
+      }
+      next_dump = std::chrono::steady_clock::now() + config.dump_interval;
+    }
+
+    if (!behind) userver::engine::InterruptibleSleepFor(config.update_interval);
+  }
+}
+
+void CourierCache::FullLoad() {
+  auto transaction = pg_cluster_->Begin(
+      "transaction_load_courier_cache",
+      userver::storages::postgres::ClusterHostType::kSlave, kSnapshotRead);
+  auto snapshot = std::make_shared<CouriersSnapshot>();
+  snapshot->schema_epoch =
+      ExecuteAccounted(statistics_, transaction, kSelectSchemaEpoch)
+          .AsSingleRow<int64_t>();
+  // The couriers read in the same snapshot include every event up to it.
+  snapshot->last_event_id =
+      ExecuteAccounted(statistics_, transaction, kSelectLastEventId)
+          .AsSingleRow<int64_t>();
+  CouriersById couriers;
+  for (auto& courier :
+       ExecuteAccounted(statistics_, transaction, kSelectAllCouriers)
+           .AsContainer<std::vector<CourierDto>>(
+               userver::storages::postgres::kRowTag)) {
+    couriers.emplace(courier.courier_id, std::move(courier));
+  }
+  transaction.Commit();
+  snapshot->couriers = std::make_shared<const CouriersById>(std::move(couriers));
+
+  snapshot_.Assign(std::move(snapshot));
+  loaded_ = true;
+  ++full_loads_;
+}
+
+bool CourierCache::Update(const CourierCacheConfig& config) {
+  const auto current = Get();
+
+  auto transaction = pg_cluster_->Begin(
+      "transaction_update_courier_cache",
+      userver::storages::postgres::ClusterHostType::kSlave, kSnapshotRead);
+  const auto changes =
+      ExecuteAccounted(statistics_, transaction, kSelectChanges,
+                       current->last_event_id,
+                       static_cast<int64_t>(config.max_events))
+          .AsContainer<std::vector<ChangeDto>>(
+              userver::storages::postgres::kRowTag);
+  if (changes.empty()) {
+    transaction.Commit();
+    return false;
+  }
+
+  std::vector<int64_t> courier_ids;
+  for (const auto& change : changes) {
+    if (change.entity == "courier" &&
+        !current->couriers->count(change.entity_id)) {
+      courier_ids.push_back(change.entity_id);
+    }
+  }
+  std::vector<CourierDto> created;
+  if (!courier_ids.empty()) {
+    created = ExecuteAccounted(statistics_, transaction, kSelectCouriersByIds,
+                               courier_ids)
+                  .AsContainer<std::vector<CourierDto>>(
+                      userver::storages::postgres::kRowTag);
+  }
+  transaction.Commit();
+
+  auto snapshot = std::make_shared<CouriersSnapshot>(*current);
+  snapshot->last_event_id = changes.back().event_id;
+  if (!created.empty()) {
+    auto couriers = std::make_shared<CouriersById>(*current->couriers);
+    for (auto& courier : created) {
+      couriers->emplace(courier.courier_id, std::move(courier));
+    }
+    snapshot->couriers = std::move(couriers);
+  }
+  snapshot_.Assign(std::move(snapshot));
+  return changes.size() == config.max_events;
+}
+
+void CourierCache::WriteDump() {
+  const auto snapshot = Get();
+  if (snapshot->last_event_id == dumped_event_id_) return;
+
+  const auto data = Serialize(*snapshot);
+  const auto directory =
+      boost::filesystem::path{dump_path_}.parent_path().string();
+  if (!directory.empty()) {
+    userver::fs::CreateDirectories(fs_task_processor_, directory);
+  }
+  userver::fs::RewriteFileContentsAtomically(
+      fs_task_processor_, dump_path_, data,
+      boost::filesystem::perms::owner_read |
+          boost::filesystem::perms::owner_write);
+  dumped_event_id_ = snapshot->last_event_id;
+  ++dumps_written_;
+}
+
+std::optional<CouriersSnapshot> CourierCache::ReadDump() const {
+  try {
+    if (!userver::fs::FileExists(fs_task_processor_, dump_path_)) {
+      return std::nullopt;
+    }
+    return Deserialize(
+        userver::fs::ReadFileContents(fs_task_processor_, dump_path_));
+  } catch (const std::exception& e) {
+    LOG_WARNING() << "Ignoring the courier cache dump " << dump_path_ << ": "
+                  << e;
+    return std::nullopt;
+  }
+}
+
+bool CourierCache::MatchesDatabase(const CouriersSnapshot& dump) {
+  int64_t schema_epoch = 0;
+  int64_t last_event_id = 0;
+  try {
+    auto transaction = pg_cluster_->Begin(
+        "transaction_check_courier_cache_dump",
+        userver::storages::postgres::ClusterHostType::kSlave, kSnapshotRead);
+    schema_epoch =
+        ExecuteAccounted(statistics_, transaction, kSelectSchemaEpoch)
+            .AsSingleRow<int64_t>();
+    last_event_id =
+        ExecuteAccounted(statistics_, transaction, kSelectLastEventId)
+            .AsSingleRow<int64_t>();
+    transaction.Commit();
+  } catch (const std::exception& e) {
+    // Not served unchecked, lookups fall back to the DB until a full load.
+    LOG_WARNING() << "Failed to check the courier cache dump: " << e;
+    ++dumps_rejected_;
+    return false;
+  }
+
+  // After the schema is recreated the change log starts over, its event
+  // ids would skip the new couriers up to the dumped one.
+  if (dump.schema_epoch != schema_epoch ||
+      dump.last_event_id > last_event_id) {
+    LOG_WARNING() << "Ignoring the courier cache dump " << dump_path_
+                  << " of schema epoch " << dump.schema_epoch << " at event "
+                  << dump.last_event_id << ", the database is at epoch "
+                  << schema_epoch << " event " << last_event_id;
+    ++dumps_rejected_;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace lavka
@@ -0,0 +1,111 @@
+#ifndef LAVKA_COURIERCACHE_H
+#define LAVKA_COURIERCACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/task/task_processor_fwd.hpp>
+#include <userver/engine/task/task_with_result.hpp>
+#include <userver/rcu/rcu.hpp>
+#include <userver/utils/statistics/entry.hpp>
+#include <userver/yaml_config/schema.hpp>
+
+#include "CouriersHandler.h"
+
+namespace lavka {
+
+class Statistics;
+
+struct CourierCacheConfig {
+  std::chrono::milliseconds update_interval{1000};
+  std::chrono::milliseconds dump_interval{60000};
+  // Change log events read per update.
+  size_t max_events{10000};
+};
+
+CourierCacheConfig Parse(const userver::formats::json::Value& value,
+                         userver::formats::parse::To<CourierCacheConfig>);
+
+CourierCacheConfig ParseCourierCacheConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseCourierCacheConfig>
+    kCourierCacheConfig;
+
+using CouriersById = std::unordered_map<int64_t, CourierDto>;
+
+// Couriers without completed_orders, as of change log event
+// last_event_id of the schema created as schema_epoch. Snapshots that only
+// advance last_event_id share the map.
+struct CouriersSnapshot {
+  int64_t schema_epoch{0};
+  int64_t last_event_id{0};
+  std::shared_ptr<const CouriersById> couriers{
+      std::make_shared<const CouriersById>()};
+};
+
+// In-memory copy of the couriers table for lookups by id. Couriers never
+// change after they are created, so the copy is caught up from the
+// "created" events of service_schema.change_log rather than reloaded.
+// Reads go to a replica.
+//
+// The snapshot is dumped to `dump-path` every dump_interval and on
+// shutdown. On start the dump is loaded and caught up from the change log,
+// so a restart does not need a full table load; a missing, outdated or
+// corrupted dump, or one of another schema epoch or ahead of the change
+// log, falls back to one. A courier missing from the cache may
+// just be too new, callers look such ids up in the DB.
+class CourierCache final : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-courier-cache";
+
+  CourierCache(const userver::components::ComponentConfig& config,
+               const userver::components::ComponentContext& component_context);
+  ~CourierCache() override;
+
+  static userver::yaml_config::Schema GetStaticConfigSchema();
+
+  std::shared_ptr<const CouriersSnapshot> Get() const {
+    return snapshot_.ReadCopy();
+  }
+
+ private:
+  void Run();
+  void FullLoad();
+  // Returns whether there were new events.
+  bool Update(const CourierCacheConfig& config);
+  void WriteDump();
+  std::optional<CouriersSnapshot> ReadDump() const;
+  // Whether the dump was taken from the database the cache reads.
+  bool MatchesDatabase(const CouriersSnapshot& dump);
+
+  userver::dynamic_config::Source config_source_;
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  userver::engine::TaskProcessor& fs_task_processor_;
+  const std::string dump_path_;
+
+  userver::rcu::Variable<std::shared_ptr<const CouriersSnapshot>> snapshot_;
+  bool loaded_{false};
+  int64_t dumped_event_id_{-1};
+
+  std::atomic<uint64_t> full_loads_{0};
+  std::atomic<uint64_t> dump_loads_{0};
+  std::atomic<uint64_t> dump_errors_{0};
+  std::atomic<uint64_t> dumps_rejected_{0};
+  std::atomic<uint64_t> dumps_written_{0};
+  std::atomic<uint64_t> update_errors_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+
+  userver::engine::TaskWithResult<void> task_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_COURIERCACHE_H
@@ -1,5 +1,15 @@
 #include "CouriersHandler.h"
+#include "CourierCache.h"
 #include <fstream>
+#include <unordered_map>
+
+#include "../changes/ChangeFeed.h"
+#include "../compression/ResponseCompressor.h"
+#include "../formats/BodyFormat.h"
+#include "../hours/TimeWindow.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
 
 namespace lavka {
 
@@ -16,27 +26,123 @@ int64_t CourierIdManager::GetNewId() {
     return -1;  // exc_max_couriers + response 400 bad request
 }
 
-userver::formats::json::Value Serialize(
-    const CourierDto& data,
-    userver::formats::serialize::To<userver::formats::json::Value>) {
-  userver::formats::json::ValueBuilder jsonCourier;
-  jsonCourier["courier_id"] = data.courier_id;
-  jsonCourier["courier_type"] = data.courier_type;
-  jsonCourier["regions"] = data.regions;
-  jsonCourier["working_hours"] = data.working_hours;
-  if (data.completed_orders.has_value()) {
-    jsonCourier["completed_orders"] = data.completed_orders.value();
+bool IsCourierJsonValid(const userver::formats::json::Value& courier_json) {
+  try {
+    if (courier_json.GetSize() != 3) return false;
+
+    if (!(courier_json.HasMember("courier_type") &&
+          courier_json.HasMember("regions") &&
+          courier_json.HasMember("working_hours")))
+      return false;
+
+    if (courier_json["courier_type"].As<std::string>() != courierType::foot &&
+        courier_json["courier_type"].As<std::string>() != courierType::bike &&
+        courier_json["courier_type"].As<std::string>() != courierType::_auto)
+      return false;
+
+    if (courier_json["regions"].IsEmpty()) return false;
+
+    for (const auto& region : courier_json["regions"]) {
+      region.As<int>();
+    }
+
+    if (courier_json["working_hours"].IsEmpty()) return false;
+
+    for (const auto& working_hour : courier_json["working_hours"]) {
+      if (!IsValidHours(working_hour.As<std::string>())) return false;
+    }
+
+  } catch (...) {
+    return false;
   }
-  return jsonCourier.ExtractValue();
+
+  return true;
 }
 
 namespace {
 
+// Shared by the JSON and BSON bodies.
+template <typename Value>
+std::optional<std::pmr::vector<NewCourierDto>> ParseNewCouriersImpl(
+    const Value& couriers_json, RequestArena& arena) {
+  auto couriers = arena.MakeVector<NewCourierDto>();
+  couriers.reserve(couriers_json.GetSize());
+  // Checked together after the loop.
+  auto all_hours = arena.MakeVector<std::string_view>();
+  try {
+    for (const auto& courier_json : couriers_json) {
+      if (courier_json.GetSize() != 3 ||
+          !courier_json.HasMember("courier_type") ||
+          !courier_json.HasMember("regions") ||
+          !courier_json.HasMember("working_hours"))
+        return std::nullopt;
+
+      auto& courier = couriers.emplace_back(
+          NewCourierDto{{},
+                        arena.MakeVector<int>(),
+                        arena.MakeVector<std::string_view>()});
+      const auto type = StringOf(courier_json["courier_type"]);
+      for (const auto known :
+           {courierType::foot, courierType::bike, courierType::_auto}) {
+        if (type == known) courier.courier_type = known;
+      }
+      if (courier.courier_type.empty()) return std::nullopt;
+
+      const auto regions = courier_json["regions"];
+      if (regions.IsEmpty()) return std::nullopt;
+      courier.regions.reserve(regions.GetSize());
+      for (const auto& region : regions) {
+        courier.regions.push_back(region.template As<int>());
+      }
+
+      const auto working_hours = courier_json["working_hours"];
+      if (working_hours.IsEmpty()) return std::nullopt;
+      courier.working_hours.reserve(working_hours.GetSize());
+      for (const auto& working_hour : working_hours) {
+        courier.working_hours.push_back(arena.Copy(StringOf(working_hour)));
+        all_hours.push_back(courier.working_hours.back());
+      }
+    }
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  auto windows = arena.MakeVector<TimeWindow>();
+  windows.resize(all_hours.size());
+  if (ParseTimeWindows(all_hours.data(), all_hours.size(), windows.data()) !=
+      all_hours.size())
+    return std::nullopt;
+  return couriers;
+}
+
+}  // namespace
+
+std::optional<std::pmr::vector<NewCourierDto>> ParseNewCouriers(
+    const userver::formats::json::Value& couriers_json, RequestArena& arena) {
+  return ParseNewCouriersImpl(couriers_json, arena);
+}
+
+std::optional<std::pmr::vector<NewCourierDto>> ParseNewCouriers(
+    const BsonValue& couriers_json, RequestArena& arena) {
+  return ParseNewCouriersImpl(couriers_json, arena);
+}
+
+namespace {
+
+constexpr size_t kMaxIdsCount = 1000;
+
 class CouriersHandler final
     : public userver::server::handlers::HttpHandlerBase {
  public:
   static constexpr std::string_view kName = "handler-couriers";
   userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+  ChangeFeed& change_feed_;
+  CourierCache& courier_cache_;
+  ResponseCompressor& response_compressor_;
 
   CouriersHandler(
       const userver::components::ComponentConfig& config,
@@ -45,16 +151,35 @@ class CouriersHandler final
         pg_cluster_(
             component_context
                 .FindComponent<userver::components::Postgres>("postgres-db-1")
-                .GetCluster()){};
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()),
+        change_feed_(component_context.FindComponent<ChangeFeed>()),
+        courier_cache_(component_context.FindComponent<CourierCache>()),
+        response_compressor_(
+            component_context.FindComponent<ResponseCompressor>()){};
 
   std::string HandleRequestThrow(
       const userver::server::http::HttpRequest& request,
       userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    auto slot = concurrency_limiter_.TryAcquire(
+        request,
+        request.GetMethod() == userver::server::http::HttpMethod::kPost
+            ? Priority::kLow
+            : Priority::kHigh);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
     switch (request.GetMethod()) {
       case userver::server::http::HttpMethod::kGet:
-        return GetCouriers(request);
+        return response_compressor_.Compress(request,
+                                             GetCouriers(request, scope));
       case userver::server::http::HttpMethod::kPost:
-        return PostCouriers(request);
+        return PostCouriers(request, scope);
       default:
         throw userver::server::handlers::ClientError(
             userver::server::handlers::ExternalBody{
@@ -62,47 +187,20 @@ class CouriersHandler final
     }
   }
 
-  bool IsCourierJsonValid(
-      const userver::formats::json::Value& courier_json) const {
-    try {
-      if (courier_json.GetSize() != 3) return false;
-
-      if (!(courier_json.HasMember("courier_type") &&
-            courier_json.HasMember("regions") &&
-            courier_json.HasMember("working_hours")))
-        return false;
-
-      if (courier_json["courier_type"].As<std::string>() != courierType::foot &&
-          courier_json["courier_type"].As<std::string>() != courierType::bike &&
-          courier_json["courier_type"].As<std::string>() != courierType::_auto)
-        return false;
-
-      if (courier_json["regions"].IsEmpty()) return false;
-
-      for (const auto& region : courier_json["regions"]) {
-        region.As<int>();
-      }
-
-      if (courier_json["working_hours"].IsEmpty()) return false;
-
-      for (const auto& working_hour : courier_json["working_hours"]) {
-        if (!IsValidHours(working_hour.As<std::string>())) return false;
-      }
-
-    } catch (...) {
-      return false;
-    }
-
-    return true;
-  }
-
   const userver::storages::postgres::Query kSelectCouriers{
       "SELECT * from service_schema.couriers LIMIT $2 OFFSET $1",
       userver::storages::postgres::Query::Name{"select_couriers"},
   };
 
-  std::string GetCouriers(
-      const userver::server::http::HttpRequest& request) const {
+  const userver::storages::postgres::Query kSelectCouriersByIds{
+      "SELECT * from service_schema.couriers WHERE courier_id = ANY($1)",
+      userver::storages::postgres::Query::Name{"select_couriers_by_ids"},
+  };
+
+  std::string GetCouriers(const userver::server::http::HttpRequest& request,
+                          RequestScope& scope) const {
+    if (request.HasArg("ids")) return GetCouriersByIds(request, scope);
+
     if (request.ArgCount() > 2) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
@@ -130,25 +228,81 @@ class CouriersHandler final
       return {};
     }
 
-    userver::storages::postgres::ResultSet res = pg_cluster_->Execute(
-        userver::storages::postgres::ClusterHostType::kSlave, kSelectCouriers,
-        offset, limit);
+    userver::storages::postgres::ResultSet res = scope.Execute(
+        pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
+        kSelectCouriers, offset, limit);
 
     auto resVec = res.AsSetOf<CourierDto>(userver::storages::postgres::kRowTag);
 
-    userver::formats::json::ValueBuilder couriersBuilder{resVec};
-    for (auto& courier : couriersBuilder) {
-      if (courier.HasMember("completed_orders"))
-        courier.Remove("completed_orders");
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto response) {
+      decltype(response) couriers{userver::formats::common::Type::kArray};
+      for (auto courier : resVec) {
+        courier.completed_orders.reset();
+        couriers.PushBack(courier);
+      }
+      response["couriers"] = couriers.ExtractValue();
+      response["offset"] = offset;
+      response["limit"] = limit;
+      return response.ExtractValue();
+    });
+  }
+
+  // GET /couriers?ids=1,2,3: the couriers in the requested order and the
+  // ids that do not exist. Served from the courier cache, only ids missing
+  // from it are looked up in the DB.
+  std::string GetCouriersByIds(
+      const userver::server::http::HttpRequest& request,
+      RequestScope& scope) const {
+    const auto ids = ParseIds(request.GetArg("ids"), kMaxIdsCount);
+    if (request.ArgCount() > 1 || !ids.has_value()) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    const auto cached = courier_cache_.Get();
+    std::unordered_map<int64_t, const CourierDto*> found;
+    std::vector<int64_t> missing;
+    for (const auto id : ids.value()) {
+      const auto it = cached->couriers->find(id);
+      if (it == cached->couriers->end()) {
+        missing.push_back(id);
+      } else {
+        found.emplace(id, &it->second);
+      }
     }
-    auto couriersJson = couriersBuilder.ExtractValue();
 
-    userver::formats::json::ValueBuilder responseJson;
-    responseJson["couriers"] = couriersJson;
-    responseJson["offset"] = offset;
-    responseJson["limit"] = limit;
+    std::vector<CourierDto> loaded;
+    if (!missing.empty()) {
+      loaded = scope
+                   .Execute(pg_cluster_,
+                            userver::storages::postgres::ClusterHostType::kSlave,
+                            kSelectCouriersByIds, missing)
+                   .AsContainer<std::vector<CourierDto>>(
+                       userver::storages::postgres::kRowTag);
+    }
 
-    return userver::formats::json::ToStableString(responseJson.ExtractValue());
+    const auto timer = scope.Time(Stage::kSerialize);
+    for (auto& courier : loaded) {
+      courier.completed_orders.reset();
+      found.emplace(courier.courier_id, &courier);
+    }
+
+    return SerializeBody(request, [&](auto response) {
+      decltype(response) couriers{userver::formats::common::Type::kArray};
+      decltype(response) notFound{userver::formats::common::Type::kArray};
+      for (const auto id : ids.value()) {
+        const auto it = found.find(id);
+        if (it == found.end()) {
+          notFound.PushBack(id);
+        } else {
+          couriers.PushBack(*it->second);
+        }
+      }
+      response["couriers"] = couriers.ExtractValue();
+      response["not_found"] = notFound.ExtractValue();
+      return response.ExtractValue();
+    });
   }
 
   const userver::storages::postgres::Query kInsertCouriers{
@@ -158,73 +312,88 @@ class CouriersHandler final
       userver::storages::postgres::Query::Name{"insert_couriers"},
   };
 
-  std::string PostCouriers(
-      const userver::server::http::HttpRequest& request) const {
-    userver::formats::json::Value couriers_arr;
-
+  std::string PostCouriers(const userver::server::http::HttpRequest& request,
+                           RequestScope& scope) const {
     if(request.ArgCount() > 0) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
     }
 
-    try {
-      couriers_arr = userver::formats::json::FromString(request.RequestBody());
-
-      if (couriers_arr.IsEmpty() || !couriers_arr.IsArray()) {
+    // Freed at once when the request ends, the JSON tree is dropped as
+    // soon as the couriers are built.
+    RequestArena arena{request.RequestBody().size()};
+    std::optional<std::pmr::vector<NewCourierDto>> couriers;
+    {
+      std::optional<RequestBody> body;
+      {
+        const auto timer = scope.Time(Stage::kParse);
+        body = ParseBody(request);
+      }
+      if (!body.has_value() ||
+          std::visit(
+              [](const auto& value) {
+                return !value.IsArray() || value.IsEmpty();
+              },
+              body.value())) {
         request.SetResponseStatus(
             userver::server::http::HttpStatus::kBadRequest);
         return {};
       }
 
-    } catch (const userver::formats::json::Exception& exc) {
-      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
-      return {};
-    }
-
-    for (const auto& single_courier : couriers_arr) {
-      if (!IsCourierJsonValid(single_courier)) {
+      const auto timer = scope.Time(Stage::kValidate);
+      couriers = std::visit(
+          [&](const auto& value) { return ParseNewCouriers(value, arena); },
+          body.value());
+      if (!couriers.has_value()) {
         request.SetResponseStatus(
             userver::server::http::HttpStatus::kBadRequest);
         return {};
       }
     }
 
-    std::lock_guard<userver::engine::Mutex> lock(
-        DatabaseAccessManager::GetCouriersMutex());
+    const auto lock = scope.Lock(DatabaseAccessManager::GetCouriersMutex());
 
-    userver::formats::json::ValueBuilder responseBuilder;
-
-    for (const auto& single_courier : couriers_arr) {
+    // All or nothing: if the deadline expires midway the transaction rolls
+    // back, so a 504 never leaves couriers the client has no ids for.
+    userver::storages::postgres::Transaction transaction = scope.Begin(
+        pg_cluster_, "transaction_insert_couriers",
+        userver::storages::postgres::ClusterHostType::kMaster);
+    std::vector<int64_t> created_ids;
+    for (auto& courier : couriers.value()) {
       int64_t courier_id = CourierIdManager::GetNewId();
-      auto type = single_courier["courier_type"].As<std::string>();
-      auto regions_arr = single_courier["regions"].As<std::vector<int>>();
-      auto hours_arr =
-          single_courier["working_hours"].As<std::vector<std::string>>();
-
-      userver::storages::postgres::Transaction transaction = pg_cluster_->Begin(
-          "transaction_insert_courier_value",
-          userver::storages::postgres::ClusterHostType::kMaster, {});
 
-      auto res = transaction.Execute(kInsertCouriers, courier_id, type,
-                                     regions_arr, hours_arr);
-
-      userver::formats::json::ValueBuilder courierDO_builder{single_courier};
-      courierDO_builder["courier_id"] = courier_id;
+      auto res = scope.Execute(transaction, kInsertCouriers, courier_id,
+                               courier.courier_type, courier.regions,
+                               courier.working_hours);
 
       if (res.RowsAffected()) {
-        transaction.Commit();
-        responseBuilder.PushBack(courierDO_builder.ExtractValue());
+        created_ids.push_back(courier_id);
+        courier.courier_id = courier_id;
       }
     }
+    if (!created_ids.empty()) {
+      scope.Execute(transaction, kRecordCreated, std::string{"courier"},
+                    created_ids);
+    }
+    scope.Commit(transaction);
 
-    return userver::formats::json::ToStableString(
-        responseBuilder.ExtractValue());
+    if (!created_ids.empty()) change_feed_.Notify();
+
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto response) {
+      response = decltype(response){userver::formats::common::Type::kArray};
+      for (const auto& courier : couriers.value()) {
+        if (courier.courier_id != 0) response.PushBack(courier);
+      }
+      return response.ExtractValue();
+    });
   }
 };
 
 }  // namespace
 
 void AppendCouriers(userver::components::ComponentList& component_list) {
+  component_list.Append<CourierCache>();
   component_list.Append<CouriersHandler>();
 }
 
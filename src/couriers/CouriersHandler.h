@@ -2,15 +2,20 @@
 #define LAVKA_COURIERSHANDLER_H
 
 #include "../lavka.h"
+#include "../memory/RequestArena.h"
 
 namespace lavka {
 
+class BsonValue;
+
 struct CourierDto {
   int64_t courier_id;
   std::string courier_type;
   std::vector<int> regions;
   std::vector<std::string> working_hours;
   std::optional<std::vector<int64_t>> completed_orders;
+  // Not serialized, completed_orders does not change it.
+  int64_t version{0};
 };
 
 namespace courierType {
@@ -19,6 +24,16 @@ inline constexpr std::string_view bike{"BIKE"};
 inline constexpr std::string_view _auto{"AUTO"};
 }  // namespace courierType
 
+// A courier of a POST /couriers body, allocated in the request arena.
+struct NewCourierDto {
+  // One of courierType.
+  std::string_view courier_type;
+  std::pmr::vector<int> regions;
+  std::pmr::vector<std::string_view> working_hours;
+  // Set once the courier is inserted.
+  int64_t courier_id{0};
+};
+
 class CourierIdManager {
   static int64_t last_id_;
   static userver::engine::Mutex mutex_;
@@ -27,9 +42,41 @@ class CourierIdManager {
   static int64_t GetNewId();
 };
 
-userver::formats::json::Value Serialize(const CourierDto& data,
-    userver::formats::serialize::To<userver::formats::json::Value>);
+// Shared by the JSON and BSON responses.
+template <typename Value>
+Value Serialize(const CourierDto& data,
+                userver::formats::serialize::To<Value>) {
+  typename Value::Builder courier;
+  courier["courier_id"] = data.courier_id;
+  courier["courier_type"] = data.courier_type;
+  courier["regions"] = data.regions;
+  courier["working_hours"] = data.working_hours;
+  if (data.completed_orders.has_value()) {
+    courier["completed_orders"] = data.completed_orders.value();
+  }
+  return courier.ExtractValue();
+}
+
+template <typename Value>
+Value Serialize(const NewCourierDto& data,
+                userver::formats::serialize::To<Value>) {
+  typename Value::Builder courier;
+  courier["courier_type"] = data.courier_type;
+  courier["regions"] = data.regions;
+  courier["working_hours"] = data.working_hours;
+  courier["courier_id"] = data.courier_id;
+  return courier.ExtractValue();
+}
+
+bool IsCourierJsonValid(const userver::formats::json::Value& courier_json);
 
+// Validates the couriers of a POST /couriers body as IsCourierJsonValid
+// does and builds them in the arena in the same pass. nullopt if any of
+// them is invalid.
+std::optional<std::pmr::vector<NewCourierDto>> ParseNewCouriers(
+    const userver::formats::json::Value& couriers_json, RequestArena& arena);
+std::optional<std::pmr::vector<NewCourierDto>> ParseNewCouriers(
+    const BsonValue& couriers_json, RequestArena& arena);
 
 void AppendCouriers(userver::components::ComponentList& component_list);
 
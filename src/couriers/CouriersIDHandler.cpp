@@ -1,6 +1,13 @@
 
 #include "CouriersIDHandler.h"
 
+#include "CourierCache.h"
+
+#include "../formats/BodyFormat.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
 namespace lavka {
 
 namespace {
@@ -9,6 +16,11 @@ class CouriersIdHandler final
  public:
   static constexpr std::string_view kName = "handler-couriers-id";
   userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+  CourierCache& courier_cache_;
 
   CouriersIdHandler(
       const userver::components::ComponentConfig& config,
@@ -17,14 +29,25 @@ class CouriersIdHandler final
         pg_cluster_(
             component_context
                 .FindComponent<userver::components::Postgres>("postgres-db-1")
-                .GetCluster()){};
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()),
+        courier_cache_(component_context.FindComponent<CourierCache>()){};
 
   std::string HandleRequestThrow(
       const userver::server::http::HttpRequest& request,
       userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    auto slot = concurrency_limiter_.TryAcquire(request, Priority::kHigh);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
     switch (request.GetMethod()) {
       case userver::server::http::HttpMethod::kGet:
-        return GetSpecificCourier(request);
+        return GetSpecificCourier(request, scope);
       default:
         throw userver::server::handlers::ClientError(
             userver::server::handlers::ExternalBody{
@@ -38,7 +61,8 @@ class CouriersIdHandler final
   };
 
   std::string GetSpecificCourier(
-      const userver::server::http::HttpRequest& request) const {
+      const userver::server::http::HttpRequest& request,
+      RequestScope& scope) const {
     if(request.ArgCount() > 0) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
@@ -55,8 +79,22 @@ class CouriersIdHandler final
       return {};
     }
 
-    userver::storages::postgres::ResultSet res = pg_cluster_->Execute(
-        userver::storages::postgres::ClusterHostType::kSlave,
+    const auto cached = courier_cache_.Get();
+    if (const auto it = cached->couriers->find(courier_id);
+        it != cached->couriers->end()) {
+      if (IsNotModified(request, MakeETag(it->second.version,
+                                          AcceptedFormat(request)))) {
+        return {};
+      }
+      const auto timer = scope.Time(Stage::kSerialize);
+      return SerializeBody(request, [&](auto builder) {
+        return decltype(builder){it->second}.ExtractValue();
+      });
+    }
+
+    // Too new for the cache, or does not exist.
+    userver::storages::postgres::ResultSet res = scope.Execute(
+        pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
         kSelectSpecificCourier, courier_id);
 
     if (res.IsEmpty()) {
@@ -66,13 +104,16 @@ class CouriersIdHandler final
 
     auto resValue =
         res.AsSingleRow<CourierDto>(userver::storages::postgres::kRowTag);
+    if (IsNotModified(request,
+                      MakeETag(resValue.version, AcceptedFormat(request)))) {
+      return {};
+    }
 
-    userver::formats::json::ValueBuilder courierBuilder{resValue};
-    if (courierBuilder.HasMember("completed_orders"))
-      courierBuilder.Remove("completed_orders");
-    auto courierJson = courierBuilder.ExtractValue();
-
-    return userver::formats::json::ToStableString(courierJson);
+    const auto timer = scope.Time(Stage::kSerialize);
+    resValue.completed_orders.reset();
+    return SerializeBody(request, [&](auto builder) {
+      return decltype(builder){resValue}.ExtractValue();
+    });
   }
 };
 }  // namespace
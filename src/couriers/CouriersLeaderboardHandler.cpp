@@ -0,0 +1,278 @@
+#include "CouriersLeaderboardHandler.h"
+
+#include <algorithm>
+#include <queue>
+#include <tuple>
+
+#include <userver/utils/async.hpp>
+
+#include "../formats/BodyFormat.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
+namespace lavka {
+
+namespace {
+
+struct CourierTotalsRow {
+  int64_t courier_id;
+  std::string courier_type;
+  int64_t completed_orders;
+  int64_t cost_sum;
+};
+
+struct LeaderboardEntry {
+  int64_t courier_id;
+  std::string courier_type;
+  int64_t earnings;
+  std::optional<int64_t> rating;
+  int64_t score;
+};
+
+// Higher score first, lower courier_id first among equal scores.
+bool IsRankedHigher(const LeaderboardEntry& lhs, const LeaderboardEntry& rhs) {
+  if (lhs.score != rhs.score) return lhs.score > rhs.score;
+  return lhs.courier_id < rhs.courier_id;
+}
+
+// Keeps the `limit` best entries, the worst one on top.
+class BoundedHeap final {
+ public:
+  explicit BoundedHeap(size_t limit) : limit_(limit) {}
+
+  void Push(LeaderboardEntry&& entry) {
+    if (heap_.size() < limit_) {
+      heap_.push(std::move(entry));
+    } else if (IsRankedHigher(entry, heap_.top())) {
+      heap_.pop();
+      heap_.push(std::move(entry));
+    }
+  }
+
+  std::vector<LeaderboardEntry> Extract() && {
+    std::vector<LeaderboardEntry> entries;
+    entries.reserve(heap_.size());
+    while (!heap_.empty()) {
+      entries.push_back(heap_.top());
+      heap_.pop();
+    }
+    return entries;
+  }
+
+ private:
+  std::priority_queue<LeaderboardEntry, std::vector<LeaderboardEntry>,
+                      decltype(&IsRankedHigher)>
+      heap_{&IsRankedHigher};
+  size_t limit_;
+};
+
+enum class Metric { kEarnings, kRating };
+
+constexpr int kShardsCount = 8;
+constexpr size_t kDefaultLimit = 100;
+constexpr size_t kMaxLimit = 1000;
+
+class CouriersLeaderboardHandler final
+    : public userver::server::handlers::HttpHandlerBase {
+ public:
+  static constexpr std::string_view kName = "handler-couriers-leaderboard";
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+
+  CouriersLeaderboardHandler(
+      const userver::components::ComponentConfig& config,
+      const userver::components::ComponentContext& component_context)
+      : HttpHandlerBase(config, component_context),
+        pg_cluster_(
+            component_context
+                .FindComponent<userver::components::Postgres>("postgres-db-1")
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()){};
+
+  std::string HandleRequestThrow(
+      const userver::server::http::HttpRequest& request,
+      userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    // The shards hold that many connections at once.
+    auto slot =
+        concurrency_limiter_.TryAcquire(request, Priority::kLow, kShardsCount);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
+    switch (request.GetMethod()) {
+      case userver::server::http::HttpMethod::kGet:
+        return GetLeaderboard(request, scope);
+      default:
+        throw userver::server::handlers::ClientError(
+            userver::server::handlers::ExternalBody{
+                fmt::format("Unsupported method {}", request.GetMethod())});
+    }
+  }
+
+  const userver::storages::postgres::Query kSelectTimeDiffInSeconds{
+      "SELECT service_schema.CalculateTimestampDiffInSeconds"
+      "(CAST($1 as TIMESTAMP),CAST($2 as TIMESTAMP)) as result",
+      userver::storages::postgres::Query::Name{"select_time_diff_in_seconds"},
+  };
+
+  const userver::storages::postgres::Query kSelectCourierIdRange{
+      "SELECT COALESCE(MIN(courier_id), 0), COALESCE(MAX(courier_id), -1) "
+      "FROM service_schema.couriers",
+      userver::storages::postgres::Query::Name{
+          "select_leaderboard_courier_id_range"},
+  };
+
+  // One shard: the couriers with $3 <= courier_id < $4. The shards scan
+  // disjoint ranges of orders_courier_id_complete_time_idx, together the
+  // completion range is read once.
+  const userver::storages::postgres::Query kSelectShardTotals{
+      "SELECT c.courier_id, c.courier_type, "
+      "COUNT(*) as completed_orders, SUM(o.cost) as cost_sum "
+      "FROM service_schema.orders o "
+      "JOIN service_schema.couriers c ON c.courier_id = o.courier_id "
+      "WHERE o.courier_id >= $3 AND o.courier_id < $4 "
+      "AND o.complete_time >= CAST($1 as TIMESTAMP) "
+      "AND o.complete_time < CAST($2 as TIMESTAMP) "
+      "AND ($5::INTEGER IS NULL OR $5 = ANY(c.regions)) "
+      "GROUP BY c.courier_id",
+      userver::storages::postgres::Query::Name{"select_leaderboard_shard"},
+  };
+
+  // Query: startDate, endDate, metric=earnings|rating, limit (up to 1000),
+  // region.
+  std::string GetLeaderboard(const userver::server::http::HttpRequest& request,
+                             RequestScope& scope) const {
+    std::string startDate, endDate;
+    auto metric = Metric::kEarnings;
+    size_t limit = kDefaultLimit;
+    std::optional<int> region;
+    try {
+      startDate = request.GetArg("startDate");
+      endDate = request.GetArg("endDate");
+      if (startDate.empty() || endDate.empty()) {
+        request.SetResponseStatus(
+            userver::server::http::HttpStatus::kBadRequest);
+        return {};
+      }
+      if (request.HasArg("metric")) {
+        const auto& metric_name = request.GetArg("metric");
+        if (metric_name == "rating") {
+          metric = Metric::kRating;
+        } else if (metric_name != "earnings") {
+          request.SetResponseStatus(
+              userver::server::http::HttpStatus::kBadRequest);
+          return {};
+        }
+      }
+      if (request.HasArg("limit")) limit = std::stoul(request.GetArg("limit"));
+      if (request.HasArg("region")) region = std::stoi(request.GetArg("region"));
+    } catch (...) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+    if (limit == 0 || limit > kMaxLimit) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    const auto timeDiffInSeconds =
+        scope
+            .Execute(pg_cluster_,
+                     userver::storages::postgres::ClusterHostType::kSlave,
+                     kSelectTimeDiffInSeconds, startDate, endDate)
+            .AsSingleRow<int>();
+    const int64_t range_hours = timeDiffInSeconds / 3600;
+    if (metric == Metric::kRating && range_hours <= 0) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    // Equal courier_id ranges, a courier is in exactly one shard.
+    const auto [min_courier_id, max_courier_id] =
+        scope
+            .Execute(pg_cluster_,
+                     userver::storages::postgres::ClusterHostType::kSlave,
+                     kSelectCourierIdRange)
+            .AsSingleRow<std::tuple<int64_t, int64_t>>(
+                userver::storages::postgres::kRowTag);
+    const auto shard_size =
+        (max_courier_id - min_courier_id) / kShardsCount + 1;
+
+    std::vector<LeaderboardEntry> leaders;
+    {
+      const auto timer = scope.Time(Stage::kDb);
+
+      std::vector<userver::engine::TaskWithResult<std::vector<LeaderboardEntry>>>
+          shards;
+      shards.reserve(kShardsCount);
+      for (int64_t from = min_courier_id; from <= max_courier_id;
+           from += shard_size) {
+        shards.push_back(userver::utils::Async(
+            "leaderboard_shard", [&, from] {
+              const auto res = scope.ExecuteConcurrently(
+                  pg_cluster_,
+                  userver::storages::postgres::ClusterHostType::kSlave,
+                  kSelectShardTotals, startDate, endDate, from,
+                  from + shard_size, region);
+
+              BoundedHeap heap{limit};
+              for (auto row : res.AsSetOf<CourierTotalsRow>(
+                       userver::storages::postgres::kRowTag)) {
+                const auto earnings =
+                    row.cost_sum * EarningsCoefficient(row.courier_type);
+                LeaderboardEntry entry{row.courier_id,
+                                       std::move(row.courier_type), earnings,
+                                       std::nullopt, 0};
+                if (range_hours > 0) {
+                  entry.rating = (row.completed_orders / range_hours) *
+                                 RatingCoefficient(entry.courier_type);
+                }
+                entry.score = metric == Metric::kEarnings
+                                  ? entry.earnings
+                                  : entry.rating.value_or(0);
+                heap.Push(std::move(entry));
+              }
+              return std::move(heap).Extract();
+            }));
+      }
+
+      BoundedHeap merged{limit};
+      for (auto& shard : shards) {
+        for (auto& entry : shard.Get()) merged.Push(std::move(entry));
+      }
+      leaders = std::move(merged).Extract();
+    }
+    std::reverse(leaders.begin(), leaders.end());
+
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto response) {
+      response = decltype(response){userver::formats::common::Type::kArray};
+      for (const auto& entry : leaders) {
+        decltype(response) item;
+        item["courier_id"] = entry.courier_id;
+        item["courier_type"] = entry.courier_type;
+        item["earnings"] = entry.earnings;
+        if (entry.rating.has_value()) item["rating"] = entry.rating.value();
+        response.PushBack(item.ExtractValue());
+      }
+      return response.ExtractValue();
+    });
+  }
+};
+
+}  // namespace
+
+void AppendCouriersLeaderboard(
+    userver::components::ComponentList& component_list) {
+  component_list.Append<CouriersLeaderboardHandler>();
+}
+
+}  // namespace lavka
@@ -0,0 +1,13 @@
+#ifndef LAVKA_COURIERSLEADERBOARDHANDLER_H
+#define LAVKA_COURIERSLEADERBOARDHANDLER_H
+
+#include "CouriersMetaInfoHandler.h"
+
+namespace lavka {
+
+void AppendCouriersLeaderboard(
+    userver::components::ComponentList& component_list);
+
+}  // namespace lavka
+
+#endif  // LAVKA_COURIERSLEADERBOARDHANDLER_H
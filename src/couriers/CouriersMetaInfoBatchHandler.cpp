@@ -0,0 +1,244 @@
+#include "CouriersMetaInfoBatchHandler.h"
+
+#include <utility>
+
+#include <userver/formats/json/serialize.hpp>
+#include <userver/server/http/http_response_body_stream.hpp>
+
+#include "../compression/ResponseCompressor.h"
+#include "../formats/BodyFormat.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
+namespace lavka {
+
+namespace {
+
+struct CourierMetaInfoRow {
+  int64_t courier_id;
+  std::string courier_type;
+  std::vector<int> regions;
+  std::vector<std::string> working_hours;
+  int64_t completed_orders;
+  int64_t cost_sum;
+};
+
+// Rows read from the cursor and pushed to the client per round trip.
+constexpr std::uint32_t kChunkSize = 1000;
+
+class CouriersMetaInfoBatchHandler final
+    : public userver::server::handlers::HttpHandlerBase {
+ public:
+  static constexpr std::string_view kName = "handler-couriers-meta-info-batch";
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+  ResponseCompressor& response_compressor_;
+
+  CouriersMetaInfoBatchHandler(
+      const userver::components::ComponentConfig& config,
+      const userver::components::ComponentContext& component_context)
+      : HttpHandlerBase(config, component_context),
+        pg_cluster_(
+            component_context
+                .FindComponent<userver::components::Postgres>("postgres-db-1")
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()),
+        response_compressor_(
+            component_context.FindComponent<ResponseCompressor>()){};
+
+  void HandleStreamRequest(
+      userver::server::http::HttpRequest& request,
+      userver::server::request::RequestContext&,
+      userver::server::http::ResponseBodyStream& response_body_stream)
+      const override {
+    if (!rate_limiter_.Admit(request)) {
+      response_body_stream.SetEndOfHeaders();
+      return;
+    }
+    auto slot = concurrency_limiter_.TryAcquire(request, Priority::kLow);
+    if (!slot) {
+      response_body_stream.SetEndOfHeaders();
+      return;
+    }
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
+    PostCouriersMetaInfoBatch(request, scope, response_body_stream);
+  }
+
+  const userver::storages::postgres::Query kSelectTimeDiffInSeconds{
+      "SELECT service_schema.CalculateTimestampDiffInSeconds"
+      "(CAST($1 as TIMESTAMP),CAST($2 as TIMESTAMP)) as result",
+      userver::storages::postgres::Query::Name{"select_time_diff_in_seconds"},
+  };
+
+  const userver::storages::postgres::Query kSelectMetaInfoByIds{
+      "SELECT c.courier_id, c.courier_type, c.regions, c.working_hours, "
+      "COUNT(o.order_id) as completed_orders, "
+      "COALESCE(SUM(o.cost), 0) as cost_sum "
+      "FROM service_schema.couriers c "
+      "LEFT JOIN service_schema.orders o ON o.courier_id = c.courier_id "
+      "AND o.complete_time >= CAST($2 as TIMESTAMP) "
+      "AND o.complete_time < CAST($3 as TIMESTAMP) "
+      "WHERE c.courier_id = ANY($1) "
+      "GROUP BY c.courier_id ORDER BY c.courier_id",
+      userver::storages::postgres::Query::Name{"select_meta_info_by_ids"},
+  };
+
+  const userver::storages::postgres::Query kSelectMetaInfoAll{
+      "SELECT c.courier_id, c.courier_type, c.regions, c.working_hours, "
+      "COUNT(o.order_id) as completed_orders, "
+      "COALESCE(SUM(o.cost), 0) as cost_sum "
+      "FROM service_schema.couriers c "
+      "LEFT JOIN service_schema.orders o ON o.courier_id = c.courier_id "
+      "AND o.complete_time >= CAST($1 as TIMESTAMP) "
+      "AND o.complete_time < CAST($2 as TIMESTAMP) "
+      "GROUP BY c.courier_id ORDER BY c.courier_id",
+      userver::storages::postgres::Query::Name{"select_meta_info_all"},
+  };
+
+  // Body: {"courier_ids": [1, 2, ...] | "all", "startDate": ...,
+  // "endDate": ...}. Responds with the GET /couriers/meta-info objects of
+  // the couriers found, ordered by courier_id. A JSON array is sent in
+  // chunks while the rows are read from the cursor. A BSON document starts
+  // with its size, so it is sent once complete.
+  void PostCouriersMetaInfoBatch(
+      userver::server::http::HttpRequest& request, RequestScope& scope,
+      userver::server::http::ResponseBodyStream& response_body_stream) const {
+    const auto bad_request = [&] {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      response_body_stream.SetEndOfHeaders();
+    };
+    if (request.ArgCount() > 0) return bad_request();
+
+    std::string startDate, endDate;
+    std::optional<std::vector<int64_t>> courier_ids;
+    try {
+      const auto timer = scope.Time(Stage::kParse);
+      const auto body = ParseBody(request).value_or(
+          userver::formats::json::Value{});
+      const bool parsed = std::visit(
+          [&](const auto& value) {
+            startDate = value["startDate"].template As<std::string>();
+            endDate = value["endDate"].template As<std::string>();
+            const auto ids = value["courier_ids"];
+            if (ids.IsString() && ids.template As<std::string>() == "all") {
+              courier_ids = std::nullopt;
+            } else if (ids.IsArray()) {
+              courier_ids = ids.template As<std::vector<int64_t>>();
+            } else {
+              return false;
+            }
+            return true;
+          },
+          body);
+      if (!parsed) return bad_request();
+    } catch (const userver::formats::json::Exception& exc) {
+      return bad_request();
+    } catch (const BsonError&) {
+      return bad_request();
+    }
+
+    const auto timeDiffInSeconds =
+        scope
+            .Execute(pg_cluster_,
+                     userver::storages::postgres::ClusterHostType::kSlave,
+                     kSelectTimeDiffInSeconds, startDate, endDate)
+            .AsSingleRow<int>();
+
+    auto transaction =
+        scope.Begin(pg_cluster_, "transaction_select_meta_info_batch",
+                    userver::storages::postgres::ClusterHostType::kSlave);
+    const auto& query =
+        courier_ids.has_value() ? kSelectMetaInfoByIds : kSelectMetaInfoAll;
+    auto portal =
+        courier_ids.has_value()
+            ? scope.MakePortal(transaction, query, courier_ids.value(),
+                               startDate, endDate)
+            : scope.MakePortal(transaction, query, startDate, endDate);
+
+    // Fetched before the headers, so that a failing query still gets its
+    // status.
+    std::optional<userver::storages::postgres::ResultSet> rows{
+        scope.Fetch(portal, query, kChunkSize)};
+
+    const bool bson = AcceptedFormat(request) == BodyFormat::kBson;
+    response_body_stream.SetHeader(
+        std::string{"Content-Type"},
+        bson ? std::string{kBsonContentType}
+             : std::string{"application/json; charset=utf-8"});
+    auto compressor = response_compressor_.StartStream(request);
+    response_body_stream.SetEndOfHeaders();
+
+    const auto push = [&](std::string chunk) {
+      if (compressor) chunk = compressor->Compress(chunk);
+      if (chunk.empty()) return;
+      response_body_stream.PushBodyChunk(std::move(chunk), scope.GetDeadline());
+    };
+
+    userver::formats::json::ValueBuilder items{
+        userver::formats::common::Type::kArray};
+    std::string chunk = bson ? "" : "[";
+    bool first = true;
+    while (true) {
+      {
+        const auto timer = scope.Time(Stage::kSerialize);
+        for (const auto& row : rows->AsSetOf<CourierMetaInfoRow>(
+                 userver::storages::postgres::kRowTag)) {
+          userver::formats::json::ValueBuilder meta_info;
+          meta_info["courier_id"] = row.courier_id;
+          meta_info["courier_type"] = row.courier_type;
+          meta_info["regions"] = row.regions;
+          meta_info["working_hours"] = row.working_hours;
+          if (timeDiffInSeconds > 0) {
+            AddEarningsAndRating(meta_info, row.courier_type,
+                                 row.completed_orders, row.cost_sum,
+                                 timeDiffInSeconds);
+          }
+          if (bson) {
+            items.PushBack(std::move(meta_info));
+            continue;
+          }
+          if (!first) chunk += ',';
+          first = false;
+          chunk += userver::formats::json::ToString(meta_info.ExtractValue());
+        }
+      }
+      if (portal.Done()) break;
+      if (!bson) push(std::exchange(chunk, {}));
+
+      scope.CheckDeadline();
+      rows.emplace(scope.Fetch(portal, query, kChunkSize));
+    }
+    if (bson) {
+      const auto timer = scope.Time(Stage::kSerialize);
+      chunk = ToBsonString(items.ExtractValue());
+    } else {
+      chunk += ']';
+    }
+    if (compressor) {
+      chunk = compressor->Finish(chunk);
+      response_compressor_.Account(compressor.value());
+    }
+    if (!chunk.empty()) {
+      response_body_stream.PushBodyChunk(std::move(chunk), scope.GetDeadline());
+    }
+    scope.Commit(transaction);
+  }
+};
+
+}  // namespace
+
+void AppendCouriersMetaInfoBatch(
+    userver::components::ComponentList& component_list) {
+  component_list.Append<CouriersMetaInfoBatchHandler>();
+}
+
+}  // namespace lavka
@@ -0,0 +1,13 @@
+#ifndef LAVKA_COURIERSMETAINFOBATCHHANDLER_H
+#define LAVKA_COURIERSMETAINFOBATCHHANDLER_H
+
+#include "CouriersMetaInfoHandler.h"
+
+namespace lavka {
+
+void AppendCouriersMetaInfoBatch(
+    userver::components::ComponentList& component_list);
+
+}  // namespace lavka
+
+#endif  // LAVKA_COURIERSMETAINFOBATCHHANDLER_H
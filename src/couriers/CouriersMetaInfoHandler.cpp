@@ -1,7 +1,43 @@
 #include "CouriersMetaInfoHandler.h"
 
+#include "MetaInfoCache.h"
+
+#include "../formats/BodyFormat.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
 namespace lavka {
 
+int EarningsCoefficient(std::string_view courier_type) {
+  if (courier_type == courierType::foot) return 2;
+  if (courier_type == courierType::bike) return 3;
+  if (courier_type == courierType::_auto) return 4;
+  return 0;
+}
+
+int RatingCoefficient(std::string_view courier_type) {
+  if (courier_type == courierType::foot) return 3;
+  if (courier_type == courierType::bike) return 2;
+  if (courier_type == courierType::_auto) return 1;
+  return 0;
+}
+
+void AddEarningsAndRating(userver::formats::json::ValueBuilder& meta_info,
+                          std::string_view courier_type,
+                          int64_t completed_orders, int64_t cost_sum,
+                          int64_t range_seconds) {
+  if (completed_orders == 0) return;
+
+  meta_info["earnings"] = cost_sum * EarningsCoefficient(courier_type);
+
+  const auto range_hours = range_seconds / 3600;
+  if (range_hours > 0) {
+    meta_info["rating"] =
+        (completed_orders / range_hours) * RatingCoefficient(courier_type);
+  }
+}
+
 namespace {
 
 class CouriersMetaInfoHandler final
@@ -9,6 +45,11 @@ class CouriersMetaInfoHandler final
  public:
   static constexpr std::string_view kName = "handler-couriers-meta-info";
   userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+  MetaInfoCache& cache_;
 
   CouriersMetaInfoHandler(
       const userver::components::ComponentConfig& config,
@@ -17,14 +58,25 @@ class CouriersMetaInfoHandler final
         pg_cluster_(
             component_context
                 .FindComponent<userver::components::Postgres>("postgres-db-1")
-                .GetCluster()){};
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()),
+        cache_(component_context.FindComponent<MetaInfoCache>()){};
 
   std::string HandleRequestThrow(
       const userver::server::http::HttpRequest& request,
       userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    auto slot = concurrency_limiter_.TryAcquire(request, Priority::kLow);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
     switch (request.GetMethod()) {
       case userver::server::http::HttpMethod::kGet:
-        return GetCouriersMetaInfo(request);
+        return GetCouriersMetaInfo(request, scope);
       default:
         throw userver::server::handlers::ClientError(
             userver::server::handlers::ExternalBody{
@@ -58,7 +110,8 @@ class CouriersMetaInfoHandler final
   };
 
   std::string GetCouriersMetaInfo(
-      const userver::server::http::HttpRequest& request) const {
+      const userver::server::http::HttpRequest& request,
+      RequestScope& scope) const {
     if (request.ArgCount() != 2) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
@@ -93,22 +146,33 @@ class CouriersMetaInfoHandler final
       return {};
     }
 
-    userver::storages::postgres::ResultSet res = pg_cluster_->Execute(
-        userver::storages::postgres::ClusterHostType::kSlave,
-        kSelectSpecificCourier, courier_id);
-    if (res.IsEmpty()) {
+    auto response = cache_.GetOrCompute(
+        courier_id, startDate, endDate, scope,
+        [&] { return ComputeMetaInfo(courier_id, startDate, endDate, scope); });
+    if (!response.has_value()) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
     }
+    return ConvertBody(request, std::move(response.value()));
+  }
+
+  // nullopt if there is no such courier.
+  std::optional<std::string> ComputeMetaInfo(int64_t courier_id,
+                                             const std::string& startDate,
+                                             const std::string& endDate,
+                                             RequestScope& scope) const {
+    userver::storages::postgres::ResultSet res = scope.Execute(
+        pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
+        kSelectSpecificCourier, courier_id);
+    if (res.IsEmpty()) return std::nullopt;
     auto courierValue =
         res.AsSingleRow<CourierDto>(userver::storages::postgres::kRowTag);
 
     int earnings = 0;
-    int rating = 0;
     int completedOrdersCount = 0;
 
-    res = pg_cluster_->Execute(
-        userver::storages::postgres::ClusterHostType::kSlave,
+    res = scope.Execute(
+        pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
         kSelectTimeDiffInSeconds, startDate, endDate);
 
     int timeDiffInSeconds = res.AsSingleRow<int>();
@@ -118,15 +182,16 @@ class CouriersMetaInfoHandler final
           courierValue.completed_orders.value();
 
       for (auto order_id : completeOrders) {
-        userver::storages::postgres::ResultSet orderRes = pg_cluster_->Execute(
-            userver::storages::postgres::ClusterHostType::kSlave,
+        scope.CheckDeadline();
+        userver::storages::postgres::ResultSet orderRes = scope.Execute(
+            pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
             kSelectSpecificOrder, order_id);
 
         auto orderValue = orderRes.AsSingleRow<OrderDto>(
             userver::storages::postgres::kRowTag);
 
-        res = pg_cluster_->Execute(
-            userver::storages::postgres::ClusterHostType::kSlave,
+        res = scope.Execute(
+            pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
             SelectIsInDateInterval, startDate, endDate, orderValue.complete_time.value());
 
         bool completeTimeIsInInterval = res.AsSingleRow<bool>();
@@ -138,26 +203,14 @@ class CouriersMetaInfoHandler final
       }
     }
 
+    const auto timer = scope.Time(Stage::kSerialize);
     userver::formats::json::ValueBuilder responseJson{courierValue};
     if (responseJson.HasMember("completed_orders")) {
       responseJson.Remove("completed_orders");
     }
 
-    if (completedOrdersCount != 0) {
-      int C = 0;
-      if (courierValue.courier_type == courierType::foot) C = 2;
-      if (courierValue.courier_type == courierType::bike) C = 3;
-      if (courierValue.courier_type == courierType::_auto) C = 4;
-      earnings *= C;
-      responseJson["earnings"] = earnings;
-
-      C = 0;
-      if (courierValue.courier_type == courierType::foot) C = 3;
-      if (courierValue.courier_type == courierType::bike) C = 2;
-      if (courierValue.courier_type == courierType::_auto) C = 1;
-      rating = (completedOrdersCount / (timeDiffInSeconds / 3600)) * C;
-      responseJson["rating"] = rating;
-    }
+    AddEarningsAndRating(responseJson, courierValue.courier_type,
+                         completedOrdersCount, earnings, timeDiffInSeconds);
 
     return userver::formats::json::ToStableString(responseJson.ExtractValue());
   }
@@ -166,6 +219,7 @@ class CouriersMetaInfoHandler final
 }  // namespace
 
 void AppendCouriersMetaInfo(userver::components::ComponentList& component_list){
+  component_list.Append<MetaInfoCache>();
   component_list.Append<CouriersMetaInfoHandler>();
 }
 
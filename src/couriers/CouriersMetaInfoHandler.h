@@ -6,6 +6,16 @@
 
 namespace lavka {
 
+int EarningsCoefficient(std::string_view courier_type);
+int RatingCoefficient(std::string_view courier_type);
+
+// Adds "earnings" and "rating" if the courier completed any orders in the
+// range, the rating needs a range of at least an hour.
+void AddEarningsAndRating(userver::formats::json::ValueBuilder& meta_info,
+                          std::string_view courier_type,
+                          int64_t completed_orders, int64_t cost_sum,
+                          int64_t range_seconds);
+
 void AppendCouriersMetaInfo(userver::components::ComponentList& component_list);
 
 }  // namespace lavka
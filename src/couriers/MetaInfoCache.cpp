@@ -0,0 +1,214 @@
+#include "MetaInfoCache.h"
+
+#include <cctype>
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+#include <userver/engine/task/cancel.hpp>
+
+#include "../statistics/RequestScope.h"
+
+namespace lavka {
+
+namespace {
+
+// "YYYY-MM-DD" optionally followed by " HH:MM:SS...": such values order
+// the same way as strings and as timestamps.
+bool IsIsoTimestamp(const std::string& value) {
+  if (value.size() < 10 || (value.size() > 10 && value[10] != ' ')) {
+    return false;
+  }
+  for (size_t i = 0; i < 10; ++i) {
+    const bool is_separator = i == 4 || i == 7;
+    if (is_separator ? value[i] != '-'
+                     : !std::isdigit(static_cast<unsigned char>(value[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Mirrors service_schema.IsInDateInterval. Ranges in other formats are
+// assumed to contain the time.
+bool RangeContains(const std::string& start_date, const std::string& end_date,
+                   const std::string& time) {
+  if (!IsIsoTimestamp(start_date) || !IsIsoTimestamp(end_date) ||
+      !IsIsoTimestamp(time)) {
+    return true;
+  }
+  return start_date <= time && time < end_date;
+}
+
+}  // namespace
+
+MetaInfoCacheConfig Parse(const userver::formats::json::Value& value,
+                          userver::formats::parse::To<MetaInfoCacheConfig>) {
+  MetaInfoCacheConfig config;
+  config.ttl =
+      std::chrono::milliseconds{value["ttl_ms"].As<int64_t>(config.ttl.count())};
+  config.max_entries = value["max_entries"].As<size_t>(config.max_entries);
+  return config;
+}
+
+MetaInfoCacheConfig ParseMetaInfoCacheConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_META_INFO_CACHE").As<MetaInfoCacheConfig>();
+}
+
+MetaInfoCache::MetaInfoCache(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()) {
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-meta-info-cache",
+              [this](userver::utils::statistics::Writer& writer) {
+                writer["hits"] = hits_.load();
+                writer["misses"] = misses_.load();
+                writer["coalesced"] = coalesced_.load();
+                writer["invalidations"] = invalidations_.load();
+              });
+}
+
+MetaInfoCache::~MetaInfoCache() { statistics_holder_.Unregister(); }
+
+MetaInfoCache::Result MetaInfoCache::GetOrCompute(
+    int64_t courier_id, const std::string& start_date,
+    const std::string& end_date, RequestScope& scope,
+    const std::function<Result()>& compute) {
+  const Range range{start_date, end_date};
+  auto entry = std::make_shared<Entry>();
+  for (bool computing = false; !computing;) {
+    std::unique_lock lock{mutex_};
+    auto& ranges = entries_[courier_id];
+    auto [it, inserted] = ranges.try_emplace(range, entry);
+    if (inserted) {
+      ++entries_count_;
+      computing = true;
+    } else if (!it->second->ready) {
+      ++coalesced_;
+      const auto in_flight = it->second;
+      while (!ready_cv_.WaitUntil(lock, scope.GetDeadline(),
+                                  [&] { return in_flight->ready; })) {
+        scope.CheckDeadline();
+      }
+      // Store has dropped the abandoned entry, compute it anew.
+      if (in_flight->abandoned) continue;
+      if (in_flight->error) std::rethrow_exception(in_flight->error);
+      return in_flight->value;
+    } else if (Clock::now() < it->second->expires_at) {
+      ++hits_;
+      return it->second->value;
+    } else {
+      it->second = entry;
+      computing = true;
+    }
+  }
+
+  ++misses_;
+  try {
+    entry->value = compute();
+  } catch (const DeadlineExpired&) {
+    entry->error = std::current_exception();
+    entry->abandoned = true;
+  } catch (...) {
+    entry->error = std::current_exception();
+    entry->abandoned = userver::engine::current_task::ShouldCancel();
+  }
+  Store(courier_id, range, entry);
+  ready_cv_.NotifyAll();
+
+  if (entry->error) std::rethrow_exception(entry->error);
+  return entry->value;
+}
+
+void MetaInfoCache::Store(int64_t courier_id, const Range& range,
+                          const std::shared_ptr<Entry>& entry) {
+  const auto config = config_source_.GetCopy(kMetaInfoCacheConfig);
+  const auto now = Clock::now();
+
+  std::lock_guard lock{mutex_};
+  entry->ready = true;
+  entry->expires_at = now + config.ttl;
+
+  const bool keep = !entry->error && entry->value.has_value() &&
+                    !entry->stale && entries_count_ <= config.max_entries;
+  if (keep) return;
+
+  auto courier = entries_.find(courier_id);
+  if (courier == entries_.end()) return;
+  auto it = courier->second.find(range);
+  if (it != courier->second.end() && it->second == entry) {
+    courier->second.erase(it);
+    --entries_count_;
+    if (courier->second.empty()) entries_.erase(courier);
+  }
+  if (entries_count_ > config.max_entries) SweepExpired(now);
+}
+
+void MetaInfoCache::Invalidate(int64_t courier_id,
+                               const std::string& complete_time) {
+  std::lock_guard lock{mutex_};
+  auto courier = entries_.find(courier_id);
+  if (courier == entries_.end()) return;
+
+  auto& ranges = courier->second;
+  for (auto it = ranges.begin(); it != ranges.end();) {
+    const auto& [start_date, end_date] = it->first;
+    if (!RangeContains(start_date, end_date, complete_time)) {
+      ++it;
+      continue;
+    }
+    ++invalidations_;
+    if (!it->second->ready) {
+      // Waiters still get this result, it just is not cached.
+      it->second->stale = true;
+      ++it;
+    } else {
+      it = ranges.erase(it);
+      --entries_count_;
+    }
+  }
+  if (ranges.empty()) entries_.erase(courier);
+}
+
+void MetaInfoCache::InvalidateAll() {
+  std::lock_guard lock{mutex_};
+  for (auto courier = entries_.begin(); courier != entries_.end();) {
+    auto& ranges = courier->second;
+    for (auto it = ranges.begin(); it != ranges.end();) {
+      ++invalidations_;
+      if (!it->second->ready) {
+        it->second->stale = true;
+        ++it;
+      } else {
+        it = ranges.erase(it);
+        --entries_count_;
+      }
+    }
+    courier = ranges.empty() ? entries_.erase(courier) : std::next(courier);
+  }
+}
+
+void MetaInfoCache::SweepExpired(Clock::time_point now) {
+  for (auto courier = entries_.begin(); courier != entries_.end();) {
+    auto& ranges = courier->second;
+    for (auto it = ranges.begin(); it != ranges.end();) {
+      if (it->second->ready && it->second->expires_at <= now) {
+        it = ranges.erase(it);
+        --entries_count_;
+      } else {
+        ++it;
+      }
+    }
+    courier = ranges.empty() ? entries_.erase(courier) : std::next(courier);
+  }
+}
+
+}  // namespace lavka
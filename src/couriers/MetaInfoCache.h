@@ -0,0 +1,103 @@
+#ifndef LAVKA_METAINFOCACHE_H
+#define LAVKA_METAINFOCACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/condition_variable.hpp>
+#include <userver/engine/mutex.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+class RequestScope;
+
+struct MetaInfoCacheConfig {
+  std::chrono::milliseconds ttl{5000};
+  size_t max_entries{100000};
+};
+
+MetaInfoCacheConfig Parse(const userver::formats::json::Value& value,
+                          userver::formats::parse::To<MetaInfoCacheConfig>);
+
+MetaInfoCacheConfig ParseMetaInfoCacheConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseMetaInfoCacheConfig>
+    kMetaInfoCacheConfig;
+
+// Meta-info responses by (courier, startDate, endDate). Concurrent
+// identical requests share a single computation, successful results are
+// kept for a short TTL and dropped as soon as a completion inside their
+// range is recorded for the courier. When the computing request runs out
+// of its own deadline, a waiter takes over within its deadline.
+class MetaInfoCache final : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-meta-info-cache";
+
+  // nullopt is a request error, it is shared with the concurrent waiters
+  // but not cached.
+  using Result = std::optional<std::string>;
+
+  MetaInfoCache(const userver::components::ComponentConfig& config,
+                const userver::components::ComponentContext& component_context);
+  ~MetaInfoCache() override;
+
+  Result GetOrCompute(int64_t courier_id, const std::string& start_date,
+                      const std::string& end_date, RequestScope& scope,
+                      const std::function<Result()>& compute);
+
+  // complete_time is a normalized timestamp, "YYYY-MM-DD HH:MM:SS".
+  void Invalidate(int64_t courier_id, const std::string& complete_time);
+
+  // For when completions may have been missed.
+  void InvalidateAll();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  using Range = std::pair<std::string, std::string>;
+
+  struct Entry {
+    bool ready{false};
+    // A completion inside the range was recorded while computing.
+    bool stale{false};
+    Result value;
+    std::exception_ptr error;
+    // The computing request ran out of time or was cancelled, the error
+    // says nothing about the waiters' requests.
+    bool abandoned{false};
+    Clock::time_point expires_at;
+  };
+
+  void Store(int64_t courier_id, const Range& range,
+             const std::shared_ptr<Entry>& entry);
+  void SweepExpired(Clock::time_point now);
+
+  userver::dynamic_config::Source config_source_;
+
+  userver::engine::Mutex mutex_;
+  userver::engine::ConditionVariable ready_cv_;
+  std::unordered_map<int64_t, std::map<Range, std::shared_ptr<Entry>>>
+      entries_;
+  size_t entries_count_{0};
+
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> coalesced_{0};
+  std::atomic<uint64_t> invalidations_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_METAINFOCACHE_H
@@ -0,0 +1,258 @@
+#include "ExportHandler.h"
+
+#include <charconv>
+
+#include <userver/server/http/http_response_body_stream.hpp>
+
+#include "../compression/ResponseCompressor.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
+namespace lavka {
+
+namespace {
+
+// Rows read from the cursor and pushed to the client per round trip.
+constexpr std::uint32_t kChunkSize = 1000;
+
+// The watermark of an export is the last change_log event id in its
+// snapshot. Event ids are taken under a lock in the order of commits, so
+// with `since` exactly the rows whose events came after it are exported,
+// `changed` selects their keys. A row may be exported again later, the
+// client keeps the last version by key.
+struct ExportTable {
+  std::string_view name;
+  std::string_view columns;
+  std::string_view csv_columns;
+  std::string_view from;
+  std::string_view key;
+  std::string_view changed;
+  std::string_view order_by;
+};
+
+constexpr ExportTable kTables[] = {
+    {"orders",
+     "o.order_id, CAST(o.weight as FLOAT) as weight, o.regions, "
+     "o.delivery_hours, o.cost, CAST(o.complete_time as TEXT) as "
+     "complete_time, o.courier_id",
+     "order_id,weight,regions,delivery_hours,cost,complete_time,courier_id",
+     "service_schema.orders o WHERE TRUE", "o.order_id",
+     "SELECT entity_id FROM service_schema.change_log "
+     "WHERE entity = 'order' AND event_id > $1",
+     "o.order_id"},
+    {"couriers",
+     "c.courier_id, c.courier_type, c.regions, c.working_hours, "
+     "c.completed_orders",
+     "courier_id,courier_type,regions,working_hours,completed_orders",
+     "service_schema.couriers c WHERE TRUE", "c.courier_id",
+     "SELECT entity_id FROM service_schema.change_log "
+     "WHERE entity = 'courier' AND event_id > $1 "
+     "UNION SELECT CAST(payload->>'courier_id' as BIGINT) "
+     "FROM service_schema.change_log "
+     "WHERE kind = 'completed' AND event_id > $1",
+     "c.courier_id"},
+    {"completions",
+     "o.order_id, o.courier_id, CAST(o.complete_time as TEXT) as "
+     "complete_time",
+     "order_id,courier_id,complete_time",
+     "service_schema.orders o WHERE o.complete_time IS NOT NULL", "o.order_id",
+     "SELECT entity_id FROM service_schema.change_log "
+     "WHERE kind = 'completed' AND event_id > $1",
+     "o.complete_time, o.order_id"},
+};
+
+const userver::storages::postgres::Query kSelectExportWatermark{
+    "SELECT COALESCE(MAX(event_id), 0) FROM service_schema.change_log",
+    userver::storages::postgres::Query::Name{"select_export_watermark"},
+};
+
+const userver::storages::postgres::TransactionOptions kSnapshotRead{
+    userver::storages::postgres::IsolationLevel::kRepeatableRead,
+    userver::storages::postgres::TransactionOptions::kReadOnly,
+};
+
+// Every row is formatted by PostgreSQL into one line of the response, so
+// the handler only concatenates text.
+userver::storages::postgres::Query MakeExportQuery(const ExportTable& table,
+                                                   bool csv) {
+  std::string line;
+  if (csv) {
+    std::string_view columns = table.csv_columns;
+    while (!columns.empty()) {
+      const auto comma = columns.find(',');
+      if (!line.empty()) line += ", ";
+      line += fmt::format("service_schema.CsvField(CAST(t.{} as TEXT))",
+                          columns.substr(0, comma));
+      if (comma == std::string_view::npos) break;
+      columns.remove_prefix(comma + 1);
+    }
+    line = fmt::format("concat_ws(',', {})", line);
+  } else {
+    line = "row_to_json(t)::text";
+  }
+
+  return userver::storages::postgres::Query{
+      fmt::format("SELECT {} FROM (SELECT {} FROM {} AND ($1 IS NULL OR {} "
+                  "IN ({})) ORDER BY {}) t",
+                  line, table.columns, table.from, table.key, table.changed,
+                  table.order_by),
+      userver::storages::postgres::Query::Name{fmt::format(
+          "export_{}_{}", table.name, csv ? "csv" : "ndjson")}};
+}
+
+class ExportHandler final : public userver::server::handlers::HttpHandlerBase {
+ public:
+  static constexpr std::string_view kName = "handler-export";
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+  ResponseCompressor& response_compressor_;
+  std::vector<userver::storages::postgres::Query> csv_queries_;
+  std::vector<userver::storages::postgres::Query> ndjson_queries_;
+
+  ExportHandler(const userver::components::ComponentConfig& config,
+                const userver::components::ComponentContext& component_context)
+      : HttpHandlerBase(config, component_context),
+        pg_cluster_(
+            component_context
+                .FindComponent<userver::components::Postgres>("postgres-db-1")
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()),
+        response_compressor_(
+            component_context.FindComponent<ResponseCompressor>()) {
+    for (const auto& table : kTables) {
+      csv_queries_.push_back(MakeExportQuery(table, true));
+      ndjson_queries_.push_back(MakeExportQuery(table, false));
+    }
+  };
+
+  // GET /export/{table}?format=csv|ndjson&since=..
+  // The rows are sent as chunks of the response while they are read from
+  // a cursor on a replica, memory use does not depend on the table size.
+  void HandleStreamRequest(
+      userver::server::http::HttpRequest& request,
+      userver::server::request::RequestContext&,
+      userver::server::http::ResponseBodyStream& response_body_stream)
+      const override {
+    if (!rate_limiter_.Admit(request)) {
+      response_body_stream.SetEndOfHeaders();
+      return;
+    }
+    auto slot = concurrency_limiter_.TryAcquire(request, Priority::kLow);
+    if (!slot) {
+      response_body_stream.SetEndOfHeaders();
+      return;
+    }
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
+
+    const auto& table_name = request.GetPathArg("table");
+    const auto format =
+        request.HasArg("format") ? request.GetArg("format") : "ndjson";
+    std::optional<std::string> since;
+    size_t realArgCount = request.HasArg("format") ? 1 : 0;
+    if (request.HasArg("since")) {
+      since = request.GetArg("since");
+      ++realArgCount;
+    }
+
+    std::optional<size_t> table_index;
+    for (size_t i = 0; i < std::size(kTables); ++i) {
+      if (kTables[i].name == table_name) table_index = i;
+    }
+    if (!table_index.has_value() || (format != "csv" && format != "ndjson") ||
+        request.ArgCount() > realArgCount) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      response_body_stream.SetEndOfHeaders();
+      return;
+    }
+
+    const bool csv = format == "csv";
+    const auto& query = csv ? csv_queries_[table_index.value()]
+                            : ndjson_queries_[table_index.value()];
+
+    std::optional<int64_t> since_event_id;
+    if (since.has_value()) {
+      const auto& value = since.value();
+      int64_t event_id = 0;
+      const auto [end, ec] =
+          std::from_chars(value.data(), value.data() + value.size(), event_id);
+      if (ec != std::errc{} || end != value.data() + value.size() ||
+          event_id < 0) {
+        request.SetResponseStatus(
+            userver::server::http::HttpStatus::kBadRequest);
+        response_body_stream.SetEndOfHeaders();
+        return;
+      }
+      since_event_id = event_id;
+    }
+
+    auto transaction =
+        scope.Begin(pg_cluster_, "transaction_export",
+                    userver::storages::postgres::ClusterHostType::kSlave,
+                    kSnapshotRead);
+    const auto watermark =
+        scope.Execute(transaction, kSelectExportWatermark)
+            .AsSingleRow<int64_t>();
+    auto portal = scope.MakePortal(transaction, query, since_event_id);
+
+    std::optional<userver::storages::postgres::ResultSet> rows{
+        scope.Fetch(portal, query, kChunkSize)};
+
+    response_body_stream.SetHeader(
+        std::string{"Content-Type"},
+        std::string{csv ? "text/csv; charset=utf-8" : "application/x-ndjson"});
+    response_body_stream.SetHeader(std::string{"X-Export-Watermark"},
+                                   std::to_string(watermark));
+    auto compressor = response_compressor_.StartStream(request);
+    response_body_stream.SetEndOfHeaders();
+
+    std::string chunk;
+    if (csv) {
+      chunk.append(kTables[table_index.value()].csv_columns);
+      chunk += '\n';
+    }
+    while (true) {
+      {
+        const auto timer = scope.Time(Stage::kSerialize);
+        for (const auto& line : rows->AsSetOf<std::string>()) {
+          chunk += line;
+          chunk += '\n';
+        }
+      }
+      if (portal.Done()) break;
+      if (compressor) chunk = compressor->Compress(chunk);
+      if (!chunk.empty()) {
+        response_body_stream.PushBodyChunk(std::move(chunk),
+                                           scope.GetDeadline());
+        chunk = {};
+      }
+
+      scope.CheckDeadline();
+      rows.emplace(scope.Fetch(portal, query, kChunkSize));
+    }
+    if (compressor) {
+      chunk = compressor->Finish(chunk);
+      response_compressor_.Account(compressor.value());
+    }
+    if (!chunk.empty()) {
+      response_body_stream.PushBodyChunk(std::move(chunk), scope.GetDeadline());
+    }
+    scope.Commit(transaction);
+  }
+};
+
+}  // namespace
+
+void AppendExport(userver::components::ComponentList& component_list) {
+  component_list.Append<ExportHandler>();
+}
+
+}  // namespace lavka
@@ -0,0 +1,12 @@
+#ifndef LAVKA_EXPORTHANDLER_H
+#define LAVKA_EXPORTHANDLER_H
+
+#include "../lavka.h"
+
+namespace lavka {
+
+void AppendExport(userver::components::ComponentList& component_list);
+
+}  // namespace lavka
+
+#endif  // LAVKA_EXPORTHANDLER_H
@@ -0,0 +1,163 @@
+#include "BodyFormat.h"
+
+#include <string>
+
+#include <userver/http/content_type.hpp>
+#include <userver/utils/str_icase.hpp>
+
+namespace lavka {
+
+namespace {
+
+std::string_view Trim(std::string_view value) {
+  while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+  while (!value.empty() && value.back() == ' ') value.remove_suffix(1);
+  return value;
+}
+
+// Quality of a `type/subtype;q=0.5` entry, 1 if there is no q parameter
+// and 0 if it is malformed.
+double Quality(std::string_view params) {
+  while (!params.empty()) {
+    const auto semicolon = params.find(';');
+    const auto param = Trim(params.substr(0, semicolon));
+    if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') &&
+        param[1] == '=') {
+      try {
+        return std::stod(std::string{param.substr(2)});
+      } catch (...) {
+        return 0;
+      }
+    }
+    if (semicolon == std::string_view::npos) break;
+    params.remove_prefix(semicolon + 1);
+  }
+  return 1;
+}
+
+bool IsBson(std::string_view content_type) {
+  const auto media_type = Trim(content_type.substr(0, content_type.find(';')));
+  return userver::utils::StrIcaseEqual{}(media_type, kBsonContentType);
+}
+
+void AppendBson(BsonWriter& writer, std::string_view name,
+                const userver::formats::json::Value& value) {
+  if (value.IsNull()) {
+    writer.AppendNull(name);
+  } else if (value.IsBool()) {
+    writer.AppendBool(name, value.As<bool>());
+  } else if (value.IsInt64()) {
+    writer.AppendInt(name, value.As<int64_t>());
+  } else if (value.IsDouble()) {
+    writer.AppendDouble(name, value.As<double>());
+  } else if (value.IsString()) {
+    writer.AppendString(name, value.As<std::string>());
+  } else if (value.IsArray()) {
+    writer.OpenArray(name);
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      AppendBson(writer, std::to_string(it.GetIndex()), *it);
+    }
+    writer.Close();
+  } else if (value.IsObject()) {
+    writer.OpenDocument(name);
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      AppendBson(writer, it.GetName(), *it);
+    }
+    writer.Close();
+  }
+}
+
+}  // namespace
+
+BodyFormat NegotiateFormat(std::string_view accept) {
+  // The most specific entry gives the quality of a type: application/json
+  // or application/bson, then application/*, then */*.
+  double json = 0, bson = 0, application = 0, any = 0;
+  bool json_listed = false, bson_listed = false, application_listed = false;
+  const userver::utils::StrIcaseEqual equal;
+  while (!accept.empty()) {
+    const auto comma = accept.find(',');
+    const auto entry = accept.substr(0, comma);
+    const auto semicolon = entry.find(';');
+    const auto media_type = Trim(entry.substr(0, semicolon));
+    const auto quality = semicolon == std::string_view::npos
+                             ? 1.0
+                             : Quality(entry.substr(semicolon + 1));
+    if (equal(media_type, kBsonContentType)) {
+      bson = quality;
+      bson_listed = true;
+    } else if (equal(media_type, "application/json")) {
+      json = quality;
+      json_listed = true;
+    } else if (equal(media_type, "application/*")) {
+      application = quality;
+      application_listed = true;
+    } else if (media_type == "*/*") {
+      any = quality;
+    }
+    if (comma == std::string_view::npos) break;
+    accept.remove_prefix(comma + 1);
+  }
+  if (!application_listed) application = any;
+  if (!json_listed) json = application;
+  if (!bson_listed) bson = application;
+
+  // JSON on ties, it is also the answer when neither is acceptable.
+  return bson > json ? BodyFormat::kBson : BodyFormat::kJson;
+}
+
+BodyFormat AcceptedFormat(const userver::server::http::HttpRequest& request) {
+  AddVary(request, "Accept");
+  return NegotiateFormat(request.GetHeader("Accept"));
+}
+
+std::optional<RequestBody> ParseBody(
+    const userver::server::http::HttpRequest& request) {
+  try {
+    if (!IsBson(request.GetHeader("Content-Type"))) {
+      return userver::formats::json::FromString(request.RequestBody());
+    }
+
+    const auto document = BsonValue::FromBinary(request.RequestBody());
+    if (document.GetSize() == 1 && document[kBsonArrayField].IsArray()) {
+      return document[kBsonArrayField];
+    }
+    return document;
+  } catch (const userver::formats::json::Exception&) {
+    return std::nullopt;
+  } catch (const BsonError&) {
+    return std::nullopt;
+  }
+}
+
+std::string ToBsonString(const userver::formats::json::Value& value) {
+  BsonWriter writer;
+  if (value.IsObject()) {
+    for (auto it = value.begin(); it != value.end(); ++it) {
+      AppendBson(writer, it.GetName(), *it);
+    }
+  } else {
+    AppendBson(writer, kBsonArrayField, value);
+  }
+  return std::move(writer).Finish();
+}
+
+std::string WriteBody(const userver::server::http::HttpRequest& request,
+                      const userver::formats::json::Value& value) {
+  if (AcceptedFormat(request) == BodyFormat::kBson) {
+    request.GetHttpResponse().SetContentType(
+        userver::http::ContentType{std::string{kBsonContentType}});
+    return ToBsonString(value);
+  }
+  return userver::formats::json::ToStableString(value);
+}
+
+std::string ConvertBody(const userver::server::http::HttpRequest& request,
+                        std::string json) {
+  if (json.empty() || AcceptedFormat(request) != BodyFormat::kBson) {
+    return json;
+  }
+  return WriteBody(request, userver::formats::json::FromString(json));
+}
+
+}  // namespace lavka
@@ -0,0 +1,75 @@
+#ifndef LAVKA_BODYFORMAT_H
+#define LAVKA_BODYFORMAT_H
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+#include "../lavka.h"
+#include "Bson.h"
+
+namespace lavka {
+
+enum class BodyFormat { kJson, kBson };
+
+inline constexpr std::string_view kBsonContentType = "application/bson";
+
+// BSON has no top level arrays, they are sent as {"items": [...]} both in
+// responses and in request bodies.
+inline constexpr std::string_view kBsonArrayField = "items";
+
+// BSON if the Accept header prefers application/bson to JSON, with
+// application/* and */* counted for both. JSON otherwise.
+BodyFormat NegotiateFormat(std::string_view accept);
+
+// NegotiateFormat of the request, also adds Accept to Vary so that caches
+// keep the formats apart.
+BodyFormat AcceptedFormat(const userver::server::http::HttpRequest& request);
+
+// A parsed request body. BSON is read in place from the request bytes,
+// parsers take either through the same Value interface, e.g. with
+// std::visit and a generic lambda.
+using RequestBody = std::variant<userver::formats::json::Value, BsonValue>;
+
+// Request body in the format of its Content-Type: JSON, or BSON with
+// application/bson, a kBsonArrayField wrapper already unwrapped. nullopt
+// if it is malformed.
+std::optional<RequestBody> ParseBody(
+    const userver::server::http::HttpRequest& request);
+
+// String of a body value. A BSON string is a view of the request bytes,
+// JSON strings have no such accessor and are copied.
+template <typename Value>
+auto StringOf(const Value& value) {
+  if constexpr (std::is_same_v<Value, BsonValue>) {
+    return value.template As<std::string_view>();
+  } else {
+    return value.template As<std::string>();
+  }
+}
+
+// BSON document of the value, arrays wrapped into kBsonArrayField.
+std::string ToBsonString(const userver::formats::json::Value& value);
+
+// Response body in the accepted format, the value is encoded to BSON
+// directly without a JSON text step.
+std::string WriteBody(const userver::server::http::HttpRequest& request,
+                      const userver::formats::json::Value& value);
+
+// Same for a body built by `build` from an empty builder.
+template <typename Build>
+std::string SerializeBody(const userver::server::http::HttpRequest& request,
+                          const Build& build) {
+  return WriteBody(request, build(userver::formats::json::ValueBuilder{}));
+}
+
+// Same for a serialized JSON body, e.g. from a cache. Empty bodies of
+// error responses are left as they are.
+std::string ConvertBody(const userver::server::http::HttpRequest& request,
+                        std::string json);
+
+}  // namespace lavka
+
+#endif  // LAVKA_BODYFORMAT_H
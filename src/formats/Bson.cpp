@@ -0,0 +1,296 @@
+#include "Bson.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace lavka {
+
+namespace {
+
+// Nesting allowed in request bodies, deeper documents are rejected.
+constexpr int kMaxDepth = 64;
+
+// BSON is little-endian.
+template <typename T>
+T ReadLittleEndian(std::string_view data) {
+  if (data.size() < sizeof(T)) throw BsonError{"truncated"};
+  std::make_unsigned_t<T> value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    value |= static_cast<std::make_unsigned_t<T>>(
+                 static_cast<unsigned char>(data[i]))
+             << (8 * i);
+  }
+  return static_cast<T>(value);
+}
+
+}  // namespace
+
+BsonValue BsonValue::FromBinary(std::string_view document) {
+  Validate(kDocument, document, 0);
+  return BsonValue{kDocument, document};
+}
+
+BsonValue BsonValue::ReadElement(std::string_view& elements,
+                                 std::string_view& name) {
+  const auto type = static_cast<Type>(elements[0]);
+  const auto name_end = elements.find('\0', 1);
+  if (name_end == std::string_view::npos) throw BsonError{"truncated"};
+  name = elements.substr(1, name_end - 1);
+  const auto value = elements.substr(name_end + 1);
+
+  size_t size = 0;
+  switch (type) {
+    case kDouble:
+    case kInt64:
+      size = 8;
+      break;
+    case kInt32:
+      size = 4;
+      break;
+    case kBool:
+      size = 1;
+      break;
+    case kNull:
+      break;
+    case kString:
+      size = 4 + static_cast<uint32_t>(ReadLittleEndian<int32_t>(value));
+      break;
+    case kDocument:
+    case kArray:
+      size = static_cast<uint32_t>(ReadLittleEndian<int32_t>(value));
+      break;
+    default:
+      throw BsonError{"unsupported element type"};
+  }
+  if (value.size() < size) throw BsonError{"truncated"};
+  elements = value.substr(size);
+  return BsonValue{type, value.substr(0, size)};
+}
+
+void BsonValue::Validate(Type type, std::string_view data, int depth) {
+  switch (type) {
+    case kString: {
+      const auto size = ReadLittleEndian<int32_t>(data);
+      if (size < 1 || data.back() != '\0') throw BsonError{"bad string"};
+      return;
+    }
+    case kBool:
+      if (data[0] != 0 && data[0] != 1) throw BsonError{"bad bool"};
+      return;
+    case kDocument:
+    case kArray:
+      break;
+    default:
+      return;
+  }
+
+  if (depth > kMaxDepth) throw BsonError{"nested too deep"};
+  if (data.size() < 5 ||
+      static_cast<size_t>(ReadLittleEndian<int32_t>(data)) != data.size() ||
+      data.back() != '\0') {
+    throw BsonError{"bad document size"};
+  }
+  auto elements = data.substr(4, data.size() - 5);
+  std::string_view name;
+  while (!elements.empty()) {
+    const auto element = ReadElement(elements, name);
+    Validate(element.type_, element.data_, depth + 1);
+  }
+}
+
+template <typename Func>
+void BsonValue::ForEachElement(const Func& func) const {
+  CheckContainer();
+  auto elements = data_.substr(4, data_.size() - 5);
+  std::string_view name;
+  while (!elements.empty()) {
+    const auto element = ReadElement(elements, name);
+    if (!func(name, element)) return;
+  }
+}
+
+size_t BsonValue::GetSize() const {
+  size_t size = 0;
+  ForEachElement([&](std::string_view, const BsonValue&) {
+    ++size;
+    return true;
+  });
+  return size;
+}
+
+bool BsonValue::HasMember(std::string_view name) const {
+  return !(*this)[name].IsMissing();
+}
+
+BsonValue BsonValue::operator[](std::string_view name) const {
+  if (!IsObject()) ThrowTypeMismatch("document");
+  BsonValue member;
+  ForEachElement([&](std::string_view element_name, const BsonValue& value) {
+    if (element_name != name) return true;
+    member = value;
+    return false;
+  });
+  return member;
+}
+
+BsonValue::Iterator BsonValue::begin() const {
+  CheckContainer();
+  return Iterator{data_.substr(4, data_.size() - 5)};
+}
+
+BsonValue::Iterator BsonValue::end() const {
+  CheckContainer();
+  return Iterator{data_.substr(data_.size() - 1, 0)};
+}
+
+void BsonValue::CheckContainer() const {
+  if (!IsObject() && !IsArray()) ThrowTypeMismatch("document or array");
+}
+
+void BsonValue::ThrowTypeMismatch(std::string_view expected) const {
+  throw BsonError{IsMissing() ? "missing value"
+                              : "value is not a " + std::string{expected}};
+}
+
+int64_t BsonValue::AsInt64() const {
+  switch (type_) {
+    case kInt32:
+      return ReadLittleEndian<int32_t>(data_);
+    case kInt64:
+      return ReadLittleEndian<int64_t>(data_);
+    case kDouble: {
+      const auto value = AsDouble();
+      // 2^63 is the first double above the int64 range.
+      if (std::trunc(value) != value || value < -9223372036854775808.0 ||
+          value >= 9223372036854775808.0) {
+        ThrowTypeMismatch("integer");
+      }
+      return static_cast<int64_t>(value);
+    }
+    default:
+      ThrowTypeMismatch("integer");
+  }
+}
+
+double BsonValue::AsDouble() const {
+  switch (type_) {
+    case kDouble: {
+      const auto bits = ReadLittleEndian<uint64_t>(data_);
+      double value = 0;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+    case kInt32:
+    case kInt64:
+      return static_cast<double>(AsInt64());
+    default:
+      ThrowTypeMismatch("number");
+  }
+}
+
+bool BsonValue::AsBool() const {
+  if (!IsBool()) ThrowTypeMismatch("bool");
+  return data_[0] != 0;
+}
+
+std::string_view BsonValue::AsStringView() const {
+  if (!IsString()) ThrowTypeMismatch("string");
+  return data_.substr(4, data_.size() - 5);
+}
+
+BsonValue::Iterator::Iterator(std::string_view elements)
+    : elements_(elements) {
+  Read();
+}
+
+void BsonValue::Iterator::Read() {
+  if (elements_.empty()) return;
+  next_ = elements_;
+  value_ = ReadElement(next_, name_);
+}
+
+BsonValue::Iterator& BsonValue::Iterator::operator++() {
+  elements_ = next_;
+  Read();
+  return *this;
+}
+
+BsonWriter::BsonWriter() {
+  open_.push_back(0);
+  AppendRaw<int32_t>(0);
+}
+
+void BsonWriter::AppendDouble(std::string_view name, double value) {
+  AppendHeader(0x01, name);
+  uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(bits));
+  AppendRaw(bits);
+}
+
+void BsonWriter::AppendString(std::string_view name, std::string_view value) {
+  AppendHeader(0x02, name);
+  AppendRaw(static_cast<int32_t>(value.size() + 1));
+  data_.append(value);
+  data_ += '\0';
+}
+
+void BsonWriter::AppendBool(std::string_view name, bool value) {
+  AppendHeader(0x08, name);
+  data_ += static_cast<char>(value);
+}
+
+void BsonWriter::AppendNull(std::string_view name) { AppendHeader(0x0a, name); }
+
+void BsonWriter::AppendInt(std::string_view name, int64_t value) {
+  if (value >= std::numeric_limits<int32_t>::min() &&
+      value <= std::numeric_limits<int32_t>::max()) {
+    AppendHeader(0x10, name);
+    AppendRaw(static_cast<int32_t>(value));
+  } else {
+    AppendHeader(0x12, name);
+    AppendRaw(value);
+  }
+}
+
+void BsonWriter::OpenDocument(std::string_view name) {
+  AppendHeader(0x03, name);
+  open_.push_back(data_.size());
+  AppendRaw<int32_t>(0);
+}
+
+void BsonWriter::OpenArray(std::string_view name) {
+  AppendHeader(0x04, name);
+  open_.push_back(data_.size());
+  AppendRaw<int32_t>(0);
+}
+
+void BsonWriter::Close() {
+  data_ += '\0';
+  const auto start = open_.back();
+  open_.pop_back();
+  const auto size = static_cast<uint32_t>(data_.size() - start);
+  for (size_t i = 0; i < sizeof(size); ++i) {
+    data_[start + i] = static_cast<char>(size >> (8 * i));
+  }
+}
+
+std::string BsonWriter::Finish() && {
+  Close();
+  return std::move(data_);
+}
+
+void BsonWriter::AppendHeader(uint8_t type, std::string_view name) {
+  data_ += static_cast<char>(type);
+  data_.append(name);
+  data_ += '\0';
+}
+
+template <typename T>
+void BsonWriter::AppendRaw(T value) {
+  const auto bits = static_cast<std::make_unsigned_t<T>>(value);
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    data_ += static_cast<char>(bits >> (8 * i));
+  }
+}
+
+}  // namespace lavka
@@ -0,0 +1,195 @@
+#ifndef LAVKA_BSON_H
+#define LAVKA_BSON_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace lavka {
+
+// Malformed document, or a value read as a type it does not hold.
+class BsonError final : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+// Read-only view of a value inside a BSON document, in place over the
+// bytes it was parsed from, which must outlive it. Only the types that
+// have a JSON counterpart are accepted: double, string, document, array,
+// bool, null, int32 and int64. Mirrors the part of the formats::json::Value
+// interface the request parsers use, so they are shared by both formats.
+class BsonValue final {
+ public:
+  class Iterator;
+
+  // Checks the whole document, throws BsonError if it is malformed.
+  static BsonValue FromBinary(std::string_view document);
+
+  // Missing value, as operator[] returns for an absent member.
+  BsonValue() = default;
+
+  bool IsMissing() const { return type_ == kMissing; }
+  bool IsNull() const { return type_ == kNull; }
+  bool IsBool() const { return type_ == kBool; }
+  bool IsInt64() const { return type_ == kInt32 || type_ == kInt64; }
+  bool IsDouble() const { return type_ == kDouble; }
+  bool IsString() const { return type_ == kString; }
+  bool IsArray() const { return type_ == kArray; }
+  bool IsObject() const { return type_ == kDocument; }
+
+  // Number of elements of a document or an array.
+  size_t GetSize() const;
+  bool IsEmpty() const { return GetSize() == 0; }
+
+  bool HasMember(std::string_view name) const;
+  // The member of a document, a missing value if there is none.
+  BsonValue operator[](std::string_view name) const;
+
+  // Elements of a document or an array, names are skipped.
+  Iterator begin() const;
+  Iterator end() const;
+
+  // Integers are read from int32, int64 and doubles without a fraction,
+  // floating point from any number, strings view the document bytes.
+  template <typename T>
+  T As() const;
+
+ private:
+  // The BSON element type bytes.
+  enum Type : uint8_t {
+    kMissing = 0x00,
+    kDouble = 0x01,
+    kString = 0x02,
+    kDocument = 0x03,
+    kArray = 0x04,
+    kBool = 0x08,
+    kNull = 0x0a,
+    kInt32 = 0x10,
+    kInt64 = 0x12,
+  };
+
+  BsonValue(Type type, std::string_view data) : type_(type), data_(data) {}
+
+  // Calls func(name, value) for the elements of a document or an array
+  // while it returns true.
+  template <typename Func>
+  void ForEachElement(const Func& func) const;
+
+  // The element at the start of `elements`, advances past it.
+  static BsonValue ReadElement(std::string_view& elements,
+                               std::string_view& name);
+  static void Validate(Type type, std::string_view data, int depth);
+
+  void CheckContainer() const;
+  [[noreturn]] void ThrowTypeMismatch(std::string_view expected) const;
+
+  int64_t AsInt64() const;
+  double AsDouble() const;
+  bool AsBool() const;
+  std::string_view AsStringView() const;
+
+  Type type_{kMissing};
+  // The value bytes, for documents and arrays with their size and
+  // terminator.
+  std::string_view data_;
+};
+
+class BsonValue::Iterator final {
+ public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = BsonValue;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const BsonValue*;
+  using reference = const BsonValue&;
+
+  const BsonValue& operator*() const { return value_; }
+  const BsonValue* operator->() const { return &value_; }
+  std::string_view GetName() const { return name_; }
+
+  Iterator& operator++();
+  bool operator==(const Iterator& other) const {
+    return elements_.data() == other.elements_.data();
+  }
+  bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+ private:
+  friend class BsonValue;
+
+  // `elements` runs from the current element to the document terminator.
+  explicit Iterator(std::string_view elements);
+  void Read();
+
+  std::string_view elements_;
+  std::string_view next_;
+  std::string_view name_;
+  BsonValue value_;
+};
+
+// Appends a BSON document to a buffer. Documents and arrays are opened and
+// closed explicitly, their sizes are patched in on close; array elements
+// are named by their index by the caller.
+class BsonWriter final {
+ public:
+  BsonWriter();
+
+  void AppendDouble(std::string_view name, double value);
+  void AppendString(std::string_view name, std::string_view value);
+  void AppendBool(std::string_view name, bool value);
+  void AppendNull(std::string_view name);
+  // int32 if the value fits, int64 otherwise.
+  void AppendInt(std::string_view name, int64_t value);
+
+  void OpenDocument(std::string_view name);
+  void OpenArray(std::string_view name);
+  void Close();
+
+  // Closes the top level document and returns it.
+  std::string Finish() &&;
+
+ private:
+  void AppendHeader(uint8_t type, std::string_view name);
+  template <typename T>
+  void AppendRaw(T value);
+
+  std::string data_;
+  // Offsets of the size fields of the open documents.
+  std::vector<size_t> open_;
+};
+
+template <typename T>
+T BsonValue::As() const {
+  if constexpr (std::is_same_v<T, bool>) {
+    return AsBool();
+  } else if constexpr (std::is_integral_v<T>) {
+    const auto value = AsInt64();
+    constexpr auto kMax = static_cast<uint64_t>(std::numeric_limits<T>::max());
+    if (value < static_cast<int64_t>(std::numeric_limits<T>::min()) ||
+        (value > 0 && static_cast<uint64_t>(value) > kMax)) {
+      throw BsonError{"integer out of range"};
+    }
+    return static_cast<T>(value);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return static_cast<T>(AsDouble());
+  } else if constexpr (std::is_same_v<T, std::string_view>) {
+    return AsStringView();
+  } else if constexpr (std::is_same_v<T, std::string>) {
+    return std::string{AsStringView()};
+  } else {
+    if (!IsArray()) ThrowTypeMismatch("array");
+    T result;
+    for (const auto& item : *this) {
+      result.push_back(item.template As<typename T::value_type>());
+    }
+    return result;
+  }
+}
+
+}  // namespace lavka
+
+#endif  // LAVKA_BSON_H
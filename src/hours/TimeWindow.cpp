@@ -0,0 +1,209 @@
+#include "TimeWindow.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LAVKA_TIME_WINDOW_X86
+#include <immintrin.h>
+#endif
+
+namespace lavka {
+
+namespace {
+
+std::optional<TimeWindow> ParseScalar(std::string_view window) {
+  if (window.size() != kTimeWindowSize) return std::nullopt;
+  const auto* chars = reinterpret_cast<const unsigned char*>(window.data());
+  // Wraps around for anything below '0', so one comparison checks a digit.
+  const auto digit = [chars](size_t i) {
+    return static_cast<unsigned>(chars[i]) - unsigned{'0'};
+  };
+
+  const unsigned start_hours = digit(0) * 10 + digit(1);
+  const unsigned start_minutes = digit(3) * 10 + digit(4);
+  const unsigned end_hours = digit(6) * 10 + digit(7);
+  const unsigned end_minutes = digit(9) * 10 + digit(10);
+  const unsigned start = start_hours * 60 + start_minutes;
+  const unsigned end = end_hours * 60 + end_minutes;
+
+  const bool valid =
+      (digit(0) <= 9) & (digit(1) <= 9) & (digit(3) <= 9) & (digit(4) <= 9) &
+      (digit(6) <= 9) & (digit(7) <= 9) & (digit(9) <= 9) & (digit(10) <= 9) &
+      (chars[2] == ':') & (chars[5] == '-') & (chars[8] == ':') &
+      (start_hours <= 23) & (start_minutes <= 59) & (end_hours <= 23) &
+      (end_minutes <= 59) & (start <= end);
+  if (!valid) return std::nullopt;
+  return TimeWindow{static_cast<uint16_t>(start), static_cast<uint16_t>(end)};
+}
+
+size_t ParseScalarBatch(const std::string_view* windows, size_t count,
+                        TimeWindow* out) {
+  for (size_t i = 0; i < count; ++i) {
+    const auto window = ParseScalar(windows[i]);
+    if (!window.has_value()) return i;
+    out[i] = window.value();
+  }
+  return count;
+}
+
+#ifdef LAVKA_TIME_WINDOW_X86
+
+// The vector code checks every byte of a window against a [lo, hi] range,
+// picks the eight digits, turns them into HH, MM, HH, MM with one multiply
+// add and into minutes with another.
+
+// The window zero padded to 16 bytes, its string_view may end right after
+// the 11th byte.
+__m128i Load(std::string_view window) {
+  alignas(16) char buffer[16] = {};
+  std::memcpy(buffer, window.data(), kTimeWindowSize);
+  return _mm_load_si128(reinterpret_cast<const __m128i*>(buffer));
+}
+
+__m128i CharsLow() {
+  return _mm_setr_epi8('0', '0', ':', '0', '0', '-', '0', '0', ':', '0', '0',
+                       0, 0, 0, 0, 0);
+}
+
+__m128i CharsHigh() {
+  return _mm_setr_epi8('9', '9', ':', '9', '9', '-', '9', '9', ':', '9', '9',
+                       0, 0, 0, 0, 0);
+}
+
+__m128i DigitsOrder() {
+  return _mm_setr_epi8(0, 1, 3, 4, 6, 7, 9, 10, -1, -1, -1, -1, -1, -1, -1,
+                       -1);
+}
+
+__m128i Tens() {
+  return _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+}
+
+__m128i Limits() { return _mm_setr_epi16(23, 59, 23, 59, 0, 0, 0, 0); }
+
+__m128i ToMinutes() { return _mm_setr_epi16(60, 1, 60, 1, 0, 0, 0, 0); }
+
+__attribute__((target("ssse3"))) size_t ParseSsse3(
+    const std::string_view* windows, size_t count, TimeWindow* out) {
+  const auto low = CharsLow();
+  const auto high = CharsHigh();
+  const auto zero = _mm_set1_epi8('0');
+  const auto order = DigitsOrder();
+  const auto tens = Tens();
+  const auto limits = Limits();
+  const auto to_minutes = ToMinutes();
+
+  for (size_t i = 0; i < count; ++i) {
+    if (windows[i].size() != kTimeWindowSize) return i;
+    const auto chars = Load(windows[i]);
+    const auto in_range =
+        _mm_cmpeq_epi8(_mm_min_epu8(_mm_max_epu8(chars, low), high), chars);
+    const auto numbers = _mm_maddubs_epi16(
+        _mm_shuffle_epi8(_mm_sub_epi8(chars, zero), order), tens);
+    const auto too_big = _mm_cmpgt_epi16(numbers, limits);
+    const auto minutes = _mm_madd_epi16(numbers, to_minutes);
+    const int start = _mm_cvtsi128_si32(minutes);
+    const int end = _mm_cvtsi128_si32(_mm_srli_si128(minutes, 4));
+
+    if ((_mm_movemask_epi8(in_range) != 0xFFFF) |
+        (_mm_movemask_epi8(too_big) != 0) | (start > end))
+      return i;
+    out[i] = {static_cast<uint16_t>(start), static_cast<uint16_t>(end)};
+  }
+  return count;
+}
+
+// Two windows per step, one in each 128-bit lane.
+__attribute__((target("avx2"))) size_t ParseAvx2(
+    const std::string_view* windows, size_t count, TimeWindow* out) {
+  const auto low = _mm256_broadcastsi128_si256(CharsLow());
+  const auto high = _mm256_broadcastsi128_si256(CharsHigh());
+  const auto zero = _mm256_set1_epi8('0');
+  const auto order = _mm256_broadcastsi128_si256(DigitsOrder());
+  const auto tens = _mm256_broadcastsi128_si256(Tens());
+  const auto limits = _mm256_broadcastsi128_si256(Limits());
+  const auto to_minutes = _mm256_broadcastsi128_si256(ToMinutes());
+
+  size_t i = 0;
+  for (; i + 1 < count; i += 2) {
+    if (windows[i].size() != kTimeWindowSize ||
+        windows[i + 1].size() != kTimeWindowSize)
+      break;
+    const auto chars = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(Load(windows[i])), Load(windows[i + 1]), 1);
+    const auto in_range = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(_mm256_max_epu8(chars, low), high), chars);
+    const auto numbers = _mm256_maddubs_epi16(
+        _mm256_shuffle_epi8(_mm256_sub_epi8(chars, zero), order), tens);
+    const auto too_big = _mm256_cmpgt_epi16(numbers, limits);
+    const auto minutes = _mm256_madd_epi16(numbers, to_minutes);
+
+    const auto bad =
+        ~static_cast<uint32_t>(_mm256_movemask_epi8(in_range)) |
+        static_cast<uint32_t>(_mm256_movemask_epi8(too_big));
+    const int first_start = _mm256_extract_epi32(minutes, 0);
+    const int first_end = _mm256_extract_epi32(minutes, 1);
+    const int second_start = _mm256_extract_epi32(minutes, 4);
+    const int second_end = _mm256_extract_epi32(minutes, 5);
+
+    if (((bad & 0xFFFF) != 0) | (first_start > first_end)) return i;
+    out[i] = {static_cast<uint16_t>(first_start),
+              static_cast<uint16_t>(first_end)};
+    if (((bad >> 16) != 0) | (second_start > second_end)) return i + 1;
+    out[i + 1] = {static_cast<uint16_t>(second_start),
+                  static_cast<uint16_t>(second_end)};
+  }
+  // The odd last window, or the rest after a window of a wrong size.
+  return i + ParseSsse3(windows + i, count - i, out + i);
+}
+
+#endif
+
+}  // namespace
+
+bool IsSupported(TimeWindowParser parser) {
+  switch (parser) {
+    case TimeWindowParser::kScalar:
+      return true;
+#ifdef LAVKA_TIME_WINDOW_X86
+    case TimeWindowParser::kSsse3:
+      return __builtin_cpu_supports("ssse3");
+    case TimeWindowParser::kAvx2:
+      return __builtin_cpu_supports("avx2") &&
+             __builtin_cpu_supports("ssse3");
+#else
+    default:
+      return false;
+#endif
+  }
+  return false;
+}
+
+std::optional<TimeWindow> ParseTimeWindow(std::string_view window) {
+  return ParseScalar(window);
+}
+
+size_t ParseTimeWindows(const std::string_view* windows, size_t count,
+                        TimeWindow* out, TimeWindowParser parser) {
+  switch (parser) {
+#ifdef LAVKA_TIME_WINDOW_X86
+    case TimeWindowParser::kAvx2:
+      return ParseAvx2(windows, count, out);
+    case TimeWindowParser::kSsse3:
+      return ParseSsse3(windows, count, out);
+#endif
+    default:
+      return ParseScalarBatch(windows, count, out);
+  }
+}
+
+size_t ParseTimeWindows(const std::string_view* windows, size_t count,
+                        TimeWindow* out) {
+  static const auto parser =
+      IsSupported(TimeWindowParser::kAvx2)    ? TimeWindowParser::kAvx2
+      : IsSupported(TimeWindowParser::kSsse3) ? TimeWindowParser::kSsse3
+                                              : TimeWindowParser::kScalar;
+  return ParseTimeWindows(windows, count, out, parser);
+}
+
+}  // namespace lavka
@@ -0,0 +1,46 @@
+#ifndef LAVKA_TIMEWINDOW_H
+#define LAVKA_TIMEWINDOW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace lavka {
+
+// HH:MM-HH:MM window as minutes since midnight, start <= end.
+struct TimeWindow {
+  uint16_t start;
+  uint16_t end;
+
+  bool operator==(const TimeWindow& other) const {
+    return start == other.start && end == other.end;
+  }
+};
+
+inline constexpr size_t kTimeWindowSize = 11;
+
+enum class TimeWindowParser { kScalar, kSsse3, kAvx2 };
+
+// Whether the CPU runs the parser, kScalar always.
+bool IsSupported(TimeWindowParser parser);
+
+// Digits, separators and ranges are checked without branches or
+// allocations. Unlike the old std::stoi based check signs, spaces and
+// trailing garbage in a number are rejected.
+std::optional<TimeWindow> ParseTimeWindow(std::string_view window);
+
+// Parses windows[i] into out[i] until the first invalid window and returns
+// how many were parsed, all of them are valid if it returns count. Uses
+// the fastest parser the CPU supports: AVX2 checks two windows per step,
+// SSSE3 one.
+size_t ParseTimeWindows(const std::string_view* windows, size_t count,
+                        TimeWindow* out);
+
+// Same with the given parser, which must be supported.
+size_t ParseTimeWindows(const std::string_view* windows, size_t count,
+                        TimeWindow* out, TimeWindowParser parser);
+
+}  // namespace lavka
+
+#endif  // LAVKA_TIMEWINDOW_H
@@ -0,0 +1,118 @@
+#include "CandidatesHandler.h"
+
+#include "RegionIndex.h"
+#include "../formats/BodyFormat.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
+namespace lavka {
+
+namespace {
+
+constexpr size_t kDefaultLimit = 100;
+constexpr size_t kMaxLimit = 1000;
+
+class CandidatesHandler final
+    : public userver::server::handlers::HttpHandlerBase {
+ public:
+  static constexpr std::string_view kName = "handler-couriers-candidates";
+  RegionIndex& region_index_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+
+  CandidatesHandler(
+      const userver::components::ComponentConfig& config,
+      const userver::components::ComponentContext& component_context)
+      : HttpHandlerBase(config, component_context),
+        region_index_(component_context.FindComponent<RegionIndex>()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()){};
+
+  std::string HandleRequestThrow(
+      const userver::server::http::HttpRequest& request,
+      userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    auto slot = concurrency_limiter_.TryAcquire(request, Priority::kHigh);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
+    switch (request.GetMethod()) {
+      case userver::server::http::HttpMethod::kGet:
+        return GetCandidates(request, scope);
+      default:
+        throw userver::server::handlers::ClientError(
+            userver::server::handlers::ExternalBody{
+                fmt::format("Unsupported method {}", request.GetMethod())});
+    }
+  }
+
+  // Query: region, courier_type, time (HH:MM), limit (up to 1000). Served
+  // from the region index, so the result may miss changes of the last
+  // update_interval of LAVKA_REGION_INDEX.
+  std::string GetCandidates(const userver::server::http::HttpRequest& request,
+                            RequestScope& scope) const {
+    int region = 0;
+    std::optional<std::string_view> courier_type;
+    std::optional<int> minute;
+    size_t limit = kDefaultLimit;
+    try {
+      region = std::stoi(request.GetArg("region"));
+      if (request.HasArg("courier_type")) {
+        courier_type = request.GetArg("courier_type");
+      }
+      if (request.HasArg("time")) {
+        // HH:MM is checked as a window of a single minute.
+        const auto& time = request.GetArg("time");
+        const auto window = ParseTimeWindow(fmt::format("{}-{}", time, time));
+        if (!window) {
+          request.SetResponseStatus(
+              userver::server::http::HttpStatus::kBadRequest);
+          return {};
+        }
+        minute = window->start;
+      }
+      if (request.HasArg("limit")) limit = std::stoul(request.GetArg("limit"));
+    } catch (...) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+    if (region <= 0 || limit == 0 || limit > kMaxLimit) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    const auto snapshot = region_index_.Get();
+    const auto couriers = snapshot->FindCouriers(region, courier_type, minute);
+    if (!couriers) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+    const auto& open_orders = snapshot->OpenOrders(region);
+
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto response) {
+      response["couriers"] = couriers->ToVector(limit);
+      response["couriers_total"] =
+          static_cast<int64_t>(couriers->Cardinality());
+      response["open_orders"] = open_orders.ToVector(limit);
+      response["open_orders_total"] =
+          static_cast<int64_t>(open_orders.Cardinality());
+      return response.ExtractValue();
+    });
+  }
+};
+
+}  // namespace
+
+void AppendCandidates(userver::components::ComponentList& component_list) {
+  component_list.Append<RegionIndex>();
+  component_list.Append<CandidatesHandler>();
+}
+
+}  // namespace lavka
@@ -0,0 +1,12 @@
+#ifndef LAVKA_CANDIDATESHANDLER_H
+#define LAVKA_CANDIDATESHANDLER_H
+
+#include "../lavka.h"
+
+namespace lavka {
+
+void AppendCandidates(userver::components::ComponentList& component_list);
+
+}  // namespace lavka
+
+#endif  // LAVKA_CANDIDATESHANDLER_H
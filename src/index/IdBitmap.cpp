@@ -0,0 +1,210 @@
+#include "IdBitmap.h"
+
+#include <algorithm>
+
+namespace lavka {
+
+namespace {
+
+uint64_t KeyOf(int64_t id) { return static_cast<uint64_t>(id) >> 16; }
+
+uint16_t LowOf(int64_t id) { return static_cast<uint16_t>(id & 0xFFFF); }
+
+// Probes the larger side when the sizes differ a lot, merges otherwise.
+std::vector<uint16_t> Intersect(const std::vector<uint16_t>& lhs,
+                                const std::vector<uint16_t>& rhs) {
+  const auto& small = lhs.size() <= rhs.size() ? lhs : rhs;
+  const auto& large = lhs.size() <= rhs.size() ? rhs : lhs;
+  std::vector<uint16_t> result;
+  result.reserve(small.size());
+  if (small.size() * 32 < large.size()) {
+    auto from = large.begin();
+    for (const auto low : small) {
+      from = std::lower_bound(from, large.end(), low);
+      if (from == large.end()) break;
+      if (*from == low) result.push_back(low);
+    }
+    return result;
+  }
+  std::set_intersection(small.begin(), small.end(), large.begin(),
+                        large.end(), std::back_inserter(result));
+  return result;
+}
+
+}  // namespace
+
+bool IdBitmap::Chunk::Contains(uint16_t low) const {
+  if (IsBitset()) return (bits[low / 64] >> (low % 64)) & 1;
+  return std::binary_search(array.begin(), array.end(), low);
+}
+
+void IdBitmap::Chunk::ToBitset() {
+  bits.assign(kWords, 0);
+  for (const auto low : array) bits[low / 64] |= uint64_t{1} << (low % 64);
+  array = {};
+}
+
+void IdBitmap::Chunk::ToArray() {
+  array.clear();
+  array.reserve(cardinality);
+  for (size_t word = 0; word < kWords; ++word) {
+    for (auto value = bits[word]; value != 0; value &= value - 1) {
+      array.push_back(static_cast<uint16_t>(word * 64 + __builtin_ctzll(value)));
+    }
+  }
+  bits = {};
+}
+
+std::vector<IdBitmap::Chunk>::iterator IdBitmap::Find(uint64_t key) {
+  return std::lower_bound(
+      chunks_.begin(), chunks_.end(), key,
+      [](const Chunk& chunk, uint64_t value) { return chunk.key < value; });
+}
+
+std::vector<IdBitmap::Chunk>::const_iterator IdBitmap::Find(
+    uint64_t key) const {
+  return std::lower_bound(
+      chunks_.begin(), chunks_.end(), key,
+      [](const Chunk& chunk, uint64_t value) { return chunk.key < value; });
+}
+
+void IdBitmap::Add(int64_t id) {
+  const auto key = KeyOf(id);
+  const auto low = LowOf(id);
+  auto chunk = Find(key);
+  if (chunk == chunks_.end() || chunk->key != key) {
+    chunk = chunks_.insert(chunk, Chunk{key, {}, {}, 0});
+  }
+
+  if (chunk->IsBitset()) {
+    auto& word = chunk->bits[low / 64];
+    const auto bit = uint64_t{1} << (low % 64);
+    if (!(word & bit)) {
+      word |= bit;
+      ++chunk->cardinality;
+    }
+    return;
+  }
+
+  const auto it =
+      std::lower_bound(chunk->array.begin(), chunk->array.end(), low);
+  if (it != chunk->array.end() && *it == low) return;
+  chunk->array.insert(it, low);
+  ++chunk->cardinality;
+  if (chunk->cardinality > kMaxArraySize) chunk->ToBitset();
+}
+
+void IdBitmap::Remove(int64_t id) {
+  const auto key = KeyOf(id);
+  const auto low = LowOf(id);
+  const auto chunk = Find(key);
+  if (chunk == chunks_.end() || chunk->key != key) return;
+
+  if (chunk->IsBitset()) {
+    auto& word = chunk->bits[low / 64];
+    const auto bit = uint64_t{1} << (low % 64);
+    if (!(word & bit)) return;
+    word &= ~bit;
+    --chunk->cardinality;
+    if (chunk->cardinality <= kMaxArraySize) chunk->ToArray();
+  } else {
+    const auto it =
+        std::lower_bound(chunk->array.begin(), chunk->array.end(), low);
+    if (it == chunk->array.end() || *it != low) return;
+    chunk->array.erase(it);
+    --chunk->cardinality;
+  }
+  if (chunk->cardinality == 0) chunks_.erase(chunk);
+}
+
+bool IdBitmap::Contains(int64_t id) const {
+  const auto key = KeyOf(id);
+  const auto chunk = Find(key);
+  return chunk != chunks_.end() && chunk->key == key &&
+         chunk->Contains(LowOf(id));
+}
+
+size_t IdBitmap::Cardinality() const {
+  size_t result = 0;
+  for (const auto& chunk : chunks_) result += chunk.cardinality;
+  return result;
+}
+
+IdBitmap::Chunk IdBitmap::And(const Chunk& lhs, const Chunk& rhs) {
+  Chunk result{lhs.key, {}, {}, 0};
+  if (lhs.IsBitset() && rhs.IsBitset()) {
+    result.bits.resize(kWords);
+    for (size_t word = 0; word < kWords; ++word) {
+      result.bits[word] = lhs.bits[word] & rhs.bits[word];
+      result.cardinality += __builtin_popcountll(result.bits[word]);
+    }
+    if (result.cardinality <= kMaxArraySize) result.ToArray();
+    return result;
+  }
+
+  if (lhs.IsBitset() || rhs.IsBitset()) {
+    const auto& array = lhs.IsBitset() ? rhs.array : lhs.array;
+    const auto& bitset = lhs.IsBitset() ? lhs : rhs;
+    result.array.reserve(array.size());
+    for (const auto low : array) {
+      if (bitset.Contains(low)) result.array.push_back(low);
+    }
+  } else {
+    result.array = Intersect(lhs.array, rhs.array);
+  }
+  result.cardinality = static_cast<uint32_t>(result.array.size());
+  return result;
+}
+
+IdBitmap IdBitmap::And(const IdBitmap& lhs, const IdBitmap& rhs) {
+  IdBitmap result;
+  auto left = lhs.chunks_.begin();
+  auto right = rhs.chunks_.begin();
+  while (left != lhs.chunks_.end() && right != rhs.chunks_.end()) {
+    if (left->key < right->key) {
+      ++left;
+    } else if (right->key < left->key) {
+      ++right;
+    } else {
+      auto chunk = And(*left, *right);
+      if (chunk.cardinality != 0) result.chunks_.push_back(std::move(chunk));
+      ++left;
+      ++right;
+    }
+  }
+  return result;
+}
+
+std::vector<int64_t> IdBitmap::ToVector(size_t limit) const {
+  std::vector<int64_t> result;
+  result.reserve(std::min(limit, Cardinality()));
+  ForEach([&](int64_t id) {
+    if (result.size() >= limit) return false;
+    result.push_back(id);
+    return true;
+  });
+  return result;
+}
+
+size_t IdBitmap::MemoryUsage() const {
+  size_t result = chunks_.capacity() * sizeof(Chunk);
+  for (const auto& chunk : chunks_) {
+    result += chunk.array.capacity() * sizeof(uint16_t) +
+              chunk.bits.capacity() * sizeof(uint64_t);
+  }
+  return result;
+}
+
+bool IdBitmap::operator==(const IdBitmap& other) const {
+  if (chunks_.size() != other.chunks_.size()) return false;
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    const auto& lhs = chunks_[i];
+    const auto& rhs = other.chunks_[i];
+    if (lhs.key != rhs.key || lhs.cardinality != rhs.cardinality ||
+        lhs.array != rhs.array || lhs.bits != rhs.bits)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace lavka
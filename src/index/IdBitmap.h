@@ -0,0 +1,89 @@
+#ifndef LAVKA_IDBITMAP_H
+#define LAVKA_IDBITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace lavka {
+
+// Compressed set of non-negative ids in the manner of roaring bitmaps: ids
+// are split by their upper bits into chunks of 65536, a chunk is a sorted
+// array of the lower 16 bits while it holds up to kMaxArraySize ids and a
+// 65536-bit set above that. Dense chunks cost 8 KiB, sparse ones two bytes
+// per id, and intersections work chunk by chunk without touching ids
+// missing from either side.
+class IdBitmap final {
+ public:
+  static constexpr size_t kMaxArraySize = 4096;
+
+  void Add(int64_t id);
+  void Remove(int64_t id);
+  bool Contains(int64_t id) const;
+
+  size_t Cardinality() const;
+  bool IsEmpty() const { return chunks_.empty(); }
+
+  // Ids present in both.
+  static IdBitmap And(const IdBitmap& lhs, const IdBitmap& rhs);
+
+  // Calls func(id) in ascending order while it returns true.
+  template <typename Func>
+  void ForEach(const Func& func) const;
+
+  // The first `limit` ids in ascending order.
+  std::vector<int64_t> ToVector(size_t limit = SIZE_MAX) const;
+
+  size_t MemoryUsage() const;
+
+  bool operator==(const IdBitmap& other) const;
+
+ private:
+  static constexpr size_t kChunkBits = 16;
+  static constexpr size_t kWords = (size_t{1} << kChunkBits) / 64;
+
+  struct Chunk {
+    uint64_t key;
+    // Sorted lower bits, empty once `bits` is used.
+    std::vector<uint16_t> array;
+    // kWords words or empty.
+    std::vector<uint64_t> bits;
+    uint32_t cardinality{0};
+
+    bool IsBitset() const { return !bits.empty(); }
+    bool Contains(uint16_t low) const;
+    void ToBitset();
+    void ToArray();
+  };
+
+  static Chunk And(const Chunk& lhs, const Chunk& rhs);
+
+  std::vector<Chunk>::iterator Find(uint64_t key);
+  std::vector<Chunk>::const_iterator Find(uint64_t key) const;
+
+  // Ascending by key, never empty.
+  std::vector<Chunk> chunks_;
+};
+
+template <typename Func>
+void IdBitmap::ForEach(const Func& func) const {
+  for (const auto& chunk : chunks_) {
+    const auto high = static_cast<int64_t>(chunk.key << kChunkBits);
+    if (!chunk.IsBitset()) {
+      for (const auto low : chunk.array) {
+        if (!func(high | low)) return;
+      }
+      continue;
+    }
+    for (size_t word = 0; word < kWords; ++word) {
+      for (auto bits = chunk.bits[word]; bits != 0; bits &= bits - 1) {
+        const auto low = word * 64 + __builtin_ctzll(bits);
+        if (!func(high | static_cast<int64_t>(low))) return;
+      }
+    }
+  }
+}
+
+}  // namespace lavka
+
+#endif  // LAVKA_IDBITMAP_H
@@ -0,0 +1,429 @@
+#include "RegionIndex.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+#include <userver/engine/sleep.hpp>
+#include <userver/engine/task/cancel.hpp>
+#include <userver/logging/log.hpp>
+
+#include "../couriers/CourierCache.h"
+#include "../statistics/QueryAccounting.h"
+
+namespace lavka {
+
+namespace {
+
+const userver::storages::postgres::Query kSelectLastEventId{
+    "SELECT COALESCE(MAX(event_id), 0) FROM service_schema.change_log",
+    userver::storages::postgres::Query::Name{"select_last_event_id"},
+};
+
+const userver::storages::postgres::Query kSelectOpenOrders{
+    "SELECT order_id, regions, TRUE FROM service_schema.orders "
+    "WHERE complete_time IS NULL",
+    userver::storages::postgres::Query::Name{"select_open_orders_for_index"},
+};
+
+const userver::storages::postgres::Query kSelectChanges{
+    "SELECT event_id, entity, entity_id FROM service_schema.change_log "
+    "WHERE event_id > $1 ORDER BY event_id LIMIT $2",
+    userver::storages::postgres::Query::Name{"select_region_index_changes"},
+};
+
+const userver::storages::postgres::Query kSelectCouriersByIds{
+    "SELECT courier_id, courier_type, regions, working_hours, "
+    "NULL::BIGINT[], version FROM service_schema.couriers "
+    "WHERE courier_id = ANY($1)",
+    userver::storages::postgres::Query::Name{
+        "select_couriers_by_ids_for_index"},
+};
+
+const userver::storages::postgres::Query kSelectOrdersByIds{
+    "SELECT order_id, regions, complete_time IS NULL "
+    "FROM service_schema.orders WHERE order_id = ANY($1)",
+    userver::storages::postgres::Query::Name{"select_orders_by_ids_for_index"},
+};
+
+struct ChangeDto {
+  int64_t event_id;
+  std::string entity;
+  int64_t entity_id;
+};
+
+struct IndexedOrderDto {
+  int64_t order_id;
+  int regions;
+  bool open;
+};
+
+const userver::storages::postgres::TransactionOptions kSnapshotRead{
+    userver::storages::postgres::IsolationLevel::kRepeatableRead,
+    userver::storages::postgres::TransactionOptions::kReadOnly};
+
+const SharedIdBitmap& EmptyBitmap() {
+  static const auto kEmpty = std::make_shared<const IdBitmap>();
+  return kEmpty;
+}
+
+uint64_t HoursShardOf(int64_t courier_id) {
+  return static_cast<uint64_t>(courier_id) >> kCourierHoursShardBits;
+}
+
+std::optional<size_t> CourierTypeIndex(std::string_view courier_type) {
+  const auto it = std::find(kIndexedCourierTypes.begin(),
+                            kIndexedCourierTypes.end(), courier_type);
+  if (it == kIndexedCourierTypes.end()) return std::nullopt;
+  return it - kIndexedCourierTypes.begin();
+}
+
+// Copy-on-write over a snapshot: a bitmap or an hours shard is copied the
+// first time the update changes it, the rest stay shared with the current
+// snapshot.
+class SnapshotBuilder final {
+ public:
+  explicit SnapshotBuilder(const RegionIndexSnapshot& current)
+      : snapshot_(std::make_shared<RegionIndexSnapshot>(current)) {}
+
+  void AddCourier(const CourierDto& courier) {
+    if (snapshot_->FindCourierHours(courier.courier_id)) return;
+
+    // One by one: ParseTimeWindows stops at the first invalid window.
+    std::vector<TimeWindow> windows;
+    windows.reserve(courier.working_hours.size());
+    for (const auto& hours : courier.working_hours) {
+      if (const auto window = ParseTimeWindow(hours)) {
+        windows.push_back(*window);
+      }
+    }
+    if (windows.size() != courier.working_hours.size()) {
+      LOG_WARNING() << "Courier " << courier.courier_id
+                    << " has invalid working hours, indexing the valid ones";
+    }
+
+    for (const auto region : courier.regions) {
+      Mutable(snapshot_->couriers_by_region[region]).Add(courier.courier_id);
+    }
+    if (const auto type = CourierTypeIndex(courier.courier_type)) {
+      Mutable(snapshot_->couriers_by_type[*type]).Add(courier.courier_id);
+    }
+    for (const auto& window : windows) {
+      for (auto slot = window.start / kScheduleSlotMinutes;
+           slot <= window.end / kScheduleSlotMinutes &&
+           slot < static_cast<int>(kScheduleSlots);
+           ++slot) {
+        Mutable(snapshot_->couriers_by_slot[slot]).Add(courier.courier_id);
+      }
+    }
+    MutableHours(courier.courier_id)
+        .emplace(courier.courier_id, std::move(windows));
+  }
+
+  // Orders never change their region, so the current state of the row
+  // is enough to tell whether it belongs to the index.
+  void ApplyOrder(const IndexedOrderDto& order) {
+    auto& orders = snapshot_->open_orders_by_region[order.regions];
+    if (order.open) {
+      Mutable(orders).Add(order.order_id);
+    } else if (orders && orders->Contains(order.order_id)) {
+      Mutable(orders).Remove(order.order_id);
+    }
+  }
+
+  std::shared_ptr<const RegionIndexSnapshot> Finish(int64_t last_event_id) && {
+    snapshot_->last_event_id = last_event_id;
+    for (auto* bitmaps : {&snapshot_->couriers_by_region,
+                          &snapshot_->open_orders_by_region}) {
+      for (auto it = bitmaps->begin(); it != bitmaps->end();) {
+        if (!it->second || it->second->IsEmpty()) {
+          it = bitmaps->erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    return std::move(snapshot_);
+  }
+
+ private:
+  IdBitmap& Mutable(SharedIdBitmap& bitmap) {
+    if (!bitmap || !copied_.count(bitmap.get())) {
+      auto copy = bitmap ? std::make_shared<IdBitmap>(*bitmap)
+                         : std::make_shared<IdBitmap>();
+      copied_.insert(copy.get());
+      bitmap = std::move(copy);
+    }
+    // Only bitmaps created by this builder get here, none is shared yet.
+    return const_cast<IdBitmap&>(*bitmap);
+  }
+
+  CourierHoursShard& MutableHours(int64_t courier_id) {
+    auto& shard = snapshot_->courier_hours[HoursShardOf(courier_id)];
+    if (!shard || !copied_hours_.count(shard.get())) {
+      auto copy = shard ? std::make_shared<CourierHoursShard>(*shard)
+                        : std::make_shared<CourierHoursShard>();
+      copied_hours_.insert(copy.get());
+      shard = std::move(copy);
+    }
+    return const_cast<CourierHoursShard&>(*shard);
+  }
+
+  std::shared_ptr<RegionIndexSnapshot> snapshot_;
+  std::unordered_set<const IdBitmap*> copied_;
+  std::unordered_set<const CourierHoursShard*> copied_hours_;
+};
+
+}  // namespace
+
+RegionIndexConfig Parse(const userver::formats::json::Value& value,
+                        userver::formats::parse::To<RegionIndexConfig>) {
+  RegionIndexConfig config;
+  config.update_interval = std::chrono::milliseconds{
+      value["update_interval_ms"].As<int64_t>(config.update_interval.count())};
+  config.max_events = value["max_events"].As<size_t>(config.max_events);
+  return config;
+}
+
+RegionIndexConfig ParseRegionIndexConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_REGION_INDEX").As<RegionIndexConfig>();
+}
+
+RegionIndexSnapshot::RegionIndexSnapshot() {
+  couriers_by_type.fill(EmptyBitmap());
+  couriers_by_slot.fill(EmptyBitmap());
+}
+
+const std::vector<TimeWindow>* RegionIndexSnapshot::FindCourierHours(
+    int64_t courier_id) const {
+  const auto shard = courier_hours.find(HoursShardOf(courier_id));
+  if (shard == courier_hours.end()) return nullptr;
+  const auto hours = shard->second->find(courier_id);
+  return hours == shard->second->end() ? nullptr : &hours->second;
+}
+
+size_t RegionIndexSnapshot::CouriersCount() const {
+  size_t count = 0;
+  for (const auto& [key, shard] : courier_hours) count += shard->size();
+  return count;
+}
+
+std::optional<IdBitmap> RegionIndexSnapshot::FindCouriers(
+    int region, std::optional<std::string_view> courier_type,
+    std::optional<int> minute) const {
+  std::optional<size_t> type;
+  if (courier_type) {
+    type = CourierTypeIndex(*courier_type);
+    if (!type) return std::nullopt;
+  }
+
+  const auto it = couriers_by_region.find(region);
+  if (it == couriers_by_region.end()) return IdBitmap{};
+  auto result = type ? IdBitmap::And(*it->second, *couriers_by_type[*type])
+                     : *it->second;
+
+  if (minute) {
+    if (*minute < 0 || *minute >= 24 * 60) return IdBitmap{};
+    // The slot narrows the candidates down to couriers working within
+    // half an hour of the minute, their hours are checked exactly.
+    result = IdBitmap::And(
+        result, *couriers_by_slot[*minute / kScheduleSlotMinutes]);
+    IdBitmap on_shift;
+    result.ForEach([&](int64_t courier_id) {
+      const auto* hours = FindCourierHours(courier_id);
+      if (hours &&
+          std::any_of(hours->begin(), hours->end(),
+                      [&](const TimeWindow& window) {
+                        return window.start <= *minute &&
+                               *minute <= window.end;
+                      })) {
+        on_shift.Add(courier_id);
+      }
+      return true;
+    });
+    result = std::move(on_shift);
+  }
+  return result;
+}
+
+const IdBitmap& RegionIndexSnapshot::OpenOrders(int region) const {
+  const auto it = open_orders_by_region.find(region);
+  return it == open_orders_by_region.end() ? *EmptyBitmap() : *it->second;
+}
+
+RegionIndex::RegionIndex(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()),
+      pg_cluster_(
+          component_context
+              .FindComponent<userver::components::Postgres>("postgres-db-1")
+              .GetCluster()),
+      statistics_(component_context.FindComponent<Statistics>()),
+      courier_cache_(component_context.FindComponent<CourierCache>()),
+      snapshot_(std::make_shared<const RegionIndexSnapshot>()) {
+  try {
+    FullLoad();
+    // Catch up before the service is ready.
+    const auto index_config = config_source_.GetCopy(kRegionIndexConfig);
+    while (Update(index_config)) {
+    }
+  } catch (const std::exception& e) {
+    // Lookups see an empty index until the background task loads it.
+    LOG_ERROR() << "Failed to load the region index: " << e;
+    ++update_errors_;
+  }
+
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-region-index",
+              [this](userver::utils::statistics::Writer& writer) {
+                const auto snapshot = Get();
+                size_t memory = 0;
+                size_t open_orders = 0;
+                for (const auto& [region, couriers] :
+                     snapshot->couriers_by_region) {
+                  memory += couriers->MemoryUsage();
+                }
+                for (const auto& [region, orders] :
+                     snapshot->open_orders_by_region) {
+                  memory += orders->MemoryUsage();
+                  open_orders += orders->Cardinality();
+                }
+                for (const auto& couriers : snapshot->couriers_by_type) {
+                  memory += couriers->MemoryUsage();
+                }
+                for (const auto& couriers : snapshot->couriers_by_slot) {
+                  memory += couriers->MemoryUsage();
+                }
+                writer["couriers"] = snapshot->CouriersCount();
+                writer["open-orders"] = open_orders;
+                writer["regions"] = snapshot->couriers_by_region.size();
+                writer["bitmap-bytes"] = memory;
+                writer["last-event-id"] = snapshot->last_event_id;
+                writer["full-loads"] = full_loads_.load();
+                writer["update-errors"] = update_errors_.load();
+              });
+
+  task_ = userver::engine::CriticalAsyncNoSpan([this] { Run(); });
+}
+
+RegionIndex::~RegionIndex() {
+  task_.SyncCancel();
+  statistics_holder_.Unregister();
+}
+
+void RegionIndex::Run() {
+  while (!userver::engine::current_task::ShouldCancel()) {
+    const auto config = config_source_.GetCopy(kRegionIndexConfig);
+    bool behind = false;
+    try {
+      if (!loaded_) FullLoad();
+      behind = Update(config);
+    } catch (const std::exception& e) {
+      if (userver::engine::current_task::ShouldCancel()) return;
+      LOG_WARNING() << "Failed to update the region index: " << e;
+      ++update_errors_;
+    }
+    if (!behind) userver::engine::InterruptibleSleepFor(config.update_interval);
+  }
+}
+
+void RegionIndex::FullLoad() {
+  const auto couriers = courier_cache_.Get();
+
+  auto transaction = pg_cluster_->Begin(
+      "transaction_load_region_index",
+      userver::storages::postgres::ClusterHostType::kSlave, kSnapshotRead);
+  // The rows read in the same snapshot include every event up to it.
+  const auto last_event_id =
+      ExecuteAccounted(statistics_, transaction, kSelectLastEventId)
+          .AsSingleRow<int64_t>();
+  const auto orders =
+      ExecuteAccounted(statistics_, transaction, kSelectOpenOrders)
+          .AsContainer<std::vector<IndexedOrderDto>>(
+              userver::storages::postgres::kRowTag);
+  transaction.Commit();
+
+  SnapshotBuilder builder{RegionIndexSnapshot{}};
+  for (const auto& [courier_id, courier] : *couriers->couriers) {
+    builder.AddCourier(courier);
+  }
+  for (const auto& order : orders) builder.ApplyOrder(order);
+  // Update replays the events between the cache and the orders snapshot,
+  // applying an event twice does not change the index.
+  snapshot_.Assign(std::move(builder).Finish(
+      std::min(couriers->last_event_id, last_event_id)));
+  loaded_ = true;
+  ++full_loads_;
+}
+
+bool RegionIndex::Update(const RegionIndexConfig& config) {
+  const auto current = Get();
+
+  auto transaction = pg_cluster_->Begin(
+      "transaction_update_region_index",
+      userver::storages::postgres::ClusterHostType::kSlave, kSnapshotRead);
+  const auto changes =
+      ExecuteAccounted(statistics_, transaction, kSelectChanges,
+                       current->last_event_id,
+                       static_cast<int64_t>(config.max_events))
+          .AsContainer<std::vector<ChangeDto>>(
+              userver::storages::postgres::kRowTag);
+  if (changes.empty()) {
+    transaction.Commit();
+    return false;
+  }
+
+  // Couriers never change, the ones the cache already has are not read.
+  const auto cached = courier_cache_.Get();
+  std::vector<CourierDto> couriers;
+  std::vector<int64_t> courier_ids;
+  std::vector<int64_t> order_ids;
+  for (const auto& change : changes) {
+    if (change.entity == "courier") {
+      if (current->FindCourierHours(change.entity_id)) continue;
+      const auto it = cached->couriers->find(change.entity_id);
+      if (it != cached->couriers->end()) {
+        couriers.push_back(it->second);
+      } else {
+        courier_ids.push_back(change.entity_id);
+      }
+    } else if (change.entity == "order") {
+      order_ids.push_back(change.entity_id);
+    }
+  }
+  if (!courier_ids.empty()) {
+    for (auto& courier :
+         ExecuteAccounted(statistics_, transaction, kSelectCouriersByIds,
+                          courier_ids)
+             .AsContainer<std::vector<CourierDto>>(
+                 userver::storages::postgres::kRowTag)) {
+      couriers.push_back(std::move(courier));
+    }
+  }
+  std::vector<IndexedOrderDto> orders;
+  if (!order_ids.empty()) {
+    orders = ExecuteAccounted(statistics_, transaction, kSelectOrdersByIds,
+                              order_ids)
+                 .AsContainer<std::vector<IndexedOrderDto>>(
+                     userver::storages::postgres::kRowTag);
+  }
+  transaction.Commit();
+
+  SnapshotBuilder builder{*current};
+  for (const auto& courier : couriers) builder.AddCourier(courier);
+  for (const auto& order : orders) builder.ApplyOrder(order);
+  snapshot_.Assign(std::move(builder).Finish(changes.back().event_id));
+  return changes.size() == config.max_events;
+}
+
+}  // namespace lavka
@@ -0,0 +1,132 @@
+#ifndef LAVKA_REGIONINDEX_H
+#define LAVKA_REGIONINDEX_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/task/task_with_result.hpp>
+#include <userver/rcu/rcu.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "IdBitmap.h"
+#include "../couriers/CouriersHandler.h"
+#include "../hours/TimeWindow.h"
+
+namespace lavka {
+
+class CourierCache;
+class Statistics;
+
+struct RegionIndexConfig {
+  std::chrono::milliseconds update_interval{1000};
+  // Change log events read per update.
+  size_t max_events{10000};
+};
+
+RegionIndexConfig Parse(const userver::formats::json::Value& value,
+                        userver::formats::parse::To<RegionIndexConfig>);
+
+RegionIndexConfig ParseRegionIndexConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseRegionIndexConfig>
+    kRegionIndexConfig;
+
+using SharedIdBitmap = std::shared_ptr<const IdBitmap>;
+
+// Working hours of the couriers whose ids share the upper bits, the unit
+// an update copies.
+using CourierHoursShard = std::unordered_map<int64_t, std::vector<TimeWindow>>;
+inline constexpr size_t kCourierHoursShardBits = 16;
+
+// The day split into half hours, a courier is in every slot its working
+// hours touch.
+inline constexpr size_t kScheduleSlots = 48;
+inline constexpr int kScheduleSlotMinutes = 24 * 60 / kScheduleSlots;
+
+// Courier types in the order of RegionIndexSnapshot::couriers_by_type.
+inline constexpr std::array<std::string_view, 3> kIndexedCourierTypes = {
+    courierType::foot, courierType::bike, courierType::_auto};
+
+struct RegionIndexSnapshot {
+  int64_t last_event_id{0};
+
+  std::unordered_map<int, SharedIdBitmap> couriers_by_region;
+  std::array<SharedIdBitmap, kIndexedCourierTypes.size()> couriers_by_type;
+  std::array<SharedIdBitmap, kScheduleSlots> couriers_by_slot;
+  // Exact working hours of the couriers in a slot, by the shard of the id.
+  std::unordered_map<uint64_t, std::shared_ptr<const CourierHoursShard>>
+      courier_hours;
+
+  std::unordered_map<int, SharedIdBitmap> open_orders_by_region;
+
+  RegionIndexSnapshot();
+
+  // nullptr for a courier that is not indexed.
+  const std::vector<TimeWindow>* FindCourierHours(int64_t courier_id) const;
+  size_t CouriersCount() const;
+
+  // Couriers working in the region, of the type and on shift at the minute
+  // of the day when those are given. nullopt for an unknown type.
+  std::optional<IdBitmap> FindCouriers(
+      int region, std::optional<std::string_view> courier_type,
+      std::optional<int> minute) const;
+
+  const IdBitmap& OpenOrders(int region) const;
+};
+
+// Inverted index from region to the couriers working in it and to its
+// open orders, for matching couriers and orders without scanning either.
+// On start the couriers are taken from the CourierCache snapshot and only
+// the open orders are read from the replica. Then the index is caught up
+// from service_schema.change_log: created couriers (from the cache while
+// it has them) and orders are added, completed orders are removed from
+// their region. Snapshots share every bitmap and hours shard an update
+// does not touch.
+//
+// The index lags the master by up to update_interval, the completion
+// check keeps reading the rows it validates from the master.
+class RegionIndex final : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-region-index";
+
+  RegionIndex(const userver::components::ComponentConfig& config,
+              const userver::components::ComponentContext& component_context);
+  ~RegionIndex() override;
+
+  std::shared_ptr<const RegionIndexSnapshot> Get() const {
+    return snapshot_.ReadCopy();
+  }
+
+ private:
+  void Run();
+  void FullLoad();
+  // Returns whether there may be more events to read.
+  bool Update(const RegionIndexConfig& config);
+
+  userver::dynamic_config::Source config_source_;
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  CourierCache& courier_cache_;
+
+  userver::rcu::Variable<std::shared_ptr<const RegionIndexSnapshot>> snapshot_;
+  bool loaded_{false};
+
+  std::atomic<uint64_t> full_loads_{0};
+  std::atomic<uint64_t> update_errors_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+
+  userver::engine::TaskWithResult<void> task_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_REGIONINDEX_H
@@ -1,6 +1,18 @@
 #include "lavka.h"
 #include "fstream"
 
+#include <charconv>
+
+#include <userver/utils/str_icase.hpp>
+
+#include "changes/ChangeFeed.h"
+#include "compression/ResponseCompressor.h"
+#include "formats/BodyFormat.h"
+#include "hours/TimeWindow.h"
+#include "limits/ConcurrencyLimiter.h"
+#include "limits/RateLimiter.h"
+#include "statistics/Statistics.h"
+
 namespace lavka {
 
   userver::engine::Mutex DatabaseAccessManager::couriers_mutex_;
@@ -12,36 +24,97 @@ namespace lavka {
     return orders_mutex_;
   }
 
-  bool IsValidHours(const std::string& working_hours) {
-    if (working_hours.size() != 11) return false;
-
-    if (working_hours[5] != '-') return false;
-
-    if (working_hours[2] != ':' || working_hours[8] != ':') return false;
+  bool IsValidHours(std::string_view working_hours) {
+    return ParseTimeWindow(working_hours).has_value();
+  }
 
-    int hours1 = std::stoi(working_hours.substr(0, 2));
-    int hours2 = std::stoi(working_hours.substr(6, 2));
+  std::optional<std::vector<int64_t>> ParseIds(std::string_view ids,
+                                               size_t max_count) {
+    std::vector<int64_t> result;
+    while (!ids.empty()) {
+      const auto comma = ids.find(',');
+      const auto id = ids.substr(0, comma);
+      int64_t value = 0;
+      const auto [end, error] =
+          std::from_chars(id.data(), id.data() + id.size(), value);
+      if (id.empty() || error != std::errc{} || end != id.data() + id.size())
+        return std::nullopt;
+      result.push_back(value);
+      if (result.size() > max_count) return std::nullopt;
 
-    if (hours1 < 0 || hours1 > 23 || hours2 < 0 || hours2 > 23) return false;
+      if (comma == std::string_view::npos) break;
+      ids.remove_prefix(comma + 1);
+      if (ids.empty()) return std::nullopt;
+    }
+    if (result.empty()) return std::nullopt;
+    return result;
+  }
 
-    int minutes1 = std::stoi(working_hours.substr(3, 2));
-    int minutes2 = std::stoi(working_hours.substr(9, 2));
+  std::string AppendVary(std::string_view vary, std::string_view header) {
+    std::string_view rest = vary;
+    while (!rest.empty()) {
+      const auto comma = rest.find(',');
+      auto entry = rest.substr(0, comma);
+      while (!entry.empty() && entry.front() == ' ') entry.remove_prefix(1);
+      while (!entry.empty() && entry.back() == ' ') entry.remove_suffix(1);
+      if (entry == "*" || userver::utils::StrIcaseEqual{}(entry, header))
+        return std::string{vary};
+      if (comma == std::string_view::npos) break;
+      rest.remove_prefix(comma + 1);
+    }
+    if (vary.empty()) return std::string{header};
+    return fmt::format("{}, {}", vary, header);
+  }
 
-    if (minutes1 < 0 || minutes1 > 59 || minutes2 < 0 || minutes2 > 59)
-      return false;
+  void AddVary(const userver::server::http::HttpRequest& request,
+               std::string_view header) {
+    auto& response = request.GetHttpResponse();
+    const std::string vary =
+        response.HasHeader("Vary") ? response.GetHeader("Vary") : "";
+    response.SetHeader(std::string{"Vary"}, AppendVary(vary, header));
+  }
 
-    if (hours1 > hours2) return false;
+  std::string MakeETag(int64_t version, BodyFormat format) {
+    if (format == BodyFormat::kBson) {
+      return fmt::format("\"{}-bson\"", version);
+    }
+    return fmt::format("\"{}\"", version);
+  }
 
-    if (hours1 == hours2) {
-      if (minutes1 > minutes2) return false;
+  bool MatchesIfNoneMatch(std::string_view if_none_match,
+                          std::string_view etag) {
+    // If-None-Match uses the weak comparison, W/ prefixes are ignored.
+    while (!if_none_match.empty()) {
+      const auto comma = if_none_match.find(',');
+      auto tag = if_none_match.substr(0, comma);
+      while (!tag.empty() && tag.front() == ' ') tag.remove_prefix(1);
+      while (!tag.empty() && tag.back() == ' ') tag.remove_suffix(1);
+      if (tag.substr(0, 2) == "W/") tag.remove_prefix(2);
+      if (tag == "*" || tag == etag) return true;
+      if (comma == std::string_view::npos) break;
+      if_none_match.remove_prefix(comma + 1);
     }
+    return false;
+  }
 
+  bool IsNotModified(const userver::server::http::HttpRequest& request,
+                     const std::string& etag) {
+    request.GetHttpResponse().SetHeader(std::string{"ETag"}, etag);
+    if (!MatchesIfNoneMatch(request.GetHeader("If-None-Match"), etag)) {
+      return false;
+    }
+    request.SetResponseStatus(userver::server::http::HttpStatus::kNotModified);
     return true;
   }
 
   void AppendLavka(userver::components::ComponentList& component_list) {
     component_list.Append<userver::components::Postgres>("postgres-db-1");
     component_list.Append<userver::clients::dns::Component>();
+    component_list.Append<Statistics>();
+    component_list.Append<RateLimiter>();
+    component_list.Append<ConcurrencyLimiter>();
+    component_list.Append<ChangeFeed>();
+    component_list.Append<ResponseCompressor>();
   }
 
 }
@@ -2,8 +2,10 @@
 #define LAVKA_LAVKA_H
 
 #include <cstdint>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include <fmt/format.h>
 
@@ -31,7 +33,36 @@ class DatabaseAccessManager {
   static userver::engine::Mutex& GetOrdersMutex();
 };
 
-bool IsValidHours(const std::string& working_hours);
+// HH:MM-HH:MM with the start not after the end, see ParseTimeWindow.
+bool IsValidHours(std::string_view working_hours);
+
+// Comma separated list of ids from the `ids` query argument, nullopt if it
+// is empty, malformed or longer than max_count.
+std::optional<std::vector<int64_t>> ParseIds(std::string_view ids,
+                                             size_t max_count);
+
+// Vary value listing `header` in addition to the ones already in `vary`.
+std::string AppendVary(std::string_view vary, std::string_view header);
+
+// Adds `header` to the Vary header of the response, keeping what other
+// negotiations have put there.
+void AddVary(const userver::server::http::HttpRequest& request,
+             std::string_view header);
+
+enum class BodyFormat;
+
+// Strong ETag of a row version in the given body format. The JSON and
+// BSON bodies of a row differ byte for byte, so they get different tags.
+std::string MakeETag(int64_t version, BodyFormat format);
+
+// Whether an If-None-Match value lists `etag` or is `*`, with the weak
+// comparison.
+bool MatchesIfNoneMatch(std::string_view if_none_match, std::string_view etag);
+
+// Sets the ETag header. If the request's If-None-Match lists it, sets 304
+// and returns true, the response body is then left empty.
+bool IsNotModified(const userver::server::http::HttpRequest& request,
+                   const std::string& etag);
 
 void AppendLavka(userver::components::ComponentList& component_list);
 
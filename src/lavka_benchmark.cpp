@@ -0,0 +1,474 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <sstream>
+
+#include "lavka.h"
+
+#include "couriers/CouriersHandler.h"
+#include "formats/BodyFormat.h"
+#include "hours/TimeWindow.h"
+#include "index/IdBitmap.h"
+#include "memory/RequestArena.h"
+#include "orders/OrdersCompleteHandler.h"
+#include "orders/OrdersHandler.h"
+
+namespace {
+
+// Calls of the global allocator, for the allocations per request counters.
+std::atomic<uint64_t> allocations{0};
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace {
+
+constexpr int64_t kMinRecords = 1;
+constexpr int64_t kMaxRecords = 100'000;
+
+userver::formats::json::Value ReadDataset(std::string_view file_name) {
+  std::ifstream file{std::string{LAVKA_BENCHMARK_DATASET_DIR} + "/" +
+                     std::string{file_name}};
+  std::stringstream content;
+  content << file.rdbuf();
+  return userver::formats::json::FromString(content.str());
+}
+
+// Repeats the records of a dataset array until it holds `count` elements.
+userver::formats::json::Value Replicate(
+    const userver::formats::json::Value& records, size_t count) {
+  userver::formats::json::ValueBuilder builder{
+      userver::formats::common::Type::kArray};
+  for (size_t i = 0; i < count; ++i) {
+    builder.PushBack(records[i % records.GetSize()]);
+  }
+  return builder.ExtractValue();
+}
+
+const userver::formats::json::Value& Couriers() {
+  static const auto couriers = ReadDataset("couriers.txt");
+  return couriers;
+}
+
+const userver::formats::json::Value& Orders() {
+  static const auto orders = ReadDataset("orders.txt");
+  return orders;
+}
+
+const userver::formats::json::Value& CompleteInfo() {
+  static const auto complete_info =
+      ReadDataset("complete_orders.txt")["complete_info"];
+  return complete_info;
+}
+
+std::vector<lavka::OrderDto> MakeOrders(size_t count) {
+  std::vector<lavka::OrderDto> orders;
+  orders.reserve(count);
+  for (const auto& order : Replicate(Orders(), count)) {
+    orders.push_back({static_cast<int64_t>(orders.size() + 1),
+                      order["weight"].As<double>(),
+                      order["regions"].As<int>(),
+                      order["delivery_hours"].As<std::vector<std::string>>(),
+                      order["cost"].As<int>(),
+                      std::nullopt});
+  }
+  return orders;
+}
+
+std::vector<lavka::CourierDto> MakeCouriers(size_t count) {
+  std::vector<lavka::CourierDto> couriers;
+  couriers.reserve(count);
+  for (const auto& courier : Replicate(Couriers(), count)) {
+    couriers.push_back(
+        {static_cast<int64_t>(couriers.size() + 1),
+         courier["courier_type"].As<std::string>(),
+         courier["regions"].As<std::vector<int>>(),
+         courier["working_hours"].As<std::vector<std::string>>(),
+         std::nullopt});
+  }
+  return couriers;
+}
+
+}  // namespace
+
+void IsValidHours(benchmark::State& state) {
+  std::vector<std::string> hours;
+  for (const auto& order : Replicate(Orders(), state.range(0))) {
+    hours.push_back(order["delivery_hours"][0].As<std::string>());
+  }
+
+  for (auto _ : state) {
+    for (const auto& interval : hours) {
+      benchmark::DoNotOptimize(lavka::IsValidHours(interval));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * hours.size());
+}
+BENCHMARK(IsValidHours)->RangeMultiplier(10)->Range(kMinRecords, kMaxRecords);
+
+void ParseTimeWindows(benchmark::State& state,
+                      lavka::TimeWindowParser parser) {
+  if (!lavka::IsSupported(parser)) {
+    state.SkipWithError("not supported by the CPU");
+    return;
+  }
+  std::vector<std::string> hours;
+  for (const auto& order : Replicate(Orders(), state.range(0))) {
+    hours.push_back(order["delivery_hours"][0].As<std::string>());
+  }
+  const std::vector<std::string_view> views(hours.begin(), hours.end());
+  std::vector<lavka::TimeWindow> windows(views.size());
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(lavka::ParseTimeWindows(
+        views.data(), views.size(), windows.data(), parser));
+  }
+  state.SetItemsProcessed(state.iterations() * views.size());
+}
+BENCHMARK_CAPTURE(ParseTimeWindows, scalar, lavka::TimeWindowParser::kScalar)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(ParseTimeWindows, ssse3, lavka::TimeWindowParser::kSsse3)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(ParseTimeWindows, avx2, lavka::TimeWindowParser::kAvx2)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+// Couriers of a region (one of 20) that have a type (one of 3) among
+// range(0) couriers, as the region index filters them: an intersection of
+// bitmaps or, for comparison, of sorted id vectors.
+void IntersectCouriers(benchmark::State& state, bool use_bitmaps) {
+  std::vector<int64_t> region_ids, type_ids;
+  lavka::IdBitmap region, type;
+  for (int64_t id = 1; id <= state.range(0); ++id) {
+    if (id % 20 == 0) {
+      region_ids.push_back(id);
+      region.Add(id);
+    }
+    if (id % 3 == 0) {
+      type_ids.push_back(id);
+      type.Add(id);
+    }
+  }
+
+  for (auto _ : state) {
+    if (use_bitmaps) {
+      benchmark::DoNotOptimize(lavka::IdBitmap::And(region, type));
+    } else {
+      std::vector<int64_t> result;
+      std::set_intersection(region_ids.begin(), region_ids.end(),
+                            type_ids.begin(), type_ids.end(),
+                            std::back_inserter(result));
+      benchmark::DoNotOptimize(result);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["bitmap_bytes"] = region.MemoryUsage() + type.MemoryUsage();
+}
+BENCHMARK_CAPTURE(IntersectCouriers, bitmap, true)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords * 10);
+BENCHMARK_CAPTURE(IntersectCouriers, sorted_vector, false)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords * 10);
+
+void IsComplete(benchmark::State& state) {
+  const auto couriers = MakeCouriers(state.range(0));
+  const auto orders = MakeOrders(state.range(0));
+  std::vector<std::string> complete_times;
+  for (const auto& info : Replicate(CompleteInfo(), state.range(0))) {
+    complete_times.push_back(info["complete_time"].As<std::string>());
+  }
+
+  for (auto _ : state) {
+    for (size_t i = 0; i < complete_times.size(); ++i) {
+      benchmark::DoNotOptimize(
+          lavka::IsComplete(couriers[i].working_hours,
+                            orders[i].delivery_hours, complete_times[i]));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * complete_times.size());
+}
+BENCHMARK(IsComplete)->RangeMultiplier(10)->Range(kMinRecords, kMaxRecords);
+
+void IsOrderJsonValid(benchmark::State& state) {
+  const auto orders = Replicate(Orders(), state.range(0));
+
+  for (auto _ : state) {
+    for (const auto& order : orders) {
+      benchmark::DoNotOptimize(lavka::IsOrderJsonValid(order));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * orders.GetSize());
+}
+BENCHMARK(IsOrderJsonValid)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void IsCourierJsonValid(benchmark::State& state) {
+  const auto couriers = Replicate(Couriers(), state.range(0));
+
+  for (auto _ : state) {
+    for (const auto& courier : couriers) {
+      benchmark::DoNotOptimize(lavka::IsCourierJsonValid(courier));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * couriers.GetSize());
+}
+BENCHMARK(IsCourierJsonValid)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void SerializeOrders(benchmark::State& state) {
+  const auto orders = MakeOrders(state.range(0));
+
+  for (auto _ : state) {
+    userver::formats::json::ValueBuilder ordersBuilder{orders};
+    benchmark::DoNotOptimize(
+        userver::formats::json::ToStableString(ordersBuilder.ExtractValue()));
+  }
+  state.SetItemsProcessed(state.iterations() * orders.size());
+}
+BENCHMARK(SerializeOrders)->RangeMultiplier(10)->Range(kMinRecords, kMaxRecords);
+
+void SerializeCouriers(benchmark::State& state) {
+  const auto couriers = MakeCouriers(state.range(0));
+
+  for (auto _ : state) {
+    userver::formats::json::ValueBuilder couriersBuilder{couriers};
+    benchmark::DoNotOptimize(userver::formats::json::ToStableString(
+        couriersBuilder.ExtractValue()));
+  }
+  state.SetItemsProcessed(state.iterations() * couriers.size());
+}
+BENCHMARK(SerializeCouriers)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+// JSON against BSON for the order and courier lists: encoding the value
+// built from the DTOs, decoding the body back (a BSON body is only checked,
+// it is read in place) and the size of the payload.
+template <typename Dto>
+std::string EncodeList(lavka::BodyFormat format,
+                       const std::vector<Dto>& records) {
+  const auto value =
+      userver::formats::json::ValueBuilder{records}.ExtractValue();
+  if (format == lavka::BodyFormat::kBson) return lavka::ToBsonString(value);
+  return userver::formats::json::ToStableString(value);
+}
+
+template <typename Dto>
+void EncodeList(benchmark::State& state, lavka::BodyFormat format,
+                const std::vector<Dto>& records) {
+  std::string body;
+  for (auto _ : state) {
+    body = EncodeList(format, records);
+    benchmark::DoNotOptimize(body);
+  }
+  state.SetItemsProcessed(state.iterations() * records.size());
+  state.counters["payload_bytes"] = body.size();
+}
+
+template <typename Dto>
+void DecodeList(benchmark::State& state, lavka::BodyFormat format,
+                const std::vector<Dto>& records) {
+  const auto body = EncodeList(format, records);
+  for (auto _ : state) {
+    if (format == lavka::BodyFormat::kBson) {
+      benchmark::DoNotOptimize(lavka::BsonValue::FromBinary(body));
+    } else {
+      benchmark::DoNotOptimize(userver::formats::json::FromString(body));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * records.size());
+  state.SetBytesProcessed(state.iterations() * body.size());
+  state.counters["payload_bytes"] = body.size();
+}
+
+void EncodeOrders(benchmark::State& state, lavka::BodyFormat format) {
+  EncodeList(state, format, MakeOrders(state.range(0)));
+}
+BENCHMARK_CAPTURE(EncodeOrders, json, lavka::BodyFormat::kJson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(EncodeOrders, bson, lavka::BodyFormat::kBson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void DecodeOrders(benchmark::State& state, lavka::BodyFormat format) {
+  DecodeList(state, format, MakeOrders(state.range(0)));
+}
+BENCHMARK_CAPTURE(DecodeOrders, json, lavka::BodyFormat::kJson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(DecodeOrders, bson, lavka::BodyFormat::kBson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void EncodeCouriers(benchmark::State& state, lavka::BodyFormat format) {
+  EncodeList(state, format, MakeCouriers(state.range(0)));
+}
+BENCHMARK_CAPTURE(EncodeCouriers, json, lavka::BodyFormat::kJson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(EncodeCouriers, bson, lavka::BodyFormat::kBson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void DecodeCouriers(benchmark::State& state, lavka::BodyFormat format) {
+  DecodeList(state, format, MakeCouriers(state.range(0)));
+}
+BENCHMARK_CAPTURE(DecodeCouriers, json, lavka::BodyFormat::kJson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(DecodeCouriers, bson, lavka::BodyFormat::kBson)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void ParseRequestBody(benchmark::State& state,
+                      const userver::formats::json::Value& body) {
+  const auto body_str = userver::formats::json::ToString(body);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(userver::formats::json::FromString(body_str));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * body_str.size());
+}
+
+void ParseOrdersBody(benchmark::State& state) {
+  ParseRequestBody(state, Replicate(Orders(), state.range(0)));
+}
+BENCHMARK(ParseOrdersBody)->RangeMultiplier(10)->Range(kMinRecords, kMaxRecords);
+
+void ParseCouriersBody(benchmark::State& state) {
+  ParseRequestBody(state, Replicate(Couriers(), state.range(0)));
+}
+BENCHMARK(ParseCouriersBody)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void ParseCompleteOrdersBody(benchmark::State& state) {
+  userver::formats::json::ValueBuilder body;
+  body["complete_info"] = Replicate(CompleteInfo(), state.range(0));
+  ParseRequestBody(state, body.ExtractValue());
+}
+BENCHMARK(ParseCompleteOrdersBody)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+// POST /orders and POST /couriers without the DB: parse the body, validate
+// it, build the DTOs and serialize the response. `global` is the pipeline
+// over the JSON tree with the DTO copies in the global allocator, `arena`
+// builds the DTOs in a RequestArena.
+void PostOrdersPipeline(benchmark::State& state, bool use_arena) {
+  const auto body_str =
+      userver::formats::json::ToString(Replicate(Orders(), state.range(0)));
+  const auto allocations_before = allocations.load();
+
+  for (auto _ : state) {
+    const auto body = userver::formats::json::FromString(body_str);
+    if (use_arena) {
+      lavka::RequestArena arena{body_str.size()};
+      auto orders = lavka::ParseNewOrders(body, arena);
+      int64_t order_id = 0;
+      for (auto& order : orders.value()) order.order_id = ++order_id;
+      benchmark::DoNotOptimize(userver::formats::json::ToStableString(
+          userver::formats::json::ValueBuilder{orders.value()}
+              .ExtractValue()));
+      continue;
+    }
+
+    for (const auto& order : body) {
+      benchmark::DoNotOptimize(lavka::IsOrderJsonValid(order));
+    }
+    userver::formats::json::ValueBuilder response;
+    int64_t order_id = 0;
+    for (const auto& order : body) {
+      benchmark::DoNotOptimize(order["weight"].As<float>());
+      benchmark::DoNotOptimize(order["regions"].As<int>());
+      benchmark::DoNotOptimize(
+          order["delivery_hours"].As<std::vector<std::string>>());
+      benchmark::DoNotOptimize(order["cost"].As<int>());
+      userver::formats::json::ValueBuilder created{order};
+      created["order_id"] = ++order_id;
+      response.PushBack(created.ExtractValue());
+    }
+    benchmark::DoNotOptimize(
+        userver::formats::json::ToStableString(response.ExtractValue()));
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["allocs_per_request"] =
+      benchmark::Counter(allocations.load() - allocations_before,
+                         benchmark::Counter::kAvgIterations);
+}
+BENCHMARK_CAPTURE(PostOrdersPipeline, global, false)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(PostOrdersPipeline, arena, true)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+
+void PostCouriersPipeline(benchmark::State& state, bool use_arena) {
+  const auto body_str =
+      userver::formats::json::ToString(Replicate(Couriers(), state.range(0)));
+  const auto allocations_before = allocations.load();
+
+  for (auto _ : state) {
+    const auto body = userver::formats::json::FromString(body_str);
+    if (use_arena) {
+      lavka::RequestArena arena{body_str.size()};
+      auto couriers = lavka::ParseNewCouriers(body, arena);
+      int64_t courier_id = 0;
+      for (auto& courier : couriers.value()) courier.courier_id = ++courier_id;
+      benchmark::DoNotOptimize(userver::formats::json::ToStableString(
+          userver::formats::json::ValueBuilder{couriers.value()}
+              .ExtractValue()));
+      continue;
+    }
+
+    for (const auto& courier : body) {
+      benchmark::DoNotOptimize(lavka::IsCourierJsonValid(courier));
+    }
+    userver::formats::json::ValueBuilder response;
+    int64_t courier_id = 0;
+    for (const auto& courier : body) {
+      benchmark::DoNotOptimize(courier["courier_type"].As<std::string>());
+      benchmark::DoNotOptimize(courier["regions"].As<std::vector<int>>());
+      benchmark::DoNotOptimize(
+          courier["working_hours"].As<std::vector<std::string>>());
+      userver::formats::json::ValueBuilder created{courier};
+      created["courier_id"] = ++courier_id;
+      response.PushBack(created.ExtractValue());
+    }
+    benchmark::DoNotOptimize(
+        userver::formats::json::ToStableString(response.ExtractValue()));
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["allocs_per_request"] =
+      benchmark::Counter(allocations.load() - allocations_before,
+                         benchmark::Counter::kAvgIterations);
+}
+BENCHMARK_CAPTURE(PostCouriersPipeline, global, false)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
+BENCHMARK_CAPTURE(PostCouriersPipeline, arena, true)
+    ->RangeMultiplier(10)
+    ->Range(kMinRecords, kMaxRecords);
@@ -0,0 +1,446 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "compression/ResponseCompressor.h"
+#include "formats/BodyFormat.h"
+#include "formats/Bson.h"
+#include "hours/TimeWindow.h"
+#include "index/IdBitmap.h"
+#include "lavka.h"
+
+namespace {
+
+// IsValidHours before ParseTimeWindow, the reference of the differential
+// tests.
+bool LegacyIsValidHours(const std::string& working_hours) {
+  try {
+    if (working_hours.size() != 11) return false;
+    if (working_hours[5] != '-') return false;
+    if (working_hours[2] != ':' || working_hours[8] != ':') return false;
+
+    int hours1 = std::stoi(working_hours.substr(0, 2));
+    int hours2 = std::stoi(working_hours.substr(6, 2));
+    if (hours1 < 0 || hours1 > 23 || hours2 < 0 || hours2 > 23) return false;
+
+    int minutes1 = std::stoi(working_hours.substr(3, 2));
+    int minutes2 = std::stoi(working_hours.substr(9, 2));
+    if (minutes1 < 0 || minutes1 > 59 || minutes2 < 0 || minutes2 > 59)
+      return false;
+
+    if (hours1 > hours2) return false;
+    if (hours1 == hours2 && minutes1 > minutes2) return false;
+    return true;
+  } catch (...) {
+    return false;
+  }
+}
+
+// Minutes as the legacy code computed them in IsComplete.
+lavka::TimeWindow LegacyMinutes(const std::string& window) {
+  return {static_cast<uint16_t>(std::stoi(window.substr(0, 2)) * 60 +
+                                std::stoi(window.substr(3, 2))),
+          static_cast<uint16_t>(std::stoi(window.substr(6, 2)) * 60 +
+                                std::stoi(window.substr(9, 2)))};
+}
+
+// std::stoi also accepts signs, spaces and trailing garbage, which the new
+// parser rejects. Both must agree on windows made of digits only.
+bool HasOnlyDigits(const std::string& window) {
+  if (window.size() != lavka::kTimeWindowSize) return false;
+  for (const auto position : {0, 1, 3, 4, 6, 7, 9, 10}) {
+    if (window[position] < '0' || window[position] > '9') return false;
+  }
+  return true;
+}
+
+std::string FormatWindow(int start, int end) {
+  return fmt::format("{:02}:{:02}-{:02}:{:02}", start / 60, start % 60,
+                     end / 60, end % 60);
+}
+
+// Random windows: valid ones, near misses with the right separators and
+// garbage of random length.
+std::vector<std::string> RandomWindows(size_t count) {
+  std::mt19937 random{42};
+  const std::string alphabet = "0123456789012345678923569:- +a";
+  std::vector<std::string> windows;
+  windows.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    switch (random() % 3) {
+      case 0:
+        windows.push_back(
+            FormatWindow(random() % (24 * 60), random() % (24 * 60)));
+        break;
+      case 1: {
+        std::string window(lavka::kTimeWindowSize, '0');
+        for (auto& c : window) c = alphabet[random() % alphabet.size()];
+        window[2] = window[8] = ':';
+        window[5] = '-';
+        windows.push_back(std::move(window));
+        break;
+      }
+      default: {
+        std::string window(random() % 14, '0');
+        for (auto& c : window) c = alphabet[random() % alphabet.size()];
+        windows.push_back(std::move(window));
+      }
+    }
+  }
+  return windows;
+}
+
+const lavka::TimeWindowParser kParsers[] = {lavka::TimeWindowParser::kScalar,
+                                            lavka::TimeWindowParser::kSsse3,
+                                            lavka::TimeWindowParser::kAvx2};
+
+}  // namespace
+
+TEST(TimeWindow, AllValidWindows) {
+  for (int start = 0; start < 24 * 60; ++start) {
+    for (int end = 0; end < 24 * 60; end += 7) {
+      const auto window = FormatWindow(start, end);
+      const auto parsed = lavka::ParseTimeWindow(window);
+      ASSERT_EQ(parsed.has_value(), LegacyIsValidHours(window)) << window;
+      if (parsed.has_value()) {
+        EXPECT_EQ(parsed.value(), LegacyMinutes(window)) << window;
+      }
+    }
+  }
+}
+
+TEST(TimeWindow, DifferentialAgainstLegacy) {
+  for (const auto& window : RandomWindows(1'000'000)) {
+    const auto parsed = lavka::ParseTimeWindow(window);
+    const auto legacy = LegacyIsValidHours(window);
+    if (parsed.has_value()) {
+      ASSERT_TRUE(legacy) << window;
+      ASSERT_EQ(parsed.value(), LegacyMinutes(window)) << window;
+    } else if (HasOnlyDigits(window)) {
+      ASSERT_FALSE(legacy) << window;
+    }
+    ASSERT_EQ(lavka::IsValidHours(window), parsed.has_value()) << window;
+  }
+}
+
+TEST(TimeWindow, Rejected) {
+  for (const std::string window :
+       {"", "10:00-12:0", "10:00-12:000", "1a:00-12:00", " 1:00-12:00",
+        "+1:00-12:00", "10:00 12:00", "10-00-12:00", "24:00-24:00",
+        "10:60-12:00", "12:00-10:00", "12:01-12:00", "10:00-12:00\n"}) {
+    EXPECT_FALSE(lavka::ParseTimeWindow(window).has_value()) << window;
+  }
+  EXPECT_EQ(lavka::ParseTimeWindow("00:00-23:59"),
+            (lavka::TimeWindow{0, 23 * 60 + 59}));
+}
+
+TEST(TimeWindow, BatchParsersMatchScalar) {
+  const auto windows = RandomWindows(200'000);
+  const std::vector<std::string_view> views(windows.begin(), windows.end());
+  std::vector<lavka::TimeWindow> expected(views.size());
+  std::vector<lavka::TimeWindow> parsed(views.size());
+
+  for (const auto parser : kParsers) {
+    if (!lavka::IsSupported(parser)) continue;
+    // Batches of every length up to 33 from every offset, so both the pairs
+    // and the odd tail of the AVX2 parser meet invalid windows.
+    for (size_t offset = 0; offset + 33 < views.size(); offset += 17) {
+      const auto count = 1 + offset % 33;
+      const auto expected_count = lavka::ParseTimeWindows(
+          views.data() + offset, count, expected.data(),
+          lavka::TimeWindowParser::kScalar);
+      const auto parsed_count = lavka::ParseTimeWindows(
+          views.data() + offset, count, parsed.data(), parser);
+      ASSERT_EQ(parsed_count, expected_count) << static_cast<int>(parser);
+      for (size_t i = 0; i < parsed_count; ++i) {
+        ASSERT_EQ(parsed[i], expected[i]) << views[offset + i];
+      }
+    }
+  }
+}
+
+TEST(TimeWindow, BatchOfValidWindows) {
+  std::vector<std::string> windows;
+  for (int start = 0; start < 24 * 60; start += 5) {
+    windows.push_back(FormatWindow(start, 24 * 60 - 1));
+  }
+  const std::vector<std::string_view> views(windows.begin(), windows.end());
+  std::vector<lavka::TimeWindow> parsed(views.size());
+
+  for (const auto parser : kParsers) {
+    if (!lavka::IsSupported(parser)) continue;
+    ASSERT_EQ(lavka::ParseTimeWindows(views.data(), views.size(),
+                                      parsed.data(), parser),
+              views.size());
+    for (size_t i = 0; i < views.size(); ++i) {
+      EXPECT_EQ(parsed[i], LegacyMinutes(windows[i]));
+    }
+  }
+  EXPECT_EQ(
+      lavka::ParseTimeWindows(views.data(), views.size(), parsed.data()),
+      views.size());
+}
+
+namespace {
+
+// Ids clustered so that chunks cross kMaxArraySize both ways: a dense
+// chunk, a sparse one and a few far apart.
+int64_t RandomId(std::mt19937_64& random) {
+  switch (random() % 3) {
+    case 0:
+      return random() % 20000;
+    case 1:
+      return (int64_t{1} << 16) + random() % 65536;
+    default:
+      return random() % (int64_t{1} << 24);
+  }
+}
+
+std::vector<int64_t> ToVector(const std::set<int64_t>& ids) {
+  return {ids.begin(), ids.end()};
+}
+
+}  // namespace
+
+TEST(IdBitmap, DifferentialAgainstSet) {
+  std::mt19937_64 random{42};
+  lavka::IdBitmap bitmap;
+  std::set<int64_t> expected;
+  for (int i = 0; i < 200000; ++i) {
+    const auto id = RandomId(random);
+    // Adds outweigh removals, so chunks grow into bitsets and shrink back.
+    if (random() % 3 != 0) {
+      bitmap.Add(id);
+      expected.insert(id);
+    } else {
+      bitmap.Remove(id);
+      expected.erase(id);
+    }
+    ASSERT_EQ(bitmap.Contains(id), expected.count(id) == 1);
+  }
+  EXPECT_EQ(bitmap.Cardinality(), expected.size());
+  EXPECT_EQ(bitmap.ToVector(), ToVector(expected));
+  EXPECT_EQ(bitmap.ToVector(10),
+            std::vector<int64_t>(expected.begin(),
+                                 std::next(expected.begin(), 10)));
+
+  for (const auto id : ToVector(expected)) bitmap.Remove(id);
+  EXPECT_TRUE(bitmap.IsEmpty());
+  EXPECT_EQ(bitmap, lavka::IdBitmap{});
+}
+
+TEST(IdBitmap, And) {
+  std::mt19937_64 random{7};
+  lavka::IdBitmap lhs, rhs;
+  std::set<int64_t> lhs_ids, rhs_ids;
+  for (int i = 0; i < 100000; ++i) {
+    const auto id = RandomId(random);
+    if (random() % 2) {
+      lhs.Add(id);
+      lhs_ids.insert(id);
+    } else {
+      rhs.Add(id);
+      rhs_ids.insert(id);
+    }
+  }
+  std::set<int64_t> expected;
+  std::set_intersection(lhs_ids.begin(), lhs_ids.end(), rhs_ids.begin(),
+                        rhs_ids.end(),
+                        std::inserter(expected, expected.end()));
+  ASSERT_FALSE(expected.empty());
+
+  const auto result = lavka::IdBitmap::And(lhs, rhs);
+  EXPECT_EQ(result.ToVector(), ToVector(expected));
+  EXPECT_EQ(result, lavka::IdBitmap::And(rhs, lhs));
+  EXPECT_EQ(lavka::IdBitmap::And(lhs, lhs), lhs);
+  EXPECT_TRUE(lavka::IdBitmap::And(lhs, {}).IsEmpty());
+
+  std::vector<int64_t> first;
+  result.ForEach([&](int64_t id) {
+    first.push_back(id);
+    return first.size() < 3;
+  });
+  EXPECT_EQ(first, result.ToVector(3));
+}
+
+namespace {
+
+// POST /orders body as a BSON client sends it.
+std::string MakeOrdersBson() {
+  lavka::BsonWriter writer;
+  writer.OpenArray("items");
+  writer.OpenDocument("0");
+  writer.AppendDouble("weight", 1.5);
+  writer.AppendInt("regions", 3);
+  writer.OpenArray("delivery_hours");
+  writer.AppendString("0", "10:00-11:00");
+  writer.Close();
+  writer.AppendInt("cost", 5'000'000'000);
+  writer.Close();
+  writer.Close();
+  return std::move(writer).Finish();
+}
+
+}  // namespace
+
+TEST(Bson, ReadsWhatIsWritten) {
+  const auto data = MakeOrdersBson();
+  const auto document = lavka::BsonValue::FromBinary(data);
+  ASSERT_EQ(document.GetSize(), 1u);
+  const auto items = document["items"];
+  ASSERT_TRUE(items.IsArray());
+  ASSERT_EQ(items.GetSize(), 1u);
+
+  const auto order = *items.begin();
+  EXPECT_TRUE(order.IsObject());
+  EXPECT_EQ(order.GetSize(), 4u);
+  EXPECT_EQ(order["weight"].As<double>(), 1.5);
+  EXPECT_EQ(order["regions"].As<int>(), 3);
+  EXPECT_EQ(order["regions"].As<double>(), 3.0);
+  EXPECT_EQ(order["cost"].As<int64_t>(), 5'000'000'000);
+  EXPECT_EQ(order["delivery_hours"].As<std::vector<std::string>>(),
+            std::vector<std::string>{"10:00-11:00"});
+  EXPECT_FALSE(order.HasMember("courier_id"));
+  EXPECT_TRUE(order["courier_id"].IsMissing());
+}
+
+TEST(Bson, TypeMismatch) {
+  const auto data = MakeOrdersBson();
+  const auto order = *lavka::BsonValue::FromBinary(data)["items"].begin();
+  EXPECT_THROW(order["cost"].As<int>(), lavka::BsonError);
+  EXPECT_THROW(order["weight"].As<int>(), lavka::BsonError);
+  EXPECT_THROW(order["weight"].As<std::string>(), lavka::BsonError);
+  EXPECT_THROW(order["courier_id"].As<int64_t>(), lavka::BsonError);
+  EXPECT_THROW(order["regions"].GetSize(), lavka::BsonError);
+}
+
+TEST(Bson, RejectsMalformed) {
+  const auto data = MakeOrdersBson();
+  for (size_t size = 0; size < data.size(); ++size) {
+    EXPECT_THROW(lavka::BsonValue::FromBinary(data.substr(0, size)),
+                 lavka::BsonError)
+        << size;
+  }
+
+  // A 12-byte ObjectId has no JSON counterpart.
+  auto object_id = data;
+  object_id[4] = 0x07;
+  EXPECT_THROW(lavka::BsonValue::FromBinary(object_id), lavka::BsonError);
+
+  auto size_mismatch = data + '\0';
+  EXPECT_THROW(lavka::BsonValue::FromBinary(size_mismatch), lavka::BsonError);
+
+  EXPECT_TRUE(
+      lavka::BsonValue::FromBinary(std::string{"\x05\0\0\0\0", 5}).IsEmpty());
+}
+
+TEST(NegotiateEncoding, Quality) {
+  using lavka::Encoding;
+  using lavka::NegotiateEncoding;
+  EXPECT_EQ(NegotiateEncoding(""), Encoding::kIdentity);
+  EXPECT_EQ(NegotiateEncoding("br, identity"), Encoding::kIdentity);
+  EXPECT_EQ(NegotiateEncoding("gzip"), Encoding::kGzip);
+  EXPECT_EQ(NegotiateEncoding("X-GZIP"), Encoding::kGzip);
+  EXPECT_EQ(NegotiateEncoding("gzip, zstd"), Encoding::kZstd);
+  EXPECT_EQ(NegotiateEncoding("gzip;q=0.5, zstd;q=0.4"), Encoding::kGzip);
+  EXPECT_EQ(NegotiateEncoding("gzip;q=0.5, zstd;q=0.5"), Encoding::kZstd);
+  EXPECT_EQ(NegotiateEncoding("gzip ; Q=0.3 , zstd;q=0.2"), Encoding::kGzip);
+  EXPECT_EQ(NegotiateEncoding("*"), Encoding::kZstd);
+  EXPECT_EQ(NegotiateEncoding("*;q=0.5, gzip;q=0.8"), Encoding::kGzip);
+}
+
+TEST(NegotiateEncoding, ZeroQualityRefuses) {
+  using lavka::Encoding;
+  using lavka::NegotiateEncoding;
+  EXPECT_EQ(NegotiateEncoding("gzip;q=0"), Encoding::kIdentity);
+  EXPECT_EQ(NegotiateEncoding("zstd;q=0, gzip"), Encoding::kGzip);
+  EXPECT_EQ(NegotiateEncoding("zstd;q=0.0, gzip;q=0.000"),
+            Encoding::kIdentity);
+  EXPECT_EQ(NegotiateEncoding("*;q=0"), Encoding::kIdentity);
+  EXPECT_EQ(NegotiateEncoding("*, zstd;q=0"), Encoding::kGzip);
+  EXPECT_EQ(NegotiateEncoding("*;q=0, gzip"), Encoding::kGzip);
+  // A malformed quality counts as 0.
+  EXPECT_EQ(NegotiateEncoding("gzip;q=abc"), Encoding::kIdentity);
+}
+
+TEST(MatchesIfNoneMatch, WeakAndAny) {
+  using lavka::MatchesIfNoneMatch;
+  EXPECT_TRUE(MatchesIfNoneMatch("\"5\"", "\"5\""));
+  EXPECT_TRUE(MatchesIfNoneMatch("W/\"5\"", "\"5\""));
+  EXPECT_TRUE(MatchesIfNoneMatch("\"4\", W/\"5\"", "\"5\""));
+  EXPECT_TRUE(MatchesIfNoneMatch(" \"4\" ,\"5\" ", "\"5\""));
+  EXPECT_TRUE(MatchesIfNoneMatch("*", "\"5\""));
+  EXPECT_TRUE(MatchesIfNoneMatch("W/*", "\"5-bson\""));
+
+  EXPECT_FALSE(MatchesIfNoneMatch("", "\"5\""));
+  EXPECT_FALSE(MatchesIfNoneMatch("\"4\"", "\"5\""));
+  EXPECT_FALSE(MatchesIfNoneMatch("5", "\"5\""));
+  EXPECT_FALSE(MatchesIfNoneMatch("w/\"5\"", "\"5\""));
+  EXPECT_FALSE(MatchesIfNoneMatch("\"5\"", "\"5-bson\""));
+  EXPECT_FALSE(MatchesIfNoneMatch("\"5-bson\"", "\"5\""));
+}
+
+TEST(NegotiateFormat, Accept) {
+  using lavka::BodyFormat;
+  using lavka::NegotiateFormat;
+  EXPECT_EQ(NegotiateFormat("application/bson"), BodyFormat::kBson);
+  EXPECT_EQ(NegotiateFormat("Application/BSON"), BodyFormat::kBson);
+  EXPECT_EQ(NegotiateFormat(" application/bson ; charset=utf-8"),
+            BodyFormat::kBson);
+  EXPECT_EQ(NegotiateFormat("application/json;q=0.5, application/bson"),
+            BodyFormat::kBson);
+  EXPECT_EQ(NegotiateFormat("*/*;q=0.8, application/bson"), BodyFormat::kBson);
+  EXPECT_EQ(NegotiateFormat("application/*;q=0.2, application/bson;q=0.5"),
+            BodyFormat::kBson);
+  EXPECT_EQ(NegotiateFormat("text/html, application/bson;q=0.1"),
+            BodyFormat::kBson);
+}
+
+TEST(NegotiateFormat, PrefersJson) {
+  using lavka::BodyFormat;
+  using lavka::NegotiateFormat;
+  for (const std::string_view accept :
+       {"application/json, application/bson;q=0.5",
+        "application/bson, application/json", "application/bson, */*",
+        "application/bson;q=0.5, application/*",
+        "application/bson;q=0.5, */*;q=0.8",
+        "application/bson;q=0.5, application/*;q=0.5, */*;q=0.1"}) {
+    EXPECT_EQ(NegotiateFormat(accept), BodyFormat::kJson) << accept;
+  }
+}
+
+TEST(NegotiateFormat, UnsupportedFallsBackToJson) {
+  using lavka::BodyFormat;
+  using lavka::NegotiateFormat;
+  for (const std::string_view accept :
+       {"", "*/*", "application/*", "text/html", "application/xml, */*",
+        "application/bsonx", "application/x-bson", "bson",
+        "application/bson;q=0", "application/bson;q=0.0",
+        "application/json, application/bson;Q=0"}) {
+    EXPECT_EQ(NegotiateFormat(accept), BodyFormat::kJson) << accept;
+  }
+}
+
+TEST(ParseIds, Valid) {
+  using Ids = std::vector<int64_t>;
+  EXPECT_EQ(lavka::ParseIds("7", 10), (Ids{7}));
+  EXPECT_EQ(lavka::ParseIds("3,1,3", 10), (Ids{3, 1, 3}));
+  EXPECT_EQ(lavka::ParseIds("9223372036854775807", 10),
+            (Ids{9223372036854775807}));
+  EXPECT_EQ(lavka::ParseIds("1,2,3", 3), (Ids{1, 2, 3}));
+}
+
+TEST(ParseIds, Rejected) {
+  for (const std::string_view ids :
+       {"", ",", "1,", "1,,2", ",1", " 1", "1 ", "1;2", "a", "1a", "0x10",
+        "9223372036854775808", "99999999999999999999"}) {
+    EXPECT_FALSE(lavka::ParseIds(ids, 10)) << ids;
+  }
+  EXPECT_FALSE(lavka::ParseIds("1,2,3,4", 3));
+  EXPECT_FALSE(lavka::ParseIds("1", 0));
+}
@@ -0,0 +1,176 @@
+#include "ConcurrencyLimiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+
+namespace lavka {
+
+namespace {
+
+constexpr double kMinGradient = 0.5;
+// Floor of the window average, a window of 0us samples would make the
+// gradient NaN.
+constexpr double kMinRttUs = 1;
+
+}  // namespace
+
+ConcurrencyLimiterConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<ConcurrencyLimiterConfig>) {
+  ConcurrencyLimiterConfig config;
+  config.enabled = value["enabled"].As<bool>(config.enabled);
+  config.initial_limit =
+      value["initial_limit"].As<int64_t>(config.initial_limit);
+  config.min_limit = value["min_limit"].As<int64_t>(config.min_limit);
+  config.max_limit = value["max_limit"].As<int64_t>(config.max_limit);
+  config.low_priority_share =
+      value["low_priority_share"].As<double>(config.low_priority_share);
+  config.tolerance = value["tolerance"].As<double>(config.tolerance);
+  config.smoothing = value["smoothing"].As<double>(config.smoothing);
+  config.window_size = value["window_size"].As<int64_t>(config.window_size);
+  config.long_window = value["long_window"].As<int64_t>(config.long_window);
+  return config;
+}
+
+ConcurrencyLimiterConfig ParseConcurrencyLimiterConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_CONCURRENCY_LIMITER")
+      .As<ConcurrencyLimiterConfig>();
+}
+
+ConcurrencyLimiter::Slot::Slot(Slot&& other) noexcept
+    : limiter_(std::exchange(other.limiter_, nullptr)),
+      admitted_(other.admitted_),
+      connections_(other.connections_) {}
+
+ConcurrencyLimiter::Slot::~Slot() {
+  Release(std::chrono::steady_clock::duration::zero(), 0);
+}
+
+void ConcurrencyLimiter::Slot::Release(
+    std::chrono::steady_clock::duration db_time, uint64_t db_round_trips) {
+  if (limiter_ && admitted_) {
+    std::exchange(limiter_, nullptr)
+        ->Release(db_time, db_round_trips, connections_);
+  }
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()) {
+  const auto initial_limit =
+      config_source_.GetSnapshot()[kConcurrencyLimiterConfig].initial_limit;
+  limit_ = initial_limit;
+  estimated_limit_ = initial_limit;
+
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-concurrency-limiter",
+              [this](userver::utils::statistics::Writer& writer) {
+                writer["limit"] = limit_.load();
+                writer["inflight"] = inflight_.load();
+                writer["shed"].ValueWithLabels(shed_high_.load(),
+                                               {{"priority", "high"}});
+                writer["shed"].ValueWithLabels(shed_low_.load(),
+                                               {{"priority", "low"}});
+              });
+}
+
+ConcurrencyLimiter::~ConcurrencyLimiter() { statistics_holder_.Unregister(); }
+
+ConcurrencyLimiter::Slot ConcurrencyLimiter::TryAcquire(
+    const userver::server::http::HttpRequest& request, Priority priority,
+    int64_t connections) {
+  const auto snapshot = config_source_.GetSnapshot();
+  const auto& config = snapshot[kConcurrencyLimiterConfig];
+  if (!config.enabled) return Slot{nullptr, true, connections};
+
+  const auto limit = limit_.load();
+  const auto allowed =
+      priority == Priority::kHigh
+          ? limit
+          : std::max<int64_t>(
+                std::llround(limit * config.low_priority_share), 1);
+  // A wide request still runs alone under the smallest limit.
+  connections = std::clamp<int64_t>(connections, 1, allowed);
+
+  auto inflight = inflight_.load();
+  do {
+    if (inflight + connections > allowed) {
+      ++(priority == Priority::kHigh ? shed_high_ : shed_low_);
+      request.SetResponseStatus(
+          userver::server::http::HttpStatus::kTooManyRequests);
+      request.GetHttpResponse().SetHeader(std::string{"Retry-After"},
+                                          std::string{"1"});
+      return Slot{};
+    }
+  } while (
+      !inflight_.compare_exchange_weak(inflight, inflight + connections));
+
+  return Slot{this, true, connections};
+}
+
+void ConcurrencyLimiter::Release(std::chrono::steady_clock::duration db_time,
+                                 uint64_t db_round_trips,
+                                 int64_t connections) {
+  const auto inflight = inflight_.fetch_sub(connections);
+  if (db_round_trips == 0) return;
+
+  // Samples are dropped rather than waited for, the estimate does not need
+  // every one of them.
+  std::unique_lock lock{mutex_, std::try_to_lock};
+  if (!lock) return;
+
+  const auto snapshot = config_source_.GetSnapshot();
+  const auto& config = snapshot[kConcurrencyLimiterConfig];
+
+  // Round trips over several connections overlap, db_time is wall time.
+  const auto rtt_us =
+      std::chrono::duration<double, std::micro>(db_time).count() *
+      connections / db_round_trips;
+  window_rtt_sum_us_ += rtt_us;
+  window_max_inflight_ = std::max(window_max_inflight_, inflight);
+  if (++window_samples_ < config.window_size) return;
+
+  const auto short_rtt_us =
+      std::max(window_rtt_sum_us_ / window_samples_, kMinRttUs);
+  const auto max_inflight = window_max_inflight_;
+  window_rtt_sum_us_ = 0;
+  window_samples_ = 0;
+  window_max_inflight_ = 0;
+
+  const auto long_weight = 1.0 / std::max<int64_t>(config.long_window, 1);
+  long_rtt_us_ = long_rtt_us_ == 0
+                     ? short_rtt_us
+                     : long_rtt_us_ * (1 - long_weight) +
+                           short_rtt_us * long_weight;
+  // After an overload the long average stays inflated, let it follow the
+  // recovered latency faster.
+  if (long_rtt_us_ > 2 * short_rtt_us) long_rtt_us_ *= 0.95;
+
+  const auto gradient = std::clamp(
+      config.tolerance * long_rtt_us_ / short_rtt_us, kMinGradient, 1.0);
+  auto new_limit = estimated_limit_ * gradient + std::sqrt(estimated_limit_);
+  // Do not grow a limit that is not even reached.
+  if (new_limit > estimated_limit_ && max_inflight < estimated_limit_ / 2) {
+    new_limit = estimated_limit_;
+  }
+
+  estimated_limit_ = std::clamp(
+      estimated_limit_ * (1 - config.smoothing) + new_limit * config.smoothing,
+      static_cast<double>(config.min_limit),
+      static_cast<double>(config.max_limit));
+  limit_ = std::llround(estimated_limit_);
+}
+
+}  // namespace lavka
@@ -0,0 +1,115 @@
+#ifndef LAVKA_CONCURRENCYLIMITER_H
+#define LAVKA_CONCURRENCYLIMITER_H
+
+#include <atomic>
+#include <chrono>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/mutex.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+struct ConcurrencyLimiterConfig {
+  bool enabled{true};
+  int64_t initial_limit{50};
+  int64_t min_limit{10};
+  int64_t max_limit{500};
+  // Low priority requests may only use this share of the limit.
+  double low_priority_share{0.7};
+  // Latency growth over the long-term average that is still not treated
+  // as queueing.
+  double tolerance{1.5};
+  double smoothing{0.2};
+  // Samples averaged before every limit update.
+  int64_t window_size{100};
+  // Samples in the long-term latency average.
+  int64_t long_window{600};
+};
+
+ConcurrencyLimiterConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<ConcurrencyLimiterConfig>);
+
+ConcurrencyLimiterConfig ParseConcurrencyLimiterConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseConcurrencyLimiterConfig>
+    kConcurrencyLimiterConfig;
+
+enum class Priority {
+  kHigh,
+  kLow,
+};
+
+// Gradient concurrency limit: the limit grows while the DB latency per
+// round trip stays near its long-term average and shrinks once it rises,
+// which happens as soon as postgres-db-1 queries start waiting for a free
+// connection. Requests over the limit are rejected with 429 before they
+// queue up behind the pool.
+class ConcurrencyLimiter final
+    : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-concurrency-limiter";
+
+  class Slot final {
+   public:
+    Slot() = default;
+    Slot(Slot&& other) noexcept;
+    Slot& operator=(Slot&&) = delete;
+    ~Slot();
+
+    explicit operator bool() const { return admitted_; }
+
+    // Reports the DB time of the request and frees the slot.
+    void Release(std::chrono::steady_clock::duration db_time,
+                 uint64_t db_round_trips);
+
+   private:
+    friend class ConcurrencyLimiter;
+
+    Slot(ConcurrencyLimiter* limiter, bool admitted, int64_t connections)
+        : limiter_(limiter), admitted_(admitted), connections_(connections) {}
+
+    ConcurrencyLimiter* limiter_{nullptr};
+    bool admitted_{false};
+    int64_t connections_{1};
+  };
+
+  ConcurrencyLimiter(
+      const userver::components::ComponentConfig& config,
+      const userver::components::ComponentContext& component_context);
+  ~ConcurrencyLimiter() override;
+
+  // Responds with 429 and returns an empty slot if there is no room for
+  // the request. A request that queries over several connections at once
+  // takes that many units of the limit.
+  Slot TryAcquire(const userver::server::http::HttpRequest& request,
+                  Priority priority, int64_t connections = 1);
+
+ private:
+  void Release(std::chrono::steady_clock::duration db_time,
+               uint64_t db_round_trips, int64_t connections);
+
+  userver::dynamic_config::Source config_source_;
+  std::atomic<int64_t> limit_;
+  std::atomic<int64_t> inflight_{0};
+  std::atomic<uint64_t> shed_high_{0};
+  std::atomic<uint64_t> shed_low_{0};
+
+  userver::engine::Mutex mutex_;
+  double estimated_limit_;
+  double long_rtt_us_{0};
+  double window_rtt_sum_us_{0};
+  int64_t window_samples_{0};
+  int64_t window_max_inflight_{0};
+
+  userver::utils::statistics::Entry statistics_holder_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_CONCURRENCYLIMITER_H
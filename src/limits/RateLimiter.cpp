@@ -0,0 +1,186 @@
+#include "RateLimiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+#include <userver/formats/common/items.hpp>
+
+namespace lavka {
+
+namespace {
+
+constexpr double kWeightScale = 1000;
+
+}  // namespace
+
+double RateLimiterConfig::WeightFor(const std::string& client) const {
+  const auto it = client_weights.find(client);
+  return it == client_weights.end() ? default_weight : it->second;
+}
+
+RateLimiterConfig Parse(const userver::formats::json::Value& value,
+                        userver::formats::parse::To<RateLimiterConfig>) {
+  RateLimiterConfig config;
+  config.enabled = value["enabled"].As<bool>(config.enabled);
+  config.client_header =
+      value["client_header"].As<std::string>(config.client_header);
+  config.total_rate_per_second = value["total_rate_per_second"].As<double>(
+      config.total_rate_per_second);
+  config.burst_seconds =
+      value["burst_seconds"].As<double>(config.burst_seconds);
+  config.default_weight =
+      value["default_weight"].As<double>(config.default_weight);
+  for (const auto& [client, weight] :
+       userver::formats::common::Items(value["client_weights"])) {
+    config.client_weights.emplace(client, weight.As<double>());
+  }
+  config.idle_timeout = std::chrono::seconds{
+      value["idle_timeout_s"].As<int64_t>(config.idle_timeout.count())};
+  config.max_keys_per_address =
+      value["max_keys_per_address"].As<size_t>(config.max_keys_per_address);
+  return config;
+}
+
+RateLimiterConfig ParseRateLimiterConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_RATE_LIMITER").As<RateLimiterConfig>();
+}
+
+RateLimiter::RateLimiter(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()) {
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-rate-limiter",
+              [this](userver::utils::statistics::Writer& writer) {
+                writer["admitted"] = admitted_.load();
+                writer["rejected"] = rejected_.load();
+                writer["keys-over-limit"] = keys_over_limit_.load();
+                writer["active-weight"] =
+                    active_weight_milli_.load() / kWeightScale;
+              });
+}
+
+RateLimiter::~RateLimiter() { statistics_holder_.Unregister(); }
+
+bool RateLimiter::Admit(const userver::server::http::HttpRequest& request) {
+  const auto snapshot = config_source_.GetSnapshot();
+  const auto& config = snapshot[kRateLimiterConfig];
+  if (!config.enabled) return true;
+
+  const auto address = request.GetRemoteAddress().PrimaryAddressString();
+  const auto& key = request.GetHeader(config.client_header);
+  double retry_after_s = 0;
+  auto outcome = Outcome::kRejected;
+  if (key.empty()) {
+    outcome = Take(address, nullptr, config, retry_after_s);
+  } else {
+    const bool configured = config.client_weights.count(key) > 0;
+    outcome = Take(key, configured ? nullptr : &address, config,
+                   retry_after_s);
+    if (outcome == Outcome::kOverKeyLimit) {
+      ++keys_over_limit_;
+      outcome = Take(address, nullptr, config, retry_after_s);
+    }
+  }
+  if (outcome == Outcome::kAdmitted) {
+    ++admitted_;
+    return true;
+  }
+
+  ++rejected_;
+  request.SetResponseStatus(
+      userver::server::http::HttpStatus::kTooManyRequests);
+  request.GetHttpResponse().SetHeader(
+      std::string{"Retry-After"},
+      std::to_string(std::max<int64_t>(std::ceil(retry_after_s), 1)));
+  return false;
+}
+
+RateLimiter::Outcome RateLimiter::Take(const std::string& client,
+                                       const std::string* owner,
+                                       const RateLimiterConfig& config,
+                                       double& retry_after_s) {
+  const auto weight = std::max(config.WeightFor(client), 0.001);
+  auto& shard = shards_[std::hash<std::string>{}(client) % kShardsCount];
+  const auto now = Clock::now();
+
+  std::lock_guard lock{shard.mutex};
+  if (now - shard.swept_at > config.idle_timeout) {
+    SweepIdle(shard, now, config);
+  }
+
+  auto it = shard.buckets.find(client);
+  const bool inserted = it == shard.buckets.end();
+  if (inserted) {
+    if (owner) {
+      std::lock_guard keys_lock{keys_mutex_};
+      auto& keys = keys_per_address_[*owner];
+      if (keys >= config.max_keys_per_address) {
+        if (keys == 0) keys_per_address_.erase(*owner);
+        return Outcome::kOverKeyLimit;
+      }
+      ++keys;
+    }
+    it = shard.buckets.emplace(client, Bucket{0, 0, now, owner ? *owner : ""})
+             .first;
+  }
+  auto& bucket = it->second;
+  if (bucket.weight != weight) {
+    active_weight_milli_ +=
+        std::llround((weight - bucket.weight) * kWeightScale);
+    bucket.weight = weight;
+  }
+
+  const auto active_weight =
+      std::max(active_weight_milli_.load() / kWeightScale, weight);
+  const auto rate = config.total_rate_per_second * weight / active_weight;
+  const auto burst = std::max(rate * config.burst_seconds, 1.0);
+  if (inserted) {
+    bucket.tokens = bucket.owner.empty() ? burst : 1.0;
+  } else {
+    const std::chrono::duration<double> elapsed = now - bucket.refilled_at;
+    bucket.tokens = std::min(bucket.tokens + elapsed.count() * rate, burst);
+    bucket.refilled_at = now;
+  }
+
+  if (bucket.tokens >= 1) {
+    bucket.tokens -= 1;
+    return Outcome::kAdmitted;
+  }
+  retry_after_s = rate > 0 ? (1 - bucket.tokens) / rate : 1;
+  return Outcome::kRejected;
+}
+
+void RateLimiter::SweepIdle(Shard& shard, Clock::time_point now,
+                            const RateLimiterConfig& config) {
+  for (auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+    if (now - it->second.refilled_at > config.idle_timeout) {
+      active_weight_milli_ -= std::llround(it->second.weight * kWeightScale);
+      if (!it->second.owner.empty()) ReleaseKey(it->second.owner);
+      it = shard.buckets.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  shard.swept_at = now;
+}
+
+void RateLimiter::ReleaseKey(const std::string& owner) {
+  std::lock_guard lock{keys_mutex_};
+  const auto it = keys_per_address_.find(owner);
+  if (it != keys_per_address_.end() && --it->second == 0) {
+    keys_per_address_.erase(it);
+  }
+}
+
+}  // namespace lavka
@@ -0,0 +1,108 @@
+#ifndef LAVKA_RATELIMITER_H
+#define LAVKA_RATELIMITER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/mutex.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+struct RateLimiterConfig {
+  bool enabled{true};
+  // Header that identifies an integration, the source IP is used without it.
+  std::string client_header{"X-Api-Key"};
+  // Capacity shared by all active clients in proportion to their weights.
+  double total_rate_per_second{1000};
+  // Bucket size in seconds of the client's share.
+  double burst_seconds{2};
+  double default_weight{1};
+  std::unordered_map<std::string, double> client_weights;
+  std::chrono::seconds idle_timeout{60};
+  // Buckets one source address may hold for header values missing from
+  // client_weights, further values are charged to the address itself.
+  size_t max_keys_per_address{16};
+
+  double WeightFor(const std::string& client) const;
+};
+
+RateLimiterConfig Parse(const userver::formats::json::Value& value,
+                        userver::formats::parse::To<RateLimiterConfig>);
+
+RateLimiterConfig ParseRateLimiterConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseRateLimiterConfig>
+    kRateLimiterConfig;
+
+// Per-client token buckets with weighted fair sharing of the total rate.
+// Clients are spread over independently locked shards, a client that stays
+// idle for idle_timeout is forgotten and stops counting as active.
+// Header values are chosen by the caller, so only the ones configured in
+// client_weights get a full burst. Any other value starts with a single
+// token and is owned by the source address, which may hold up to
+// max_keys_per_address of them: rotating the header neither bypasses the
+// limit nor grows the active weight without bound.
+class RateLimiter final : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-rate-limiter";
+
+  RateLimiter(const userver::components::ComponentConfig& config,
+              const userver::components::ComponentContext& component_context);
+  ~RateLimiter() override;
+
+  // Responds with 429 and Retry-After and returns false if the client is
+  // over its share.
+  bool Admit(const userver::server::http::HttpRequest& request);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Bucket {
+    double tokens;
+    double weight;
+    Clock::time_point refilled_at;
+    // Source address of a bucket for an unconfigured key, empty otherwise.
+    std::string owner;
+  };
+
+  struct Shard {
+    userver::engine::Mutex mutex;
+    std::unordered_map<std::string, Bucket> buckets;
+    Clock::time_point swept_at;
+  };
+
+  enum class Outcome { kAdmitted, kRejected, kOverKeyLimit };
+
+  static constexpr size_t kShardsCount = 16;
+
+  // `owner` is the source address for unconfigured keys, nullptr otherwise.
+  Outcome Take(const std::string& client, const std::string* owner,
+               const RateLimiterConfig& config, double& retry_after_s);
+  void SweepIdle(Shard& shard, Clock::time_point now,
+                 const RateLimiterConfig& config);
+  void ReleaseKey(const std::string& owner);
+
+  userver::dynamic_config::Source config_source_;
+  std::array<Shard, kShardsCount> shards_;
+  // Always locked after a shard mutex.
+  userver::engine::Mutex keys_mutex_;
+  std::unordered_map<std::string, size_t> keys_per_address_;
+  // Sum of the weights of the clients that have a bucket, scaled by 1000.
+  std::atomic<int64_t> active_weight_milli_{0};
+  std::atomic<uint64_t> admitted_{0};
+  std::atomic<uint64_t> rejected_{0};
+  std::atomic<uint64_t> keys_over_limit_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_RATELIMITER_H
@@ -0,0 +1,56 @@
+#include "RequestDeadline.h"
+
+#include <charconv>
+
+#include <userver/formats/common/items.hpp>
+
+namespace lavka {
+
+std::chrono::milliseconds RequestDeadlineConfig::TimeoutFor(
+    const std::string& handler_name) const {
+  const auto it = handler_timeouts.find(handler_name);
+  return it == handler_timeouts.end() ? default_timeout : it->second;
+}
+
+RequestDeadlineConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<RequestDeadlineConfig>) {
+  RequestDeadlineConfig config;
+  config.header = value["header"].As<std::string>(config.header);
+  config.default_timeout = std::chrono::milliseconds{
+      value["default_timeout_ms"].As<int64_t>(config.default_timeout.count())};
+  config.max_timeout = std::chrono::milliseconds{
+      value["max_timeout_ms"].As<int64_t>(config.max_timeout.count())};
+  for (const auto& [name, timeout_ms] :
+       userver::formats::common::Items(value["handler_timeout_ms"])) {
+    config.handler_timeouts.emplace(
+        name, std::chrono::milliseconds{timeout_ms.As<int64_t>()});
+  }
+  return config;
+}
+
+RequestDeadlineConfig ParseRequestDeadlineConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_REQUEST_DEADLINES").As<RequestDeadlineConfig>();
+}
+
+userver::engine::Deadline RequestDeadline(
+    const userver::server::http::HttpRequest& request,
+    const RequestDeadlineConfig& config, const std::string& handler_name) {
+  auto timeout = config.TimeoutFor(handler_name);
+
+  const auto& header = request.GetHeader(config.header);
+  int64_t timeout_ms = 0;
+  const auto [end, error] = std::from_chars(
+      header.data(), header.data() + header.size(), timeout_ms);
+  if (!header.empty() && error == std::errc{} &&
+      end == header.data() + header.size() && timeout_ms > 0) {
+    timeout = std::min(std::chrono::milliseconds{timeout_ms},
+                       config.max_timeout);
+  }
+
+  return userver::engine::Deadline::FromTimePoint(request.GetStartTime() +
+                                                  timeout);
+}
+
+}  // namespace lavka
@@ -0,0 +1,52 @@
+#ifndef LAVKA_REQUESTDEADLINE_H
+#define LAVKA_REQUESTDEADLINE_H
+
+#include <chrono>
+#include <unordered_map>
+
+#include <userver/dynamic_config/snapshot.hpp>
+#include <userver/engine/deadline.hpp>
+#include <userver/server/handlers/exceptions.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+struct RequestDeadlineConfig {
+  // Client budget in milliseconds, capped by max_timeout.
+  std::string header{"X-Request-Timeout-Ms"};
+  std::chrono::milliseconds default_timeout{1000};
+  std::chrono::milliseconds max_timeout{10000};
+  std::unordered_map<std::string, std::chrono::milliseconds> handler_timeouts;
+
+  std::chrono::milliseconds TimeoutFor(const std::string& handler_name) const;
+};
+
+RequestDeadlineConfig Parse(const userver::formats::json::Value& value,
+                            userver::formats::parse::To<RequestDeadlineConfig>);
+
+RequestDeadlineConfig ParseRequestDeadlineConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseRequestDeadlineConfig>
+    kRequestDeadlineConfig;
+
+// Deadline from the client header if it is present and valid, otherwise
+// the handler default.
+userver::engine::Deadline RequestDeadline(
+    const userver::server::http::HttpRequest& request,
+    const RequestDeadlineConfig& config, const std::string& handler_name);
+
+// Responds with 504.
+class DeadlineExpired final
+    : public userver::server::handlers::ExceptionWithCode<
+          userver::server::handlers::HandlerErrorCode::kGatewayTimeout> {
+ public:
+  DeadlineExpired()
+      : ExceptionWithCode(userver::server::handlers::ExternalBody{
+            "Request deadline expired"}) {}
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_REQUESTDEADLINE_H
@@ -1,6 +1,7 @@
 #include <userver/clients/http/component.hpp>
 #include <userver/components/minimal_server_component_list.hpp>
 #include <userver/server/handlers/ping.hpp>
+#include <userver/server/handlers/server_monitor.hpp>
 #include <userver/server/handlers/tests_control.hpp>
 #include <userver/testsuite/testsuite_support.hpp>
 #include <userver/utils/daemon_run.hpp>
@@ -16,10 +17,20 @@
 #include "orders/OrdersCompleteHandler.h"
 
 #include "couriers/CouriersMetaInfoHandler.h"
+#include "couriers/CouriersMetaInfoBatchHandler.h"
+#include "couriers/CouriersLeaderboardHandler.h"
+
+#include "index/CandidatesHandler.h"
+
+#include "changes/ChangesHandler.h"
+#include "export/ExportHandler.h"
+
+#include "profiler/ProfileHandler.h"
 
 int main(int argc, char* argv[]) {
   auto component_list = userver::components::MinimalServerComponentList()
                             .Append<userver::server::handlers::Ping>()
+                            .Append<userver::server::handlers::ServerMonitor>()
                             .Append<userver::components::TestsuiteSupport>()
                             .Append<userver::components::HttpClient>()
                             .Append<userver::server::handlers::TestsControl>();
@@ -34,6 +45,15 @@ int main(int argc, char* argv[]) {
   lavka::AppendOrdersComplete(component_list);
 
   lavka::AppendCouriersMetaInfo(component_list);
+  lavka::AppendCouriersMetaInfoBatch(component_list);
+  lavka::AppendCouriersLeaderboard(component_list);
+
+  lavka::AppendCandidates(component_list);
+
+  lavka::AppendChanges(component_list);
+  lavka::AppendExport(component_list);
+
+  lavka::AppendProfile(component_list);
 
   return userver::utils::DaemonMain(argc, argv, component_list);
 }
@@ -0,0 +1,26 @@
+#include "RequestArena.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace lavka {
+
+namespace {
+
+constexpr size_t kMinBlockSize = 4 * 1024;
+
+}  // namespace
+
+RequestArena::RequestArena(size_t initial_size)
+    : resource_(std::max(initial_size, kMinBlockSize)) {}
+
+std::pmr::memory_resource* RequestArena::Resource() { return &resource_; }
+
+std::string_view RequestArena::Copy(std::string_view value) {
+  if (value.empty()) return {};
+  auto* data = static_cast<char*>(resource_.allocate(value.size(), 1));
+  std::memcpy(data, value.data(), value.size());
+  return {data, value.size()};
+}
+
+}  // namespace lavka
@@ -0,0 +1,39 @@
+#ifndef LAVKA_REQUESTARENA_H
+#define LAVKA_REQUESTARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+namespace lavka {
+
+// Monotonic arena of one bulk request: the DTOs of the parsed body and
+// their strings are allocated from it and released together when the
+// request ends, instead of one global allocation per vector and string.
+class RequestArena final {
+ public:
+  // The first block is taken from the global allocator on the first
+  // allocation, the size of the request body is a good guess for it.
+  explicit RequestArena(size_t initial_size);
+
+  RequestArena(const RequestArena&) = delete;
+  RequestArena& operator=(const RequestArena&) = delete;
+
+  std::pmr::memory_resource* Resource();
+
+  template <typename T>
+  std::pmr::vector<T> MakeVector() {
+    return std::pmr::vector<T>{&resource_};
+  }
+
+  // Copy of the string living in the arena.
+  std::string_view Copy(std::string_view value);
+
+ private:
+  std::pmr::monotonic_buffer_resource resource_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_REQUESTARENA_H
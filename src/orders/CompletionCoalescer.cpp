@@ -0,0 +1,281 @@
+#include "CompletionCoalescer.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+#include <userver/engine/async.hpp>
+#include <userver/engine/task/cancel.hpp>
+#include <userver/logging/log.hpp>
+
+#include "../changes/ChangeFeed.h"
+#include "../couriers/MetaInfoCache.h"
+#include "../statistics/QueryAccounting.h"
+#include "../statistics/RequestScope.h"
+
+namespace lavka {
+
+namespace {
+
+const userver::storages::postgres::Query kSelectCouriersByIds{
+    "SELECT * from service_schema.couriers WHERE courier_id = ANY($1)",
+    userver::storages::postgres::Query::Name{"select_couriers_by_ids"},
+};
+
+const userver::storages::postgres::Query kSelectOrdersByIdsForUpdate{
+    "SELECT order_id, CAST(weight as FLOAT) as weight, regions, "
+    "delivery_hours, cost, "
+    "CAST(complete_time as TEXT) as complete_time from service_schema.orders "
+    "WHERE order_id = ANY($1) FOR UPDATE",
+    userver::storages::postgres::Query::Name{"select_orders_by_ids_for_update"},
+};
+
+const userver::storages::postgres::Query kUpdateOrdersCompleteTime{
+    "UPDATE service_schema.orders o "
+    "SET complete_time = CAST(u.complete_time as TIMESTAMP), "
+    "courier_id = u.courier_id, "
+    "version = nextval('service_schema.row_version') "
+    "FROM unnest($1::BIGINT[], $2::BIGINT[], $3::TEXT[]) "
+    "AS u(order_id, courier_id, complete_time) "
+    "WHERE o.order_id = u.order_id",
+    userver::storages::postgres::Query::Name{"update_orders_complete_time"},
+};
+
+const userver::storages::postgres::Query kAppendCouriersCompletedOrders{
+    "UPDATE service_schema.couriers c "
+    "SET completed_orders = COALESCE(c.completed_orders, '{}') || u.orders "
+    "FROM (SELECT courier_id, array_agg(order_id ORDER BY n) AS orders "
+    "      FROM unnest($1::BIGINT[], $2::BIGINT[]) WITH ORDINALITY "
+    "        AS t(courier_id, order_id, n) "
+    "      GROUP BY courier_id) u "
+    "WHERE c.courier_id = u.courier_id",
+    userver::storages::postgres::Query::Name{
+        "append_couriers_completed_orders"},
+};
+
+}  // namespace
+
+CompletionCoalescerConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<CompletionCoalescerConfig>) {
+  CompletionCoalescerConfig config;
+  config.max_delay = std::chrono::milliseconds{
+      value["max_delay_ms"].As<int64_t>(config.max_delay.count())};
+  config.max_items = value["max_items"].As<size_t>(config.max_items);
+  return config;
+}
+
+CompletionCoalescerConfig ParseCompletionCoalescerConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_COMPLETION_COALESCER")
+      .As<CompletionCoalescerConfig>();
+}
+
+CompletionCoalescer::CompletionCoalescer(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()),
+      pg_cluster_(
+          component_context
+              .FindComponent<userver::components::Postgres>("postgres-db-1")
+              .GetCluster()),
+      statistics_(component_context.FindComponent<Statistics>()),
+      meta_info_cache_(component_context.FindComponent<MetaInfoCache>()),
+      change_feed_(component_context.FindComponent<ChangeFeed>()) {
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter(
+              "lavka-completion-coalescer",
+              [this](userver::utils::statistics::Writer& writer) {
+                writer["batches"] = batches_.load();
+                writer["items"] = items_.load();
+                writer["rejected-requests"] = rejected_requests_.load();
+                writer["requests-per-batch"] = requests_per_batch_;
+              });
+
+  task_ = userver::engine::CriticalAsyncNoSpan([this] { Run(); });
+}
+
+CompletionCoalescer::~CompletionCoalescer() {
+  task_.SyncCancel();
+  statistics_holder_.Unregister();
+}
+
+std::optional<std::vector<OrderDto>> CompletionCoalescer::Complete(
+    std::vector<OrderCompleteDto> items, RequestScope& scope) {
+  auto pending = std::make_shared<Pending>();
+  pending->items = std::move(items);
+  auto future = pending->promise.get_future();
+  const Pending* const queued = pending.get();
+  {
+    std::lock_guard lock{mutex_};
+    pending_items_ += pending->items.size();
+    pending_.push_back(std::move(pending));
+  }
+  pending_cv_.NotifyOne();
+
+  // A request out of time withdraws its items while they are still queued.
+  // Once its batch is flushing the outcome is decided by the batch, so the
+  // request waits for it rather than answering 504 for orders that may be
+  // completed already.
+  while (future.wait_until(scope.GetDeadline()) !=
+         userver::engine::FutureStatus::kReady) {
+    bool withdrawn = false;
+    {
+      std::lock_guard lock{mutex_};
+      const auto it = std::find_if(
+          pending_.begin(), pending_.end(),
+          [&](const auto& other) { return other.get() == queued; });
+      if (it == pending_.end()) break;
+      if (scope.GetDeadline().IsReached() ||
+          userver::engine::current_task::ShouldCancel()) {
+        pending_items_ -= (*it)->items.size();
+        pending_.erase(it);
+        withdrawn = true;
+      }
+    }
+    if (withdrawn) scope.CheckDeadline();
+  }
+  const userver::engine::TaskCancellationBlocker blocker;
+  return future.get();
+}
+
+void CompletionCoalescer::Run() {
+  while (!userver::engine::current_task::ShouldCancel()) {
+    std::vector<std::shared_ptr<Pending>> batch;
+    {
+      std::unique_lock lock{mutex_};
+      if (!pending_cv_.Wait(lock, [this] { return !pending_.empty(); })) {
+        return;
+      }
+      const auto config = config_source_.GetCopy(kCompletionCoalescerConfig);
+      pending_cv_.WaitUntil(
+          lock, userver::engine::Deadline::FromDuration(config.max_delay),
+          [&] { return pending_items_ >= config.max_items; });
+      batch.swap(pending_);
+      pending_items_ = 0;
+    }
+
+    try {
+      Flush(batch);
+    } catch (const std::exception& ex) {
+      LOG_ERROR() << "Failed to complete a batch of " << batch.size()
+                  << " requests: " << ex;
+      for (auto& pending : batch) {
+        pending->promise.set_exception(std::current_exception());
+      }
+    }
+  }
+}
+
+void CompletionCoalescer::Flush(std::vector<std::shared_ptr<Pending>>& batch) {
+  std::vector<int64_t> courier_ids;
+  std::vector<int64_t> order_ids;
+  for (const auto& pending : batch) {
+    for (const auto& item : pending->items) {
+      courier_ids.push_back(item.courier_id);
+      order_ids.push_back(item.order_id);
+    }
+  }
+
+  const std::lock_guard lock_orders{DatabaseAccessManager::GetOrdersMutex()};
+  const std::lock_guard lock_couriers{
+      DatabaseAccessManager::GetCouriersMutex()};
+
+  auto transaction =
+      pg_cluster_->Begin("transaction_complete_orders_batch",
+                         userver::storages::postgres::ClusterHostType::kMaster,
+                         {});
+
+  std::unordered_map<int64_t, CourierDto> couriers;
+  for (auto& courier :
+       ExecuteAccounted(statistics_, transaction, kSelectCouriersByIds,
+                        courier_ids)
+           .AsContainer<std::vector<CourierDto>>(
+               userver::storages::postgres::kRowTag)) {
+    couriers.emplace(courier.courier_id, std::move(courier));
+  }
+  std::unordered_map<int64_t, OrderDto> orders;
+  for (auto& order :
+       ExecuteAccounted(statistics_, transaction, kSelectOrdersByIdsForUpdate,
+                        order_ids)
+           .AsContainer<std::vector<OrderDto>>(
+               userver::storages::postgres::kRowTag)) {
+    orders.emplace(order.order_id, std::move(order));
+  }
+
+  // Same checks as for a single request. An order completed by an earlier
+  // request of the batch counts as already completed.
+  std::unordered_set<int64_t> completed_in_batch;
+  std::vector<Result> results(batch.size());
+  std::vector<int64_t> accepted_couriers;
+  std::vector<int64_t> accepted_orders;
+  std::vector<std::string> accepted_times;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const auto is_valid = [&](const OrderCompleteDto& item) {
+      const auto courier = couriers.find(item.courier_id);
+      const auto order = orders.find(item.order_id);
+      if (courier == couriers.end() || order == orders.end()) return false;
+      if (order->second.complete_time.has_value() ||
+          completed_in_batch.count(item.order_id)) {
+        return false;
+      }
+      const auto& regions = courier->second.regions;
+      if (std::find(regions.begin(), regions.end(), order->second.regions) ==
+          regions.end()) {
+        return false;
+      }
+      return IsComplete(courier->second.working_hours,
+                        order->second.delivery_hours, item.complete_time);
+    };
+
+    const auto& items = batch[i]->items;
+    if (!std::all_of(items.begin(), items.end(), is_valid)) {
+      ++rejected_requests_;
+      continue;
+    }
+
+    auto& completed = results[i].emplace();
+    for (const auto& item : items) {
+      completed_in_batch.insert(item.order_id);
+      accepted_couriers.push_back(item.courier_id);
+      accepted_orders.push_back(item.order_id);
+      accepted_times.push_back(item.complete_time);
+
+      auto order = orders.at(item.order_id);
+      order.complete_time = item.complete_time;
+      completed.push_back(std::move(order));
+    }
+  }
+
+  if (!accepted_orders.empty()) {
+    ExecuteAccounted(statistics_, transaction, kUpdateOrdersCompleteTime,
+                     accepted_orders, accepted_couriers, accepted_times);
+    ExecuteAccounted(statistics_, transaction, kAppendCouriersCompletedOrders,
+                     accepted_couriers, accepted_orders);
+    ExecuteAccounted(statistics_, transaction, kRecordCompleted,
+                     accepted_orders, accepted_couriers, accepted_times);
+  }
+  transaction.Commit();
+  if (!accepted_orders.empty()) change_feed_.Notify();
+
+  for (size_t i = 0; i < accepted_orders.size(); ++i) {
+    meta_info_cache_.Invalidate(accepted_couriers[i], accepted_times[i]);
+  }
+
+  ++batches_;
+  items_ += accepted_orders.size();
+  requests_per_batch_.GetCurrentCounter().Account(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    batch[i]->promise.set_value(std::move(results[i]));
+  }
+}
+
+}  // namespace lavka
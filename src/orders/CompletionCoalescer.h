@@ -0,0 +1,98 @@
+#ifndef LAVKA_COMPLETIONCOALESCER_H
+#define LAVKA_COMPLETIONCOALESCER_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/engine/condition_variable.hpp>
+#include <userver/engine/future.hpp>
+#include <userver/engine/mutex.hpp>
+#include <userver/engine/task/task_with_result.hpp>
+#include <userver/utils/statistics/entry.hpp>
+
+#include "OrdersCompleteHandler.h"
+#include "../statistics/Statistics.h"
+
+namespace lavka {
+
+class ChangeFeed;
+class MetaInfoCache;
+class RequestScope;
+
+struct CompletionCoalescerConfig {
+  // How long the first completion of a batch waits for others to join.
+  std::chrono::milliseconds max_delay{5};
+  size_t max_items{200};
+};
+
+CompletionCoalescerConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<CompletionCoalescerConfig>);
+
+CompletionCoalescerConfig ParseCompletionCoalescerConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseCompletionCoalescerConfig>
+    kCompletionCoalescerConfig;
+
+// Group commit for order completions: completions of concurrent requests
+// are collected for max_delay or up to max_items, validated together
+// against one read of the couriers and orders involved and written in a
+// single transaction. Every request is still accepted or rejected as a
+// whole, exactly as if it was processed alone.
+class CompletionCoalescer final
+    : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-completion-coalescer";
+
+  CompletionCoalescer(
+      const userver::components::ComponentConfig& config,
+      const userver::components::ComponentContext& component_context);
+  ~CompletionCoalescer() override;
+
+  // Expects complete_time already normalized by CastTextToTimestamp.
+  // Returns the completed orders, or nullopt if any of the items is
+  // invalid and nothing was written. Throws DeadlineExpired only while the
+  // items are still queued, never after their batch started writing.
+  std::optional<std::vector<OrderDto>> Complete(
+      std::vector<OrderCompleteDto> items, RequestScope& scope);
+
+ private:
+  using Result = std::optional<std::vector<OrderDto>>;
+
+  struct Pending {
+    std::vector<OrderCompleteDto> items;
+    userver::engine::Promise<Result> promise;
+  };
+
+  void Run();
+  void Flush(std::vector<std::shared_ptr<Pending>>& batch);
+
+  userver::dynamic_config::Source config_source_;
+  userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  MetaInfoCache& meta_info_cache_;
+  ChangeFeed& change_feed_;
+
+  userver::engine::Mutex mutex_;
+  userver::engine::ConditionVariable pending_cv_;
+  std::vector<std::shared_ptr<Pending>> pending_;
+  size_t pending_items_{0};
+
+  Counts requests_per_batch_;
+  std::atomic<uint64_t> batches_{0};
+  std::atomic<uint64_t> items_{0};
+  std::atomic<uint64_t> rejected_requests_{0};
+  userver::utils::statistics::Entry statistics_holder_;
+
+  userver::engine::TaskWithResult<void> task_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_COMPLETIONCOALESCER_H
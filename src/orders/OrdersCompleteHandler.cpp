@@ -1,13 +1,50 @@
 #include "OrdersCompleteHandler.h"
 
+#include "CompletionCoalescer.h"
+
+#include "../formats/BodyFormat.h"
+#include "../hours/TimeWindow.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
 namespace lavka {
 
+bool IsComplete(const std::vector<std::string>& courierWorkTime,
+                const std::vector<std::string>& orderDeliveryHours,
+                const std::string& completeTime) {
+  try {
+    int completeTimeInt = std::stoi(completeTime.substr(11, 2)) * 60 +
+                          std::stoi(completeTime.substr(14, 2));
+
+    // Stored windows are validated on insert.
+    const auto contains = [completeTimeInt](const std::string& timeStr) {
+      const auto window = ParseTimeWindow(timeStr);
+      return window.has_value() && completeTimeInt >= window->start &&
+             completeTimeInt <= window->end;
+    };
+
+    return std::any_of(courierWorkTime.begin(), courierWorkTime.end(),
+                       contains) &&
+           std::any_of(orderDeliveryHours.begin(), orderDeliveryHours.end(),
+                       contains);
+
+  } catch (...) {
+    return false;
+  }
+}
+
 namespace {
 class OrdersCompleteHandler final
     : public userver::server::handlers::HttpHandlerBase {
  public:
   static constexpr std::string_view kName = "handler-orders-complete";
   userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+  CompletionCoalescer& coalescer_;
 
   OrdersCompleteHandler(
       const userver::components::ComponentConfig& config,
@@ -16,14 +53,25 @@ class OrdersCompleteHandler final
         pg_cluster_(
             component_context
                 .FindComponent<userver::components::Postgres>("postgres-db-1")
-                .GetCluster()){};
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()),
+        coalescer_(component_context.FindComponent<CompletionCoalescer>()){};
 
   std::string HandleRequestThrow(
       const userver::server::http::HttpRequest& request,
       userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    auto slot = concurrency_limiter_.TryAcquire(request, Priority::kLow);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
     switch (request.GetMethod()) {
       case userver::server::http::HttpMethod::kPost:
-        return PostOrdersComplete(request);
+        return PostOrdersComplete(request, scope);
       default:
         throw userver::server::handlers::ClientError(
             userver::server::handlers::ExternalBody{
@@ -31,215 +79,84 @@ class OrdersCompleteHandler final
     }
   }
 
-  bool IsComplete(const std::vector<std::string>& courierWorkTime,
-                  const std::vector<std::string>& orderDeliveryHours,
-                  const std::string& completeTime) const {
-    try {
-      std::vector<std::pair<int, int>> workTime;
-      std::vector<std::pair<int, int>> deliveryHours;
-
-      for (const auto& timeStr : courierWorkTime) {
-        int hhLeft = std::stoi(timeStr.substr(0, 2));
-        int hhRight = std::stoi(timeStr.substr(6, 2));
-        int mmLeft = std::stoi(timeStr.substr(3, 2));
-        int mmRight = std::stoi(timeStr.substr(9, 2));
-
-        hhLeft *= 60;
-        hhRight *= 60;
-
-        workTime.push_back(std::make_pair(hhLeft + mmLeft, hhRight + mmRight));
-      }
-
-      for (const auto& timeStr : orderDeliveryHours) {
-        int hhLeft = std::stoi(timeStr.substr(0, 2));
-        int hhRight = std::stoi(timeStr.substr(6, 2));
-        int mmLeft = std::stoi(timeStr.substr(3, 2));
-        int mmRight = std::stoi(timeStr.substr(9, 2));
-
-        hhLeft *= 60;
-        hhRight *= 60;
-
-        deliveryHours.push_back(
-            std::make_pair(hhLeft + mmLeft, hhRight + mmRight));
-      }
-
-      int completeTimeInt = std::stoi(completeTime.substr(11, 2)) * 60 +
-                            std::stoi(completeTime.substr(14, 2));
-
-      if (!std::any_of(workTime.begin(), workTime.end(),
-                       [completeTimeInt](const std::pair<int, int>& p) {
-                         return completeTimeInt >= p.first &&
-                                completeTimeInt <= p.second;
-                       }))
-        return false;
-
-      if (!std::any_of(deliveryHours.begin(), deliveryHours.end(),
-                       [completeTimeInt](const std::pair<int, int>& p) {
-                         return completeTimeInt >= p.first &&
-                                completeTimeInt <= p.second;
-                       }))
-        return false;
-
-      return true;
-
-    } catch (...) {
-      return false;
-    }
-  }
-
-  const userver::storages::postgres::Query kSelectSpecificCourier{
-      "SELECT * from service_schema.couriers WHERE courier_id=$1",
-      userver::storages::postgres::Query::Name{"select_specific_courier"},
-  };
-
-  const userver::storages::postgres::Query kSelectSpecificOrder{
-      "SELECT order_id, CAST(weight as FLOAT) as weight, regions, delivery_hours, cost, "
-      "CAST(complete_time as TEXT) as complete_time from service_schema.orders "
-      "WHERE order_id=$1",
-      userver::storages::postgres::Query::Name{"select_specific_order"},
-  };
-
-  const userver::storages::postgres::Query kUpdateOrderCompleteTime{
-      "UPDATE service_schema.orders set complete_time=CAST($2 as TIMESTAMP) "
-      "where order_id=$1",
-      userver::storages::postgres::Query::Name{"update-order-complete-time"},
-  };
-
-  const userver::storages::postgres::Query kUpdateCourierCompletedOrders{
-      "UPDATE service_schema.couriers set completed_orders=$2 where "
-      "courier_id=$1",
-      userver::storages::postgres::Query::Name{"update-courier-completed-orders"},
-  };
-
-  const userver::storages::postgres::Query kCheckAndReturnTimestamp{
-      "SELECT service_schema.CastTextToTimestamp($1) as result",
-      userver::storages::postgres::Query::Name{"check-timestamp-and-return"},
+  const userver::storages::postgres::Query kCheckAndReturnTimestamps{
+      "SELECT service_schema.CastTextToTimestamp(t) as result "
+      "FROM unnest($1::TEXT[]) WITH ORDINALITY AS u(t, n) ORDER BY n",
+      userver::storages::postgres::Query::Name{"check-timestamps-and-return"},
   };
 
   std::string PostOrdersComplete(
-      const userver::server::http::HttpRequest& request) const {
+      const userver::server::http::HttpRequest& request,
+      RequestScope& scope) const {
     if(request.ArgCount() > 0) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
     }
 
     try {
-      auto orders_full_json =
-          userver::formats::json::FromString(request.RequestBody());
-      auto orders_arr = orders_full_json["complete_info"];
-      if (!orders_arr.IsArray()) {
+      const auto orders_full_json = [&] {
+        const auto timer = scope.Time(Stage::kParse);
+        return ParseBody(request);
+      }();
+      if (!orders_full_json.has_value()) {
+        request.SetResponseStatus(
+            userver::server::http::HttpStatus::kBadRequest);
+        return {};
+      }
+      std::vector<OrderCompleteDto> complete_orders;
+      std::vector<std::string> complete_times;
+      const bool parsed = std::visit(
+          [&](const auto& body) {
+            const auto orders_arr = body["complete_info"];
+            if (!orders_arr.IsArray()) return false;
+            for (const auto& complete_order : orders_arr) {
+              complete_orders.push_back(
+                  {complete_order["courier_id"].template As<int64_t>(),
+                   complete_order["order_id"].template As<int64_t>(),
+                   complete_order["complete_time"]
+                       .template As<std::string>()});
+              complete_times.push_back(complete_orders.back().complete_time);
+            }
+            return true;
+          },
+          orders_full_json.value());
+      if (!parsed) {
         request.SetResponseStatus(
             userver::server::http::HttpStatus::kBadRequest);
         return {};
       }
 
-      std::lock_guard<userver::engine::Mutex> lock_orders(
-          DatabaseAccessManager::GetOrdersMutex());
-
-      std::lock_guard<userver::engine::Mutex> lock_couriers(
-          DatabaseAccessManager::GetCouriersMutex());
-
-      for (const auto& complete_order : orders_full_json["complete_info"]) {
-        userver::storages::postgres::ResultSet res = pg_cluster_->Execute(
-            userver::storages::postgres::ClusterHostType::kSlave,
-            kSelectSpecificCourier, complete_order["courier_id"].As<int64_t>());
-        if (res.IsEmpty()) {
-          request.SetResponseStatus(
-              userver::server::http::HttpStatus::kBadRequest);
-          return {};
-        }
-        auto courierValue =
-            res.AsSingleRow<CourierDto>(userver::storages::postgres::kRowTag);
-        std::vector<int> courier_regions = courierValue.regions;
-        std::vector<std::string> courier_work_time = courierValue.working_hours;
-
-        res = pg_cluster_->Execute(
-            userver::storages::postgres::ClusterHostType::kSlave,
-            kSelectSpecificOrder, complete_order["order_id"].As<int64_t>());
-        if (res.IsEmpty()) {
-          request.SetResponseStatus(
-              userver::server::http::HttpStatus::kBadRequest);
-          return {};
-        }
-        auto orderValue =
-            res.AsSingleRow<OrderDto>(userver::storages::postgres::kRowTag);
-        std::vector<std::string> order_delivery_hours =
-            orderValue.delivery_hours;
-        int order_region = orderValue.regions;
-        if (orderValue.complete_time.has_value()) {
-          request.SetResponseStatus(
-              userver::server::http::HttpStatus::kBadRequest);
-          return {};
-        }
-
-        if (!std::any_of(courier_regions.begin(), courier_regions.end(),
-                         [order_region](int courier_region) {
-                           return order_region == courier_region;
-                         })) {
-          request.SetResponseStatus(
-              userver::server::http::HttpStatus::kBadRequest);
-          return {};
+      std::vector<OrderDto> completed;
+      if (!complete_orders.empty()) {
+        complete_times =
+            scope
+                .Execute(pg_cluster_,
+                         userver::storages::postgres::ClusterHostType::kSlave,
+                         kCheckAndReturnTimestamps, complete_times)
+                .AsContainer<std::vector<std::string>>();
+        for (size_t i = 0; i < complete_orders.size(); ++i) {
+          complete_orders[i].complete_time = std::move(complete_times[i]);
         }
 
-        res = pg_cluster_->Execute(
-            userver::storages::postgres::ClusterHostType::kSlave,
-            kCheckAndReturnTimestamp,
-            complete_order["complete_time"].As<std::string>());
-        std::string complete_time = res.AsSingleRow<std::string>();
-
-        if (!IsComplete(courier_work_time, order_delivery_hours,
-                        complete_time)) {
+        auto result = [&] {
+          const auto timer = scope.Time(Stage::kBatchWait);
+          return coalescer_.Complete(std::move(complete_orders), scope);
+        }();
+        if (!result.has_value()) {
           request.SetResponseStatus(
               userver::server::http::HttpStatus::kBadRequest);
           return {};
         }
+        completed = std::move(result.value());
       }
 
-      userver::formats::json::ValueBuilder responseJson;
-
-      for (const auto& complete_order : orders_full_json["complete_info"]) {
-        auto res = pg_cluster_->Execute(
-            userver::storages::postgres::ClusterHostType::kSlave,
-            kSelectSpecificCourier, complete_order["courier_id"].As<int64_t>());
-        auto courierValue =
-            res.AsSingleRow<CourierDto>(userver::storages::postgres::kRowTag);
-        std::vector<int64_t> completed_orders;
-        if (courierValue.completed_orders.has_value())
-          completed_orders = courierValue.completed_orders.value();
-        completed_orders.push_back(complete_order["order_id"].As<int64_t>());
-
-        userver::storages::postgres::Transaction transaction_courier =
-            pg_cluster_->Begin(
-                "transaction_update_courier_completed_orders",
-                userver::storages::postgres::ClusterHostType::kMaster, {});
-        auto res_couriers = transaction_courier.Execute(
-            kUpdateCourierCompletedOrders,
-            complete_order["courier_id"].As<int64_t>(), completed_orders);
-
-        userver::storages::postgres::Transaction transaction_order =
-            pg_cluster_->Begin(
-                "transaction_update_order_complete_time",
-                userver::storages::postgres::ClusterHostType::kMaster, {});
-        auto res_order = transaction_order.Execute(
-            kUpdateOrderCompleteTime, complete_order["order_id"].As<int64_t>(),
-            complete_order["complete_time"].As<std::string>());
-
-        if (res_order.RowsAffected() && res_couriers.RowsAffected()) {
-          transaction_order.Commit();
-          transaction_courier.Commit();
-
-          res = pg_cluster_->Execute(
-              userver::storages::postgres::ClusterHostType::kSlave,
-              kSelectSpecificOrder, complete_order["order_id"].As<int64_t>());
-          userver::formats::json::ValueBuilder orderBuilder{
-              res.AsSingleRow<OrderDto>(userver::storages::postgres::kRowTag)};
-          responseJson.PushBack(orderBuilder.ExtractValue());
-        }
-      }
-
-      return userver::formats::json::ToStableString(
-          responseJson.ExtractValue());
+      const auto timer = scope.Time(Stage::kSerialize);
+      return SerializeBody(request, [&](auto builder) {
+        return decltype(builder){completed}.ExtractValue();
+      });
 
+    } catch (const DeadlineExpired&) {
+      throw;
     } catch (...) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
@@ -249,6 +166,7 @@ class OrdersCompleteHandler final
 }
 
 void AppendOrdersComplete(userver::components::ComponentList& component_list) {
+  component_list.Append<CompletionCoalescer>();
   component_list.Append<OrdersCompleteHandler>();
 }
 
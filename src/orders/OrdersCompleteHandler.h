@@ -13,6 +13,10 @@ struct OrderCompleteDto {
   std::string complete_time;
 };
 
+bool IsComplete(const std::vector<std::string>& courierWorkTime,
+                const std::vector<std::string>& orderDeliveryHours,
+                const std::string& completeTime);
+
 void AppendOrdersComplete(userver::components::ComponentList& component_list);
 
 }  // namespace lavka
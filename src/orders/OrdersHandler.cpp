@@ -1,5 +1,18 @@
 #include "OrdersHandler.h"
 
+#include <limits>
+#include <unordered_map>
+
+#include <userver/storages/postgres/exceptions.hpp>
+
+#include "../changes/ChangeFeed.h"
+#include "../compression/ResponseCompressor.h"
+#include "../formats/BodyFormat.h"
+#include "../hours/TimeWindow.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
 namespace lavka {
 
 userver::engine::Mutex OrderIdManager::mutex_;
@@ -15,27 +28,171 @@ int64_t OrderIdManager::GetNewId() {
     return -1;  // exc_max_orders + response 400 bad request
 }
 
-userver::formats::json::Value Serialize(
-    const OrderDto& data,
-    userver::formats::serialize::To<userver::formats::json::Value>) {
-  userver::formats::json::ValueBuilder jsonOrder;
-  jsonOrder["order_id"] = data.order_id;
-  jsonOrder["weight"] = data.weight;
-  jsonOrder["regions"] = data.regions;
-  jsonOrder["delivery_hours"] = data.delivery_hours;
-  jsonOrder["cost"] = data.cost;
-  if (data.complete_time.has_value())
-    jsonOrder["complete_time"] = data.complete_time.value();
-
-  return jsonOrder.ExtractValue();
+bool IsOrderJsonValid(const userver::formats::json::Value& order_json) {
+  try {
+    if (order_json.GetSize() != 4) return false;
+
+    if (!(order_json.HasMember("weight") && order_json.HasMember("regions") &&
+          order_json.HasMember("delivery_hours") &&
+          order_json.HasMember("cost")))
+      return false;
+
+    order_json["weight"].As<float>();
+
+    if (order_json["weight"].As<float>() < 0) return false;
+
+    order_json["regions"].As<int>();
+
+    if (order_json["delivery_hours"].IsEmpty()) return false;
+
+    for (const auto& delivery_hour : order_json["delivery_hours"]) {
+      if (!IsValidHours(delivery_hour.As<std::string>())) return false;
+    }
+
+    order_json["cost"].As<int>();
+
+  } catch (...) {
+    return false;
+  }
+
+  return true;
+}
+
+namespace {
+
+// Shared by the JSON and BSON bodies.
+template <typename Value>
+std::optional<std::pmr::vector<NewOrderDto>> ParseNewOrdersImpl(
+    const Value& orders_json, RequestArena& arena) {
+  auto orders = arena.MakeVector<NewOrderDto>();
+  orders.reserve(orders_json.GetSize());
+  // Checked together after the loop.
+  auto all_hours = arena.MakeVector<std::string_view>();
+  try {
+    for (const auto& order_json : orders_json) {
+      if (order_json.GetSize() != 4 || !order_json.HasMember("weight") ||
+          !order_json.HasMember("regions") ||
+          !order_json.HasMember("delivery_hours") ||
+          !order_json.HasMember("cost"))
+        return std::nullopt;
+
+      auto& order = orders.emplace_back(
+          NewOrderDto{order_json["weight"].template As<double>(),
+                      order_json["regions"].template As<int>(),
+                      arena.MakeVector<std::string_view>(),
+                      order_json["cost"].template As<int>()});
+      if (static_cast<float>(order.weight) < 0) return std::nullopt;
+
+      const auto delivery_hours = order_json["delivery_hours"];
+      if (delivery_hours.IsEmpty()) return std::nullopt;
+      order.delivery_hours.reserve(delivery_hours.GetSize());
+      for (const auto& delivery_hour : delivery_hours) {
+        order.delivery_hours.push_back(arena.Copy(StringOf(delivery_hour)));
+        all_hours.push_back(order.delivery_hours.back());
+      }
+    }
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  auto windows = arena.MakeVector<TimeWindow>();
+  windows.resize(all_hours.size());
+  if (ParseTimeWindows(all_hours.data(), all_hours.size(), windows.data()) !=
+      all_hours.size())
+    return std::nullopt;
+  return orders;
+}
+
+}  // namespace
+
+std::optional<std::pmr::vector<NewOrderDto>> ParseNewOrders(
+    const userver::formats::json::Value& orders_json, RequestArena& arena) {
+  return ParseNewOrdersImpl(orders_json, arena);
+}
+
+std::optional<std::pmr::vector<NewOrderDto>> ParseNewOrders(
+    const BsonValue& orders_json, RequestArena& arena) {
+  return ParseNewOrdersImpl(orders_json, arena);
 }
 
 namespace {
 
+constexpr size_t kMaxIdsCount = 1000;
+constexpr size_t kMaxRegionsCount = 100;
+// Page size of the filtered GET /orders.
+constexpr int kMaxFilterLimit = 1000;
+
+constexpr std::string_view kFilterArgs[] = {
+    "regions", "status", "completed_from", "completed_to", "delivery_window"};
+
+// Filters of GET /orders. Every supported combination has a driving
+// predicate backed by an index (regions, completion time or the partial
+// index on open orders), the rest are applied on top of it.
+struct OrdersFilter {
+  std::optional<std::vector<int>> regions;
+  std::optional<bool> completed;
+  std::optional<std::string> completed_from;
+  std::optional<std::string> completed_to;
+  std::optional<std::string> window_start;
+  std::optional<std::string> window_end;
+};
+
+std::optional<OrdersFilter> ParseOrdersFilter(
+    const userver::server::http::HttpRequest& request) {
+  OrdersFilter filter;
+
+  if (request.HasArg("regions")) {
+    const auto regions =
+        ParseIds(request.GetArg("regions"), kMaxRegionsCount);
+    if (!regions.has_value()) return std::nullopt;
+    filter.regions.emplace();
+    for (const auto region : regions.value()) {
+      if (region <= 0 || region > std::numeric_limits<int>::max())
+        return std::nullopt;
+      filter.regions->push_back(static_cast<int>(region));
+    }
+  }
+
+  if (request.HasArg("status")) {
+    const auto& status = request.GetArg("status");
+    if (status == "open") {
+      filter.completed = false;
+    } else if (status == "completed") {
+      filter.completed = true;
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  if (request.HasArg("completed_from"))
+    filter.completed_from = request.GetArg("completed_from");
+  if (request.HasArg("completed_to"))
+    filter.completed_to = request.GetArg("completed_to");
+  if (filter.completed_from || filter.completed_to) {
+    if (filter.completed == false) return std::nullopt;
+    filter.completed = true;
+  }
+
+  if (request.HasArg("delivery_window")) {
+    const auto& window = request.GetArg("delivery_window");
+    if (!IsValidHours(window)) return std::nullopt;
+    filter.window_start = window.substr(0, 5);
+    filter.window_end = window.substr(6, 5);
+  }
+
+  return filter;
+}
+
 class OrdersHandler final : public userver::server::handlers::HttpHandlerBase {
  public:
   static constexpr std::string_view kName = "handler-orders";
   userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
+  ChangeFeed& change_feed_;
+  ResponseCompressor& response_compressor_;
 
   OrdersHandler(const userver::components::ComponentConfig& config,
                 const userver::components::ComponentContext& component_context)
@@ -43,16 +200,34 @@ class OrdersHandler final : public userver::server::handlers::HttpHandlerBase {
         pg_cluster_(
             component_context
                 .FindComponent<userver::components::Postgres>("postgres-db-1")
-                .GetCluster()){};
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()),
+        change_feed_(component_context.FindComponent<ChangeFeed>()),
+        response_compressor_(
+            component_context.FindComponent<ResponseCompressor>()){};
 
   std::string HandleRequestThrow(
       const userver::server::http::HttpRequest& request,
       userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    auto slot = concurrency_limiter_.TryAcquire(
+        request,
+        request.GetMethod() == userver::server::http::HttpMethod::kPost
+            ? Priority::kLow
+            : Priority::kHigh);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
     switch (request.GetMethod()) {
       case userver::server::http::HttpMethod::kGet:
-        return GetOrders(request);
+        return response_compressor_.Compress(request,
+                                             GetOrders(request, scope));
       case userver::server::http::HttpMethod::kPost:
-        return PostOrders(request);
+        return PostOrders(request, scope);
       default:
         throw userver::server::handlers::ClientError(
             userver::server::handlers::ExternalBody{
@@ -60,36 +235,6 @@ class OrdersHandler final : public userver::server::handlers::HttpHandlerBase {
     }
   }
 
-  bool IsOrderJsonValid(const userver::formats::json::Value& order_json) const {
-    try {
-      if (order_json.GetSize() != 4) return false;
-
-      if (!(order_json.HasMember("weight") && order_json.HasMember("regions") &&
-            order_json.HasMember("delivery_hours") &&
-            order_json.HasMember("cost")))
-        return false;
-
-      order_json["weight"].As<float>();
-
-      if (order_json["weight"].As<float>() < 0) return false;
-
-      order_json["regions"].As<int>();
-
-      if (order_json["delivery_hours"].IsEmpty()) return false;
-
-      for (const auto& delivery_hour : order_json["delivery_hours"]) {
-        if (!IsValidHours(delivery_hour.As<std::string>())) return false;
-      }
-
-      order_json["cost"].As<int>();
-
-    } catch (...) {
-      return false;
-    }
-
-    return true;
-  }
-
   const userver::storages::postgres::Query kSelectOrders{
       "SELECT order_id, CAST(weight as FLOAT) as weight, regions, delivery_hours, cost, "
       "CAST(complete_time as TEXT) as complete_time from service_schema.orders "
@@ -97,8 +242,21 @@ class OrdersHandler final : public userver::server::handlers::HttpHandlerBase {
       userver::storages::postgres::Query::Name{"select_orders"},
   };
 
-  std::string GetOrders(
-      const userver::server::http::HttpRequest& request) const {
+  const userver::storages::postgres::Query kSelectOrdersByIds{
+      "SELECT order_id, CAST(weight as FLOAT) as weight, regions, delivery_hours, cost, "
+      "CAST(complete_time as TEXT) as complete_time from service_schema.orders "
+      "WHERE order_id = ANY($1)",
+      userver::storages::postgres::Query::Name{"select_orders_by_ids"},
+  };
+
+  std::string GetOrders(const userver::server::http::HttpRequest& request,
+                        RequestScope& scope) const {
+    if (request.HasArg("ids")) return GetOrdersByIds(request, scope);
+    for (const auto arg : kFilterArgs) {
+      if (request.HasArg(std::string{arg}))
+        return GetFilteredOrders(request, scope);
+    }
+
     if (request.ArgCount() > 2) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
@@ -126,15 +284,166 @@ class OrdersHandler final : public userver::server::handlers::HttpHandlerBase {
       return {};
     }
 
-    userver::storages::postgres::ResultSet res = pg_cluster_->Execute(
-        userver::storages::postgres::ClusterHostType::kSlave, kSelectOrders,
-        offset, limit);
+    userver::storages::postgres::ResultSet res = scope.Execute(
+        pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
+        kSelectOrders, offset, limit);
 
     auto resVec = res.AsSetOf<OrderDto>(userver::storages::postgres::kRowTag);
 
-    userver::formats::json::ValueBuilder ordersBuilder{resVec};
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto builder) {
+      return decltype(builder){resVec}.ExtractValue();
+    });
+  }
+
+  // GET /orders?ids=1,2,3: the orders in the requested order and the ids
+  // that do not exist.
+  std::string GetOrdersByIds(const userver::server::http::HttpRequest& request,
+                             RequestScope& scope) const {
+    const auto ids = ParseIds(request.GetArg("ids"), kMaxIdsCount);
+    if (request.ArgCount() > 1 || !ids.has_value()) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    auto res = scope.Execute(
+        pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
+        kSelectOrdersByIds, ids.value());
 
-    return userver::formats::json::ToStableString(ordersBuilder.ExtractValue());
+    const auto timer = scope.Time(Stage::kSerialize);
+    std::unordered_map<int64_t, OrderDto> found;
+    for (auto& order : res.AsContainer<std::vector<OrderDto>>(
+             userver::storages::postgres::kRowTag)) {
+      found.emplace(order.order_id, std::move(order));
+    }
+
+    return SerializeBody(request, [&](auto response) {
+      decltype(response) orders{userver::formats::common::Type::kArray};
+      decltype(response) notFound{userver::formats::common::Type::kArray};
+      for (const auto id : ids.value()) {
+        const auto it = found.find(id);
+        if (it == found.end()) {
+          notFound.PushBack(id);
+        } else {
+          orders.PushBack(it->second);
+        }
+      }
+      response["orders"] = orders.ExtractValue();
+      response["not_found"] = notFound.ExtractValue();
+      return response.ExtractValue();
+    });
+  }
+
+  // The delivery window overlaps the requested one, HH:MM strings compare
+  // as times.
+  static constexpr std::string_view kResidualFilters =
+      "AND ($2::boolean IS NULL OR (complete_time IS NOT NULL) = $2) "
+      "AND ($3::text IS NULL OR EXISTS (SELECT 1 FROM unnest(delivery_hours) "
+      "AS hours WHERE split_part(hours, '-', 1) < $4 "
+      "AND split_part(hours, '-', 2) > $3)) ";
+
+  const userver::storages::postgres::Query kSelectOrdersByRegions{
+      fmt::format(
+          "SELECT order_id, CAST(weight as FLOAT) as weight, regions, "
+          "delivery_hours, cost, CAST(complete_time as TEXT) as complete_time "
+          "from service_schema.orders WHERE regions = ANY($1) {}"
+          "AND ($5::text IS NULL OR complete_time >= CAST($5 as TIMESTAMP)) "
+          "AND ($6::text IS NULL OR complete_time < CAST($6 as TIMESTAMP)) "
+          "ORDER BY order_id LIMIT $8 OFFSET $7",
+          kResidualFilters),
+      userver::storages::postgres::Query::Name{"select_orders_by_regions"},
+  };
+
+  const userver::storages::postgres::Query kSelectOrdersByCompleteTime{
+      fmt::format(
+          "SELECT order_id, CAST(weight as FLOAT) as weight, regions, "
+          "delivery_hours, cost, CAST(complete_time as TEXT) as complete_time "
+          "from service_schema.orders "
+          "WHERE complete_time >= COALESCE(CAST($5 as TIMESTAMP), '-infinity') "
+          "AND complete_time < COALESCE(CAST($6 as TIMESTAMP), 'infinity') "
+          "AND $1::integer[] IS NULL {}"
+          "ORDER BY complete_time, order_id LIMIT $8 OFFSET $7",
+          kResidualFilters),
+      userver::storages::postgres::Query::Name{
+          "select_orders_by_complete_time"},
+  };
+
+  const userver::storages::postgres::Query kSelectOpenOrders{
+      fmt::format(
+          "SELECT order_id, CAST(weight as FLOAT) as weight, regions, "
+          "delivery_hours, cost, CAST(complete_time as TEXT) as complete_time "
+          "from service_schema.orders WHERE complete_time IS NULL "
+          "AND $1::integer[] IS NULL {}"
+          "AND $5::text IS NULL AND $6::text IS NULL "
+          "ORDER BY order_id LIMIT $8 OFFSET $7",
+          kResidualFilters),
+      userver::storages::postgres::Query::Name{"select_open_orders"},
+  };
+
+  // GET /orders?regions=1,2&status=open|completed&completed_from=..&
+  // completed_to=..&delivery_window=HH:MM-HH:MM&offset=..&limit=..
+  // Combinations without an indexed predicate (only a delivery window or
+  // all completed orders) are rejected rather than scanning the table.
+  std::string GetFilteredOrders(
+      const userver::server::http::HttpRequest& request,
+      RequestScope& scope) const {
+    int offset = 0, limit = 1;
+    size_t realArgCount = 0;
+    try {
+      if (request.HasArg("offset")) {
+        offset = std::stoi(request.GetArg("offset"));
+        ++realArgCount;
+      }
+      if (request.HasArg("limit")) {
+        limit = std::stoi(request.GetArg("limit"));
+        ++realArgCount;
+      }
+    } catch (...) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+    for (const auto arg : kFilterArgs) {
+      if (request.HasArg(std::string{arg})) ++realArgCount;
+    }
+
+    const auto filter = ParseOrdersFilter(request);
+    if (request.ArgCount() > realArgCount || !filter.has_value() ||
+        offset < 0 || limit <= 0 || limit > kMaxFilterLimit) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    const userver::storages::postgres::Query* query = nullptr;
+    if (filter->regions.has_value()) {
+      query = &kSelectOrdersByRegions;
+    } else if (filter->completed_from || filter->completed_to) {
+      query = &kSelectOrdersByCompleteTime;
+    } else if (filter->completed == false) {
+      query = &kSelectOpenOrders;
+    } else {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    std::optional<userver::storages::postgres::ResultSet> res;
+    try {
+      res.emplace(scope.Execute(
+          pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
+          *query, filter->regions, filter->completed, filter->window_start,
+          filter->window_end, filter->completed_from, filter->completed_to,
+          offset, limit));
+    } catch (const userver::storages::postgres::DataException&) {
+      // completed_from or completed_to is not a timestamp.
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    auto resVec = res->AsSetOf<OrderDto>(userver::storages::postgres::kRowTag);
+
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto builder) {
+      return decltype(builder){resVec}.ExtractValue();
+    });
   }
 
   const userver::storages::postgres::Query kInsertOrders{
@@ -144,70 +453,82 @@ class OrdersHandler final : public userver::server::handlers::HttpHandlerBase {
       userver::storages::postgres::Query::Name{"insert_orders"},
   };
 
-  std::string PostOrders(
-      const userver::server::http::HttpRequest& request) const {
+  std::string PostOrders(const userver::server::http::HttpRequest& request,
+                         RequestScope& scope) const {
 
     if(request.ArgCount() > 0) {
       request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
       return {};
     }
 
-    std::string test_res;
-
-    userver::formats::json::Value orders_arr;
-    try {
-      orders_arr = userver::formats::json::FromString(request.RequestBody());
-
-      if (orders_arr.IsEmpty() || !orders_arr.IsArray()) {
+    // Freed at once when the request ends, the JSON tree is dropped as
+    // soon as the orders are built.
+    RequestArena arena{request.RequestBody().size()};
+    std::optional<std::pmr::vector<NewOrderDto>> orders;
+    {
+      std::optional<RequestBody> body;
+      {
+        const auto timer = scope.Time(Stage::kParse);
+        body = ParseBody(request);
+      }
+      if (!body.has_value() ||
+          std::visit(
+              [](const auto& value) {
+                return !value.IsArray() || value.IsEmpty();
+              },
+              body.value())) {
         request.SetResponseStatus(
             userver::server::http::HttpStatus::kBadRequest);
         return {};
       }
 
-    } catch (const userver::formats::json::Exception& exc) {
-      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
-      return {};
-    }
-
-    for (const auto& single_order : orders_arr) {
-      if (!IsOrderJsonValid(single_order)) {
+      const auto timer = scope.Time(Stage::kValidate);
+      orders = std::visit(
+          [&](const auto& value) { return ParseNewOrders(value, arena); },
+          body.value());
+      if (!orders.has_value()) {
         request.SetResponseStatus(
             userver::server::http::HttpStatus::kBadRequest);
         return {};
       }
     }
 
-    std::lock_guard<userver::engine::Mutex> lock(
-        DatabaseAccessManager::GetOrdersMutex());
-
-    userver::formats::json::ValueBuilder responseBuilder;
+    const auto lock = scope.Lock(DatabaseAccessManager::GetOrdersMutex());
 
-    for (const auto& single_order : orders_arr) {
+    // All or nothing: if the deadline expires midway the transaction rolls
+    // back, so a 504 never leaves orders the client has no ids for.
+    userver::storages::postgres::Transaction transaction = scope.Begin(
+        pg_cluster_, "transaction_insert_orders",
+        userver::storages::postgres::ClusterHostType::kMaster);
+    std::vector<int64_t> created_ids;
+    for (auto& order : orders.value()) {
       int64_t order_id = OrderIdManager::GetNewId();
-      auto weight = single_order["weight"].As<float>();
-      auto regions = single_order["regions"].As<int>();
-      auto delivery_hours =
-          single_order["delivery_hours"].As<std::vector<std::string>>();
-      auto cost = single_order["cost"].As<int>();
-
-      userver::storages::postgres::Transaction transaction = pg_cluster_->Begin(
-          "transaction_insert_order_value",
-          userver::storages::postgres::ClusterHostType::kMaster, {});
-
-      auto res = transaction.Execute(kInsertOrders, order_id, weight, regions,
-                                     delivery_hours, cost);
 
-      userver::formats::json::ValueBuilder orderDO_builder{single_order};
-      orderDO_builder["order_id"] = order_id;
+      auto res = scope.Execute(transaction, kInsertOrders, order_id,
+                               static_cast<float>(order.weight), order.regions,
+                               order.delivery_hours, order.cost);
 
       if (res.RowsAffected()) {
-        transaction.Commit();
-        responseBuilder.PushBack(orderDO_builder.ExtractValue());
+        created_ids.push_back(order_id);
+        order.order_id = order_id;
       }
     }
+    if (!created_ids.empty()) {
+      scope.Execute(transaction, kRecordCreated, std::string{"order"},
+                    created_ids);
+    }
+    scope.Commit(transaction);
+
+    if (!created_ids.empty()) change_feed_.Notify();
 
-    return userver::formats::json::ToStableString(
-        responseBuilder.ExtractValue());
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto response) {
+      response = decltype(response){userver::formats::common::Type::kArray};
+      for (const auto& order : orders.value()) {
+        if (order.order_id != 0) response.PushBack(order);
+      }
+      return response.ExtractValue();
+    });
   }
 };
 
@@ -2,9 +2,12 @@
 #define LAVKA_ORDERSHANDLER_H
 
 #include "../lavka.h"
+#include "../memory/RequestArena.h"
 
 namespace lavka {
 
+class BsonValue;
+
 struct OrderDto {
   int64_t order_id;
   double weight;
@@ -14,6 +17,15 @@ struct OrderDto {
   std::optional<std::string> complete_time;
 };
 
+// An order of a POST /orders body, allocated in the request arena.
+struct NewOrderDto {
+  double weight;
+  int regions;
+  std::pmr::vector<std::string_view> delivery_hours;
+  int cost;
+  // Set once the order is inserted.
+  int64_t order_id{0};
+};
 
 class OrderIdManager {
   static int64_t last_id_;
@@ -23,8 +35,42 @@ class OrderIdManager {
   static int64_t GetNewId();
 };
 
-userver::formats::json::Value Serialize(const OrderDto& data,
-    userver::formats::serialize::To<userver::formats::json::Value>);
+// Shared by the JSON and BSON responses.
+template <typename Value>
+Value Serialize(const OrderDto& data, userver::formats::serialize::To<Value>) {
+  typename Value::Builder order;
+  order["order_id"] = data.order_id;
+  order["weight"] = data.weight;
+  order["regions"] = data.regions;
+  order["delivery_hours"] = data.delivery_hours;
+  order["cost"] = data.cost;
+  if (data.complete_time.has_value())
+    order["complete_time"] = data.complete_time.value();
+
+  return order.ExtractValue();
+}
+
+template <typename Value>
+Value Serialize(const NewOrderDto& data,
+                userver::formats::serialize::To<Value>) {
+  typename Value::Builder order;
+  order["weight"] = data.weight;
+  order["regions"] = data.regions;
+  order["delivery_hours"] = data.delivery_hours;
+  order["cost"] = data.cost;
+  order["order_id"] = data.order_id;
+  return order.ExtractValue();
+}
+
+bool IsOrderJsonValid(const userver::formats::json::Value& order_json);
+
+// Validates the orders of a POST /orders body as IsOrderJsonValid does
+// and builds them in the arena in the same pass. nullopt if any of them is
+// invalid.
+std::optional<std::pmr::vector<NewOrderDto>> ParseNewOrders(
+    const userver::formats::json::Value& orders_json, RequestArena& arena);
+std::optional<std::pmr::vector<NewOrderDto>> ParseNewOrders(
+    const BsonValue& orders_json, RequestArena& arena);
 
 void AppendOrders(userver::components::ComponentList& component_list);
 
@@ -1,13 +1,33 @@
 #include "OrdersIDHandler.h"
 
+#include "../formats/BodyFormat.h"
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RateLimiter.h"
+#include "../statistics/RequestScope.h"
+
 namespace lavka {
 
 namespace {
+
+struct VersionedOrderDto {
+  int64_t order_id;
+  double weight;
+  int regions;
+  std::vector<std::string> delivery_hours;
+  int cost;
+  std::optional<std::string> complete_time;
+  int64_t version;
+};
+
 class OrdersIdHandler final
     : public userver::server::handlers::HttpHandlerBase {
  public:
   static constexpr std::string_view kName = "handler-orders-id";
   userver::storages::postgres::ClusterPtr pg_cluster_;
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  RateLimiter& rate_limiter_;
+  ConcurrencyLimiter& concurrency_limiter_;
 
   OrdersIdHandler(
       const userver::components::ComponentConfig& config,
@@ -16,14 +36,24 @@ class OrdersIdHandler final
         pg_cluster_(
             component_context
                 .FindComponent<userver::components::Postgres>("postgres-db-1")
-                .GetCluster()){};
+                .GetCluster()),
+        statistics_(component_context.FindComponent<Statistics>()),
+        metrics_(statistics_.ForHandler(
+            kName, config["task_processor"].As<std::string>())),
+        rate_limiter_(component_context.FindComponent<RateLimiter>()),
+        concurrency_limiter_(
+            component_context.FindComponent<ConcurrencyLimiter>()){};
 
   std::string HandleRequestThrow(
       const userver::server::http::HttpRequest& request,
       userver::server::request::RequestContext&) const override {
+    if (!rate_limiter_.Admit(request)) return {};
+    auto slot = concurrency_limiter_.TryAcquire(request, Priority::kHigh);
+    if (!slot) return {};
+    RequestScope scope{request, statistics_, metrics_, std::move(slot)};
     switch (request.GetMethod()) {
       case userver::server::http::HttpMethod::kGet:
-        return GetSpecificOrder(request);
+        return GetSpecificOrder(request, scope);
       default:
         throw userver::server::handlers::ClientError(
             userver::server::handlers::ExternalBody{
@@ -33,13 +63,14 @@ class OrdersIdHandler final
 
   const userver::storages::postgres::Query kSelectSpecificOrder{
       "SELECT order_id, CAST(weight as FLOAT) as weight, regions, delivery_hours, cost, "
-      "CAST(complete_time as TEXT) as complete_time from service_schema.orders "
-      "WHERE order_id=$1",
-      userver::storages::postgres::Query::Name{"select_specific_order"},
+      "CAST(complete_time as TEXT) as complete_time, version "
+      "from service_schema.orders WHERE order_id=$1",
+      userver::storages::postgres::Query::Name{"select_specific_order_version"},
   };
 
   std::string GetSpecificOrder(
-      const userver::server::http::HttpRequest& request) const {
+      const userver::server::http::HttpRequest& request,
+      RequestScope& scope) const {
     auto id_str = request.GetPathArg("order_id");
 
     if(request.ArgCount() > 0) {
@@ -56,8 +87,8 @@ class OrdersIdHandler final
       return {};
     }
 
-    userver::storages::postgres::ResultSet res = pg_cluster_->Execute(
-        userver::storages::postgres::ClusterHostType::kSlave,
+    userver::storages::postgres::ResultSet res = scope.Execute(
+        pg_cluster_, userver::storages::postgres::ClusterHostType::kSlave,
         kSelectSpecificOrder, order_id);
 
     if (res.IsEmpty()) {
@@ -65,13 +96,20 @@ class OrdersIdHandler final
       return {};
     }
 
-    auto resValue =
-        res.AsSingleRow<OrderDto>(userver::storages::postgres::kRowTag);
-
-    userver::formats::json::ValueBuilder orderBuilder{resValue};
-    auto orderJson = orderBuilder.ExtractValue();
-
-    return userver::formats::json::ToStableString(orderJson);
+    auto row = res.AsSingleRow<VersionedOrderDto>(
+        userver::storages::postgres::kRowTag);
+    if (IsNotModified(request,
+                      MakeETag(row.version, AcceptedFormat(request)))) {
+      return {};
+    }
+    OrderDto resValue{row.order_id,     row.weight,
+                      row.regions,      std::move(row.delivery_hours),
+                      row.cost,         std::move(row.complete_time)};
+
+    const auto timer = scope.Time(Stage::kSerialize);
+    return SerializeBody(request, [&](auto builder) {
+      return decltype(builder){resValue}.ExtractValue();
+    });
   }
 };
 }
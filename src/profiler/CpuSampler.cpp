@@ -0,0 +1,150 @@
+#include "CpuSampler.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+namespace lavka {
+
+namespace {
+
+// OnSignal and the kernel signal trampoline.
+constexpr int kSkippedFrames = 2;
+
+std::string Symbolize(void* address) {
+  Dl_info info{};
+  if (dladdr(address, &info) == 0) {
+    return fmt::format("{}", address);
+  }
+  if (info.dli_sname == nullptr) {
+    const auto* module = info.dli_fname ? std::strrchr(info.dli_fname, '/')
+                                        : nullptr;
+    return fmt::format(
+        "{}+{:#x}", module ? module + 1 : "??",
+        reinterpret_cast<uintptr_t>(address) -
+            reinterpret_cast<uintptr_t>(info.dli_fbase));
+  }
+
+  int status = 0;
+  char* demangled =
+      abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+  std::string name = status == 0 ? demangled : info.dli_sname;
+  std::free(demangled);
+  std::replace(name.begin(), name.end(), ';', ':');
+  return name;
+}
+
+// "main-worker-3" and "main-worker" belong to the same task processor.
+std::string_view ThreadGroup(const char* thread_name) {
+  std::string_view name{thread_name};
+  while (!name.empty() &&
+         (std::isdigit(static_cast<unsigned char>(name.back())) ||
+          name.back() == '-' || name.back() == '_')) {
+    name.remove_suffix(1);
+  }
+  return name.empty() ? std::string_view{"unnamed"} : name;
+}
+
+}  // namespace
+
+CpuSampler& CpuSampler::Instance() {
+  static CpuSampler sampler;
+  return sampler;
+}
+
+bool CpuSampler::Start(std::chrono::microseconds interval) {
+  if (running_.exchange(true)) return false;
+
+  if (!samples_) samples_ = std::make_unique<Sample[]>(kMaxSamples);
+  for (size_t i = 0; i < kMaxSamples; ++i) {
+    samples_[i].ready.store(false, std::memory_order_relaxed);
+  }
+  next_sample_ = 0;
+  dropped_ = 0;
+
+  // The first backtrace() call loads libgcc, which must not happen inside
+  // the signal handler.
+  void* warmup[1];
+  backtrace(warmup, 1);
+
+  struct sigaction action {};
+  action.sa_handler = &CpuSampler::OnSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, nullptr);
+
+  itimerval timer{};
+  timer.it_interval.tv_sec = interval.count() / 1'000'000;
+  timer.it_interval.tv_usec = interval.count() % 1'000'000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  return true;
+}
+
+CpuSampler::Profile CpuSampler::Stop() {
+  itimerval disabled{};
+  setitimer(ITIMER_PROF, &disabled, nullptr);
+  // A tick may still be pending, the default SIGPROF action would kill us.
+  signal(SIGPROF, SIG_IGN);
+
+  Profile profile;
+  profile.dropped = dropped_.load();
+
+  std::unordered_map<void*, std::string> symbols;
+  const auto recorded = std::min(next_sample_.load(), kMaxSamples);
+  for (size_t i = 0; i < recorded; ++i) {
+    const auto& sample = samples_[i];
+    if (!sample.ready.load(std::memory_order_acquire)) continue;
+
+    std::string stack{ThreadGroup(sample.thread_name)};
+    for (int frame = sample.depth - 1; frame >= kSkippedFrames; --frame) {
+      auto it = symbols.find(sample.frames[frame]);
+      if (it == symbols.end()) {
+        it = symbols
+                 .emplace(sample.frames[frame],
+                          Symbolize(sample.frames[frame]))
+                 .first;
+      }
+      stack += ';';
+      stack += it->second;
+    }
+    ++profile.stacks[std::move(stack)];
+    ++profile.samples;
+  }
+
+  running_ = false;
+  return profile;
+}
+
+void CpuSampler::OnSignal(int) {
+  auto& sampler = Instance();
+  if (!sampler.running_.load(std::memory_order_relaxed)) return;
+
+  const auto index = sampler.next_sample_.fetch_add(1);
+  if (index >= kMaxSamples) {
+    ++sampler.dropped_;
+    return;
+  }
+
+  const auto saved_errno = errno;
+  auto& sample = sampler.samples_[index];
+  std::memset(sample.thread_name, 0, sizeof(sample.thread_name));
+  prctl(PR_GET_NAME, sample.thread_name);
+  sample.depth = backtrace(sample.frames, kMaxDepth);
+  sample.ready.store(true, std::memory_order_release);
+  errno = saved_errno;
+}
+
+}  // namespace lavka
@@ -0,0 +1,54 @@
+#ifndef LAVKA_CPUSAMPLER_H
+#define LAVKA_CPUSAMPLER_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace lavka {
+
+// Process-wide CPU sampler driven by ITIMER_PROF. On every tick the
+// signal handler records the interrupted thread name and its backtrace
+// into a preallocated buffer, so nothing allocates in signal context.
+// Only one sampling window may be active at a time.
+class CpuSampler final {
+ public:
+  struct Profile {
+    // Collapsed stacks "thread;outer_frame;...;inner_frame" -> samples.
+    std::map<std::string, uint64_t> stacks;
+    uint64_t samples{0};
+    uint64_t dropped{0};
+  };
+
+  static constexpr size_t kMaxSamples = 16384;
+  static constexpr size_t kMaxDepth = 48;
+
+  static CpuSampler& Instance();
+
+  // Returns false if another window is already active.
+  bool Start(std::chrono::microseconds interval);
+  Profile Stop();
+
+ private:
+  struct Sample {
+    std::atomic<bool> ready{false};
+    char thread_name[16];
+    int depth;
+    void* frames[kMaxDepth];
+  };
+
+  CpuSampler() = default;
+
+  static void OnSignal(int);
+
+  std::atomic<bool> running_{false};
+  std::unique_ptr<Sample[]> samples_;
+  std::atomic<size_t> next_sample_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_CPUSAMPLER_H
@@ -0,0 +1,164 @@
+#include "ProfileHandler.h"
+
+#include <map>
+
+#include <userver/engine/async.hpp>
+#include <userver/engine/sleep.hpp>
+#include <userver/http/content_type.hpp>
+#include <userver/yaml_config/merge_schemas.hpp>
+
+#include "CpuSampler.h"
+
+namespace lavka {
+
+namespace {
+
+constexpr std::chrono::milliseconds kDefaultDuration{5000};
+constexpr std::chrono::milliseconds kMaxDuration{60000};
+constexpr int kDefaultFrequency = 99;
+constexpr int kMaxFrequency = 1000;
+constexpr std::chrono::milliseconds kProbeInterval{1};
+
+// Upper bound of a power-of-two microseconds bucket -> probes.
+using DelayHistogram = std::map<int64_t, uint64_t>;
+
+// Measures how late a coroutine sleeping for kProbeInterval is resumed on
+// the current task processor: queueing behind busy workers and long
+// running tasks both show up as wake-up lateness.
+DelayHistogram ProbeSchedulingDelay(userver::engine::Deadline deadline) {
+  DelayHistogram histogram;
+  while (!deadline.IsReached() &&
+         !userver::engine::current_task::ShouldCancel()) {
+    const auto before = std::chrono::steady_clock::now();
+    userver::engine::SleepFor(kProbeInterval);
+    const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - before -
+                           kProbeInterval)
+                           .count();
+    int64_t bucket = 1;
+    while (bucket < delay) bucket *= 2;
+    ++histogram[bucket];
+  }
+  return histogram;
+}
+
+class ProfileHandler final : public userver::server::handlers::HttpHandlerBase {
+ public:
+  static constexpr std::string_view kName = "handler-profile";
+  std::vector<std::pair<std::string, userver::engine::TaskProcessor*>>
+      probe_task_processors_;
+
+  ProfileHandler(const userver::components::ComponentConfig& config,
+                 const userver::components::ComponentContext& component_context)
+      : HttpHandlerBase(config, component_context, /*is_monitor=*/true) {
+    for (const auto& name :
+         config["probe-task-processors"].As<std::vector<std::string>>({})) {
+      probe_task_processors_.emplace_back(
+          name, &component_context.GetTaskProcessor(name));
+    }
+  }
+
+  static userver::yaml_config::Schema GetStaticConfigSchema() {
+    return userver::yaml_config::MergeSchemas<HttpHandlerBase>(R"(
+type: object
+description: On-demand CPU sampling profiler
+additionalProperties: false
+properties:
+    probe-task-processors:
+        type: array
+        description: task processors to measure coroutine scheduling delay on
+        items:
+            type: string
+            description: task processor name
+)");
+  }
+
+  std::string HandleRequestThrow(
+      const userver::server::http::HttpRequest& request,
+      userver::server::request::RequestContext&) const override {
+    switch (request.GetMethod()) {
+      case userver::server::http::HttpMethod::kGet:
+        return GetProfile(request);
+      default:
+        throw userver::server::handlers::ClientError(
+            userver::server::handlers::ExternalBody{
+                fmt::format("Unsupported method {}", request.GetMethod())});
+    }
+  }
+
+  std::string GetProfile(
+      const userver::server::http::HttpRequest& request) const {
+    std::chrono::milliseconds duration = kDefaultDuration;
+    int frequency = kDefaultFrequency;
+
+    try {
+      if (request.HasArg("duration_ms")) {
+        duration =
+            std::chrono::milliseconds{std::stoi(request.GetArg("duration_ms"))};
+      }
+      if (request.HasArg("frequency")) {
+        frequency = std::stoi(request.GetArg("frequency"));
+      }
+    } catch (...) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    if (duration.count() <= 0 || duration > kMaxDuration || frequency <= 0 ||
+        frequency > kMaxFrequency) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kBadRequest);
+      return {};
+    }
+
+    auto& sampler = CpuSampler::Instance();
+    if (!sampler.Start(std::chrono::microseconds{1'000'000 / frequency})) {
+      request.SetResponseStatus(userver::server::http::HttpStatus::kConflict);
+      return {};
+    }
+
+    std::vector<DelayHistogram> delays;
+    try {
+      const auto deadline = userver::engine::Deadline::FromDuration(duration);
+      std::vector<userver::engine::TaskWithResult<DelayHistogram>> probes;
+      for (const auto& [name, task_processor] : probe_task_processors_) {
+        probes.push_back(userver::engine::AsyncNoSpan(
+            *task_processor, &ProbeSchedulingDelay, deadline));
+      }
+
+      userver::engine::InterruptibleSleepUntil(deadline);
+      for (auto& probe : probes) delays.push_back(probe.Get());
+    } catch (...) {
+      sampler.Stop();
+      throw;
+    }
+
+    const auto profile = sampler.Stop();
+
+    std::string body;
+    for (const auto& [stack, samples] : profile.stacks) {
+      body += fmt::format("{} {}\n", stack, samples);
+    }
+    for (size_t i = 0; i < delays.size(); ++i) {
+      for (const auto& [bucket, probes] : delays[i]) {
+        body += fmt::format("{};[scheduling-delay];[<={}us] {}\n",
+                            probe_task_processors_[i].first, bucket, probes);
+      }
+    }
+
+    auto& response = request.GetHttpResponse();
+    response.SetContentType(userver::http::content_type::kTextPlain);
+    response.SetHeader(std::string{"X-Profile-Samples"},
+                       std::to_string(profile.samples));
+    response.SetHeader(std::string{"X-Profile-Dropped"},
+                       std::to_string(profile.dropped));
+    return body;
+  }
+};
+
+}  // namespace
+
+void AppendProfile(userver::components::ComponentList& component_list) {
+  component_list.Append<ProfileHandler>();
+}
+
+}  // namespace lavka
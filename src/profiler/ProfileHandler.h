@@ -0,0 +1,12 @@
+#ifndef LAVKA_PROFILEHANDLER_H
+#define LAVKA_PROFILEHANDLER_H
+
+#include "../lavka.h"
+
+namespace lavka {
+
+void AppendProfile(userver::components::ComponentList& component_list);
+
+}  // namespace lavka
+
+#endif  // LAVKA_PROFILEHANDLER_H
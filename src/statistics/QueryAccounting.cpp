@@ -0,0 +1,43 @@
+#include "QueryAccounting.h"
+
+namespace lavka {
+
+namespace {
+
+uint32_t ToMicroseconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+}  // namespace
+
+const std::string& QueryName(const userver::storages::postgres::Query& query) {
+  static const std::string kUnnamed{"unnamed"};
+  const auto& name = query.GetName();
+  return name.has_value() ? name->GetUnderlying() : kUnnamed;
+}
+
+void AccountQueryResult(Statistics& statistics, const std::string& query_name,
+                        std::chrono::steady_clock::duration elapsed,
+                        const userver::storages::postgres::ResultSet& res,
+                        size_t params_fingerprint) {
+  auto& query_metrics = statistics.ForQuery(query_name);
+  query_metrics.timings.GetCurrentCounter().Account(ToMicroseconds(elapsed));
+  ++query_metrics.executions;
+  query_metrics.rows += res.Size() > 0 ? res.Size() : res.RowsAffected();
+
+  if (IsSlowQuerySampled(statistics.GetConfig()[kSlowQueryLogConfig],
+                         query_name, elapsed)) {
+    LogSlowQuery(query_name, elapsed, params_fingerprint);
+  }
+}
+
+void AccountQueryError(Statistics& statistics, const std::string& query_name,
+                       std::chrono::steady_clock::duration elapsed) {
+  auto& query_metrics = statistics.ForQuery(query_name);
+  query_metrics.timings.GetCurrentCounter().Account(ToMicroseconds(elapsed));
+  ++query_metrics.executions;
+  ++query_metrics.errors;
+}
+
+}  // namespace lavka
@@ -0,0 +1,67 @@
+#ifndef LAVKA_QUERYACCOUNTING_H
+#define LAVKA_QUERYACCOUNTING_H
+
+#include <chrono>
+
+#include "SlowQueryLog.h"
+#include "Statistics.h"
+
+namespace lavka {
+
+const std::string& QueryName(const userver::storages::postgres::Query& query);
+
+void AccountQueryResult(Statistics& statistics, const std::string& query_name,
+                        std::chrono::steady_clock::duration elapsed,
+                        const userver::storages::postgres::ResultSet& res,
+                        size_t params_fingerprint);
+
+void AccountQueryError(Statistics& statistics, const std::string& query_name,
+                       std::chrono::steady_clock::duration elapsed);
+
+// Runs `execute`, one execution of `query` with `args`, accounting it per
+// Query::Name and checking it against the LAVKA_SLOW_QUERY_LOG thresholds.
+// RequestScope goes through it for handlers, components querying outside
+// of a request (background loads, batched writes) call it directly.
+template <typename Execute, typename... Args>
+userver::storages::postgres::ResultSet AccountQuery(
+    Statistics& statistics, const userver::storages::postgres::Query& query,
+    const Execute& execute, const Args&... args) {
+  const auto& query_name = QueryName(query);
+  const auto start = std::chrono::steady_clock::now();
+  try {
+    auto res = execute();
+    AccountQueryResult(statistics, query_name,
+                       std::chrono::steady_clock::now() - start, res,
+                       ParamsFingerprint(args...));
+    return res;
+  } catch (...) {
+    AccountQueryError(statistics, query_name,
+                      std::chrono::steady_clock::now() - start);
+    throw;
+  }
+}
+
+template <typename... Args>
+userver::storages::postgres::ResultSet ExecuteAccounted(
+    Statistics& statistics,
+    userver::storages::postgres::Transaction& transaction,
+    const userver::storages::postgres::Query& query, const Args&... args) {
+  return AccountQuery(
+      statistics, query, [&] { return transaction.Execute(query, args...); },
+      args...);
+}
+
+template <typename... Args>
+userver::storages::postgres::ResultSet ExecuteAccounted(
+    Statistics& statistics,
+    const userver::storages::postgres::ClusterPtr& cluster,
+    userver::storages::postgres::ClusterHostTypeFlags flags,
+    const userver::storages::postgres::Query& query, const Args&... args) {
+  return AccountQuery(
+      statistics, query,
+      [&] { return cluster->Execute(flags, query, args...); }, args...);
+}
+
+}  // namespace lavka
+
+#endif  // LAVKA_QUERYACCOUNTING_H
@@ -0,0 +1,141 @@
+#include "RequestScope.h"
+
+#include <userver/engine/task/cancel.hpp>
+
+namespace lavka {
+
+namespace {
+
+// Leaves the server time to cancel the statement before the client side
+// network timeout fires and the connection has to be dropped.
+constexpr std::chrono::milliseconds kNetworkTimeoutMargin{100};
+
+uint32_t ToMicroseconds(RequestScope::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+}  // namespace
+
+RequestScope::StageTimer::StageTimer(RequestScope& scope, Stage stage)
+    : scope_(scope), stage_(stage), start_(Clock::now()) {}
+
+RequestScope::StageTimer::~StageTimer() {
+  scope_.AccountStage(stage_, Clock::now() - start_);
+}
+
+RequestScope::RequestScope(const userver::server::http::HttpRequest& request,
+                           Statistics& statistics, HandlerMetrics& metrics,
+                           ConcurrencyLimiter::Slot slot)
+    : statistics_(statistics),
+      metrics_(metrics),
+      slot_(std::move(slot)),
+      start_(Clock::now()),
+      deadline_(RequestDeadline(
+          request, statistics_.GetConfig()[kRequestDeadlineConfig],
+          metrics_.name)) {
+  const auto queue_wait = start_ - request.GetStartTime();
+  AccountStage(Stage::kQueueWait, queue_wait);
+  if (metrics_.task_processor) {
+    metrics_.task_processor->queue_wait.GetCurrentCounter().Account(
+        ToMicroseconds(queue_wait));
+  }
+}
+
+RequestScope::~RequestScope() {
+  slot_.Release(stages_[static_cast<size_t>(Stage::kDb)].value_or(
+                    Clock::duration::zero()),
+                db_round_trips_.load());
+
+  for (size_t i = 0; i < kStagesCount; ++i) {
+    if (stages_[i].has_value()) {
+      metrics_.stages[i].GetCurrentCounter().Account(
+          ToMicroseconds(stages_[i].value()));
+    }
+  }
+  metrics_.total.GetCurrentCounter().Account(
+      ToMicroseconds(Clock::now() - start_));
+  metrics_.db_round_trips_per_request.GetCurrentCounter().Account(
+      db_round_trips_.load());
+  ++metrics_.requests;
+  if (cancelled_) ++metrics_.cancelled;
+}
+
+RequestScope::StageTimer RequestScope::Time(Stage stage) {
+  return StageTimer{*this, stage};
+}
+
+std::unique_lock<userver::engine::Mutex> RequestScope::Lock(
+    userver::engine::Mutex& mutex) {
+  StageTimer timer{*this, Stage::kLockWait};
+  if (!mutex.try_lock_until(deadline_)) Cancel();
+  return std::unique_lock<userver::engine::Mutex>{mutex, std::adopt_lock};
+}
+
+void RequestScope::CheckDeadline() {
+  if (deadline_.IsReached() ||
+      userver::engine::current_task::ShouldCancel()) {
+    Cancel();
+  }
+}
+
+userver::storages::postgres::Transaction RequestScope::Begin(
+    const userver::storages::postgres::ClusterPtr& cluster,
+    const std::string& name,
+    userver::storages::postgres::ClusterHostTypeFlags flags,
+    const userver::storages::postgres::TransactionOptions& options) {
+  CheckDeadline();
+  StageTimer timer{*this, Stage::kDb};
+  ++db_round_trips_;
+  ++metrics_.db_round_trips;
+  return cluster->Begin(name, flags, options, StatementControl());
+}
+
+void RequestScope::Commit(
+    userver::storages::postgres::Transaction& transaction) {
+  StageTimer timer{*this, Stage::kDb};
+  ++db_round_trips_;
+  ++metrics_.db_round_trips;
+  transaction.Commit();
+}
+
+userver::storages::postgres::OptionalCommandControl
+RequestScope::StatementControl() const {
+  if (!deadline_.IsReachable()) return std::nullopt;
+  const auto statement_timeout = std::max(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline_.TimeLeft()),
+      std::chrono::milliseconds{1});
+  return userver::storages::postgres::CommandControl{
+      statement_timeout + kNetworkTimeoutMargin, statement_timeout};
+}
+
+void RequestScope::Cancel() {
+  cancelled_ = true;
+  throw DeadlineExpired{};
+}
+
+void RequestScope::AccountStage(Stage stage, Clock::duration elapsed) {
+  auto& total = stages_[static_cast<size_t>(stage)];
+  total = total.value_or(Clock::duration::zero()) + elapsed;
+}
+
+// SELECTs are accounted as rows read, statements without a result set
+// (INSERT, UPDATE) as rows written.
+void RequestScope::AccountResult(
+    const userver::storages::postgres::ResultSet& res) {
+  ++db_round_trips_;
+  ++metrics_.db_round_trips;
+  if (res.Size() > 0) {
+    metrics_.rows_read += res.Size();
+  } else {
+    metrics_.rows_written += res.RowsAffected();
+  }
+}
+
+void RequestScope::AccountError() {
+  ++db_round_trips_;
+  ++metrics_.db_round_trips;
+}
+
+}  // namespace lavka
@@ -0,0 +1,176 @@
+#ifndef LAVKA_REQUESTSCOPE_H
+#define LAVKA_REQUESTSCOPE_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+
+#include <userver/storages/postgres/portal.hpp>
+
+#include "../limits/ConcurrencyLimiter.h"
+#include "../limits/RequestDeadline.h"
+#include "QueryAccounting.h"
+#include "Statistics.h"
+
+namespace lavka {
+
+// Per-request bookkeeping: accumulates the time spent in each stage and
+// the DB work done by a request, flushed into HandlerMetrics on destruction.
+// Every query is also accounted per Query::Name and checked against the
+// LAVKA_SLOW_QUERY_LOG thresholds, see AccountQuery. The concurrency limiter slot is released
+// with the DB time of the request when the scope ends.
+// The time the request waited for its task processor is accounted as the
+// kQueueWait stage and per task processor.
+// Every request has a deadline (LAVKA_REQUEST_DEADLINES): queries get the
+// remaining budget as their statement timeout, and once it is spent the
+// scope throws DeadlineExpired instead of issuing more DB work.
+class RequestScope final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  class StageTimer final {
+   public:
+    StageTimer(RequestScope& scope, Stage stage);
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+    ~StageTimer();
+
+   private:
+    RequestScope& scope_;
+    Stage stage_;
+    Clock::time_point start_;
+  };
+
+  RequestScope(const userver::server::http::HttpRequest& request,
+               Statistics& statistics, HandlerMetrics& metrics,
+               ConcurrencyLimiter::Slot slot);
+  RequestScope(const RequestScope&) = delete;
+  RequestScope& operator=(const RequestScope&) = delete;
+  ~RequestScope();
+
+  [[nodiscard]] StageTimer Time(Stage stage);
+
+  std::unique_lock<userver::engine::Mutex> Lock(userver::engine::Mutex& mutex);
+
+  const userver::engine::Deadline& GetDeadline() const { return deadline_; }
+
+  // Throws DeadlineExpired if the deadline is reached or the request task
+  // was cancelled. Loops doing per-item work call it on every iteration.
+  void CheckDeadline();
+
+  template <typename... Args>
+  userver::storages::postgres::ResultSet Execute(
+      const userver::storages::postgres::ClusterPtr& cluster,
+      userver::storages::postgres::ClusterHostTypeFlags flags,
+      const userver::storages::postgres::Query& query, const Args&... args) {
+    return TimedQuery(
+        query,
+        [&] {
+          return cluster->Execute(flags, StatementControl(), query, args...);
+        },
+        args...);
+  }
+
+  template <typename... Args>
+  userver::storages::postgres::ResultSet Execute(
+      userver::storages::postgres::Transaction& transaction,
+      const userver::storages::postgres::Query& query, const Args&... args) {
+    return TimedQuery(
+        query,
+        [&] {
+          return transaction.Execute(StatementControl(), query, args...);
+        },
+        args...);
+  }
+
+  // For queries issued from parallel subtasks of the request, safe to call
+  // concurrently. Accounted like Execute except for the kDb stage, which
+  // the caller times around the whole fan-out.
+  template <typename... Args>
+  userver::storages::postgres::ResultSet ExecuteConcurrently(
+      const userver::storages::postgres::ClusterPtr& cluster,
+      userver::storages::postgres::ClusterHostTypeFlags flags,
+      const userver::storages::postgres::Query& query, const Args&... args) {
+    return AccountedQuery(
+        query,
+        [&] {
+          return cluster->Execute(flags, StatementControl(), query, args...);
+        },
+        args...);
+  }
+
+  // Server-side cursor, read it with Fetch.
+  template <typename... Args>
+  userver::storages::postgres::Portal MakePortal(
+      userver::storages::postgres::Transaction& transaction,
+      const userver::storages::postgres::Query& query, const Args&... args) {
+    CheckDeadline();
+    StageTimer timer{*this, Stage::kDb};
+    ++db_round_trips_;
+    ++metrics_.db_round_trips;
+    return transaction.MakePortal(query, args...);
+  }
+
+  // Accounted under the name of the query the portal was made for.
+  userver::storages::postgres::ResultSet Fetch(
+      userver::storages::postgres::Portal& portal,
+      const userver::storages::postgres::Query& query, std::uint32_t rows) {
+    return TimedQuery(query, [&] { return portal.Fetch(rows); });
+  }
+
+  userver::storages::postgres::Transaction Begin(
+      const userver::storages::postgres::ClusterPtr& cluster,
+      const std::string& name,
+      userver::storages::postgres::ClusterHostTypeFlags flags,
+      const userver::storages::postgres::TransactionOptions& options = {});
+
+  void Commit(userver::storages::postgres::Transaction& transaction);
+
+  // Statement timeout from the remaining budget.
+  userver::storages::postgres::OptionalCommandControl StatementControl() const;
+
+ private:
+  template <typename Func, typename... Args>
+  userver::storages::postgres::ResultSet TimedQuery(
+      const userver::storages::postgres::Query& query, const Func& func,
+      const Args&... args) {
+    StageTimer timer{*this, Stage::kDb};
+    return AccountedQuery(query, func, args...);
+  }
+
+  template <typename Func, typename... Args>
+  userver::storages::postgres::ResultSet AccountedQuery(
+      const userver::storages::postgres::Query& query, const Func& func,
+      const Args&... args) {
+    CheckDeadline();
+    try {
+      auto res = AccountQuery(statistics_, query, func, args...);
+      AccountResult(res);
+      return res;
+    } catch (...) {
+      AccountError();
+      if (deadline_.IsReached()) Cancel();
+      throw;
+    }
+  }
+
+  [[noreturn]] void Cancel();
+
+  void AccountStage(Stage stage, Clock::duration elapsed);
+  void AccountResult(const userver::storages::postgres::ResultSet& res);
+  void AccountError();
+
+  Statistics& statistics_;
+  HandlerMetrics& metrics_;
+  ConcurrencyLimiter::Slot slot_;
+  const Clock::time_point start_;
+  const userver::engine::Deadline deadline_;
+  std::atomic<bool> cancelled_{false};
+  std::array<std::optional<Clock::duration>, kStagesCount> stages_{};
+  std::atomic<uint64_t> db_round_trips_{0};
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_REQUESTSCOPE_H
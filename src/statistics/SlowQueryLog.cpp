@@ -0,0 +1,69 @@
+#include "SlowQueryLog.h"
+
+#include <userver/logging/log.hpp>
+#include <userver/tracing/span.hpp>
+#include <userver/utils/rand.hpp>
+
+namespace lavka {
+
+namespace {
+
+constexpr uint32_t kSampleScale = 10000;
+
+}  // namespace
+
+std::chrono::milliseconds SlowQueryLogConfig::ThresholdFor(
+    const std::string& query_name) const {
+  const auto it = query_thresholds.find(query_name);
+  return it == query_thresholds.end() ? threshold : it->second;
+}
+
+SlowQueryLogConfig Parse(const userver::formats::json::Value& value,
+                         userver::formats::parse::To<SlowQueryLogConfig>) {
+  SlowQueryLogConfig config;
+  config.enabled = value["enabled"].As<bool>(config.enabled);
+  config.threshold = std::chrono::milliseconds{
+      value["threshold_ms"].As<int64_t>(config.threshold.count())};
+  config.sample_rate = value["sample_rate"].As<double>(config.sample_rate);
+  for (const auto& [name, threshold_ms] :
+       userver::formats::common::Items(value["query_threshold_ms"])) {
+    config.query_thresholds.emplace(
+        name, std::chrono::milliseconds{threshold_ms.As<int64_t>()});
+  }
+  return config;
+}
+
+SlowQueryLogConfig ParseSlowQueryLogConfig(
+    const userver::dynamic_config::DocsMap& docs_map) {
+  return docs_map.Get("LAVKA_SLOW_QUERY_LOG").As<SlowQueryLogConfig>();
+}
+
+bool IsSlowQuerySampled(const SlowQueryLogConfig& config,
+                        const std::string& query_name,
+                        std::chrono::steady_clock::duration elapsed) {
+  if (!config.enabled || elapsed < config.ThresholdFor(query_name)) {
+    return false;
+  }
+  return userver::utils::RandRange(kSampleScale) <
+         config.sample_rate * kSampleScale;
+}
+
+void LogSlowQuery(const std::string& query_name,
+                  std::chrono::steady_clock::duration elapsed,
+                  size_t params_fingerprint) {
+  const auto* span = userver::tracing::Span::CurrentSpanUnchecked();
+  LOG_WARNING() << "Slow query " << query_name
+                << userver::logging::LogExtra{
+                       {"query_name", query_name},
+                       {"elapsed_ms",
+                        std::chrono::duration_cast<std::chrono::milliseconds>(
+                            elapsed)
+                            .count()},
+                       {"params_fingerprint",
+                        fmt::format("{:016x}", params_fingerprint)},
+                       {"request_trace_id",
+                        span ? span->GetTraceId() : std::string{}},
+                   };
+}
+
+}  // namespace lavka
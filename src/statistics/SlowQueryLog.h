@@ -0,0 +1,65 @@
+#ifndef LAVKA_SLOWQUERYLOG_H
+#define LAVKA_SLOWQUERYLOG_H
+
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+
+#include <boost/container_hash/hash.hpp>
+
+#include <userver/dynamic_config/snapshot.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+struct SlowQueryLogConfig {
+  bool enabled{true};
+  std::chrono::milliseconds threshold{100};
+  // Share of the slow queries that get logged, from 0 to 1.
+  double sample_rate{1.0};
+  std::unordered_map<std::string, std::chrono::milliseconds> query_thresholds;
+
+  std::chrono::milliseconds ThresholdFor(const std::string& query_name) const;
+};
+
+SlowQueryLogConfig Parse(
+    const userver::formats::json::Value& value,
+    userver::formats::parse::To<SlowQueryLogConfig>);
+
+SlowQueryLogConfig ParseSlowQueryLogConfig(
+    const userver::dynamic_config::DocsMap& docs_map);
+
+inline constexpr userver::dynamic_config::Key<ParseSlowQueryLogConfig>
+    kSlowQueryLogConfig;
+
+bool IsSlowQuerySampled(const SlowQueryLogConfig& config,
+                        const std::string& query_name,
+                        std::chrono::steady_clock::duration elapsed);
+
+void LogSlowQuery(const std::string& query_name,
+                  std::chrono::steady_clock::duration elapsed,
+                  size_t params_fingerprint);
+
+template <typename T>
+void HashParam(size_t& seed, const T& param) {
+  boost::hash_combine(seed, param);
+}
+
+template <typename T>
+void HashParam(size_t& seed, const std::optional<T>& param) {
+  boost::hash_combine(seed, param.has_value());
+  if (param.has_value()) HashParam(seed, param.value());
+}
+
+// Identifies a parameter set without writing the values into the logs.
+template <typename... Args>
+size_t ParamsFingerprint(const Args&... args) {
+  size_t seed = sizeof...(Args);
+  (HashParam(seed, args), ...);
+  return seed;
+}
+
+}  // namespace lavka
+
+#endif  // LAVKA_SLOWQUERYLOG_H
@@ -0,0 +1,138 @@
+#include "Statistics.h"
+
+#include <userver/components/statistics_storage.hpp>
+#include <userver/dynamic_config/storage/component.hpp>
+
+namespace lavka {
+
+namespace {
+
+template <typename Period>
+void DumpPercentiles(userver::utils::statistics::Writer& writer,
+                     const Period& period) {
+  const auto stats = period.GetStatsForPeriod();
+  writer.ValueWithLabels(stats.GetPercentile(50), {{"percentile", "p50"}});
+  writer.ValueWithLabels(stats.GetPercentile(90), {{"percentile", "p90"}});
+  writer.ValueWithLabels(stats.GetPercentile(99), {{"percentile", "p99"}});
+  writer.ValueWithLabels(stats.GetPercentile(99.9),
+                         {{"percentile", "p99_9"}});
+  writer.ValueWithLabels(stats.GetPercentile(100), {{"percentile", "p100"}});
+}
+
+}  // namespace
+
+std::string_view ToString(Stage stage) {
+  switch (stage) {
+    case Stage::kQueueWait:
+      return "queue-wait";
+    case Stage::kParse:
+      return "parse";
+    case Stage::kValidate:
+      return "validate";
+    case Stage::kLockWait:
+      return "lock-wait";
+    case Stage::kBatchWait:
+      return "batch-wait";
+    case Stage::kDb:
+      return "db";
+    case Stage::kSerialize:
+      return "serialize";
+  }
+  UINVARIANT(false, "Unexpected stage");
+}
+
+void DumpMetric(userver::utils::statistics::Writer& writer,
+                const Timings& timings) {
+  DumpPercentiles(writer, timings);
+}
+
+void DumpMetric(userver::utils::statistics::Writer& writer,
+                const Counts& counts) {
+  DumpPercentiles(writer, counts);
+}
+
+Statistics::Statistics(
+    const userver::components::ComponentConfig& config,
+    const userver::components::ComponentContext& component_context)
+    : LoggableComponentBase(config, component_context),
+      config_source_(
+          component_context.FindComponent<userver::components::DynamicConfig>()
+              .GetSource()) {
+  statistics_holder_ =
+      component_context
+          .FindComponent<userver::components::StatisticsStorage>()
+          .GetStorage()
+          .RegisterWriter("lavka",
+                          [this](userver::utils::statistics::Writer& writer) {
+                            WriteStatistics(writer);
+                          });
+}
+
+Statistics::~Statistics() { statistics_holder_.Unregister(); }
+
+HandlerMetrics& Statistics::ForHandler(std::string_view handler_name,
+                                       const std::string& task_processor) {
+  auto& metrics = *handlers_[std::string{handler_name}];
+  metrics.name = handler_name;
+  metrics.task_processor = task_processors_[task_processor];
+  return metrics;
+}
+
+QueryMetrics& Statistics::ForQuery(const std::string& query_name) {
+  return *queries_[query_name];
+}
+
+userver::dynamic_config::Snapshot Statistics::GetConfig() const {
+  return config_source_.GetSnapshot();
+}
+
+void Statistics::WriteStatistics(
+    userver::utils::statistics::Writer& writer) const {
+  auto handler_writer = writer["handler"];
+  for (const auto& [name, metrics] : handlers_) {
+    const userver::utils::statistics::LabelView handler_label{"handler",
+                                                              name};
+
+    for (size_t i = 0; i < kStagesCount; ++i) {
+      handler_writer["stage-timings-us"].ValueWithLabels(
+          metrics->stages[i],
+          {handler_label, {"stage", ToString(static_cast<Stage>(i))}});
+    }
+    handler_writer["timings-us"].ValueWithLabels(metrics->total,
+                                                 {handler_label});
+    handler_writer["db-round-trips-per-request"].ValueWithLabels(
+        metrics->db_round_trips_per_request, {handler_label});
+
+    handler_writer["requests"].ValueWithLabels(metrics->requests.load(),
+                                               {handler_label});
+    handler_writer["db-round-trips"].ValueWithLabels(
+        metrics->db_round_trips.load(), {handler_label});
+    handler_writer["rows-read"].ValueWithLabels(metrics->rows_read.load(),
+                                                {handler_label});
+    handler_writer["rows-written"].ValueWithLabels(
+        metrics->rows_written.load(), {handler_label});
+    handler_writer["cancelled"].ValueWithLabels(metrics->cancelled.load(),
+                                                {handler_label});
+  }
+
+  auto query_writer = writer["query"];
+  for (const auto& [name, metrics] : queries_) {
+    const userver::utils::statistics::LabelView query_label{"query", name};
+
+    query_writer["timings-us"].ValueWithLabels(metrics->timings,
+                                               {query_label});
+    query_writer["executions"].ValueWithLabels(metrics->executions.load(),
+                                               {query_label});
+    query_writer["errors"].ValueWithLabels(metrics->errors.load(),
+                                           {query_label});
+    query_writer["rows"].ValueWithLabels(metrics->rows.load(), {query_label});
+  }
+
+  auto task_processor_writer = writer["task-processor"];
+  for (const auto& [name, metrics] : task_processors_) {
+    task_processor_writer["queue-wait-us"].ValueWithLabels(
+        metrics->queue_wait, {{"task_processor", name}});
+  }
+}
+
+}  // namespace lavka
@@ -0,0 +1,107 @@
+#ifndef LAVKA_STATISTICS_H
+#define LAVKA_STATISTICS_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include <userver/components/loggable_component_base.hpp>
+#include <userver/dynamic_config/source.hpp>
+#include <userver/rcu/rcu_map.hpp>
+#include <userver/utils/statistics/percentile.hpp>
+#include <userver/utils/statistics/recentperiod.hpp>
+#include <userver/utils/statistics/storage.hpp>
+#include <userver/utils/statistics/writer.hpp>
+
+#include "../lavka.h"
+
+namespace lavka {
+
+enum class Stage {
+  kQueueWait,
+  kParse,
+  kValidate,
+  kLockWait,
+  kBatchWait,
+  kDb,
+  kSerialize,
+};
+
+inline constexpr size_t kStagesCount = 7;
+
+std::string_view ToString(Stage stage);
+
+// Own types rather than aliases, so that the writer finds DumpMetric below
+// by argument-dependent lookup.
+
+// Microseconds: 1us resolution up to ~1ms, 2ms resolution up to ~1s.
+struct Timings final
+    : public userver::utils::statistics::RecentPeriod<
+          userver::utils::statistics::Percentile<1024, uint32_t, 512, 2048>,
+          userver::utils::statistics::Percentile<1024, uint32_t, 512,
+                                                 2048>> {};
+
+struct Counts final : public userver::utils::statistics::RecentPeriod<
+                          userver::utils::statistics::Percentile<256>,
+                          userver::utils::statistics::Percentile<256>> {};
+
+void DumpMetric(userver::utils::statistics::Writer& writer,
+                const Timings& timings);
+
+void DumpMetric(userver::utils::statistics::Writer& writer,
+                const Counts& counts);
+
+struct TaskProcessorMetrics {
+  // From the request being read off the socket until its handler starts.
+  Timings queue_wait;
+};
+
+struct HandlerMetrics {
+  std::array<Timings, kStagesCount> stages;
+  Timings total;
+  Counts db_round_trips_per_request;
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> db_round_trips{0};
+  std::atomic<uint64_t> rows_read{0};
+  std::atomic<uint64_t> rows_written{0};
+  // Requests aborted because their deadline expired.
+  std::atomic<uint64_t> cancelled{0};
+  std::string name;
+  // Task processor the handler runs on, set once at handler construction.
+  std::shared_ptr<TaskProcessorMetrics> task_processor;
+};
+
+struct QueryMetrics {
+  Timings timings;
+  std::atomic<uint64_t> executions{0};
+  std::atomic<uint64_t> errors{0};
+  std::atomic<uint64_t> rows{0};
+};
+
+class Statistics final : public userver::components::LoggableComponentBase {
+ public:
+  static constexpr std::string_view kName = "lavka-statistics";
+
+  Statistics(const userver::components::ComponentConfig& config,
+             const userver::components::ComponentContext& component_context);
+  ~Statistics() override;
+
+  HandlerMetrics& ForHandler(std::string_view handler_name,
+                             const std::string& task_processor);
+  QueryMetrics& ForQuery(const std::string& query_name);
+
+  userver::dynamic_config::Snapshot GetConfig() const;
+
+ private:
+  void WriteStatistics(userver::utils::statistics::Writer& writer) const;
+
+  userver::dynamic_config::Source config_source_;
+  userver::rcu::RcuMap<std::string, HandlerMetrics> handlers_;
+  userver::rcu::RcuMap<std::string, QueryMetrics> queries_;
+  userver::rcu::RcuMap<std::string, TaskProcessorMetrics> task_processors_;
+  userver::utils::statistics::Entry statistics_holder_;
+};
+
+}  // namespace lavka
+
+#endif  // LAVKA_STATISTICS_H
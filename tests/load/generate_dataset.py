@@ -0,0 +1,174 @@
+"""Synthetic dataset generator for the lavka load harness.
+
+Writes couriers.json and orders.json (POST /couriers and POST /orders
+bodies) and completions.json, whose records reference couriers and orders
+by their position in those files. replay.py maps positions to the ids the
+service returns on ingest.
+"""
+
+import argparse
+import datetime
+import json
+import pathlib
+import random
+
+
+COURIER_TYPES = [('FOOT', 0.5), ('BIKE', 0.3), ('AUTO', 0.2)]
+
+# Shifts in minutes since midnight with their share of the fleet.
+SHIFTS = [
+    ([(8 * 60, 14 * 60)], 0.25),
+    ([(10 * 60, 18 * 60)], 0.35),
+    ([(14 * 60, 22 * 60)], 0.25),
+    ([(9 * 60, 13 * 60), (17 * 60, 21 * 60)], 0.15),
+]
+
+# Hourly order intensity with lunch and evening peaks.
+ORDER_HOURS = [
+    (hour, weight) for hour, weight in zip(
+        range(8, 22),
+        [2, 3, 4, 6, 9, 10, 7, 5, 5, 7, 9, 10, 8, 4],
+    )
+]
+
+
+def hhmm(minutes):
+    return '{:02d}:{:02d}'.format(minutes // 60, minutes % 60)
+
+
+def interval(begin, end):
+    return '{}-{}'.format(hhmm(begin), hhmm(end))
+
+
+def weighted_choice(rng, items):
+    values, weights = zip(*items)
+    return rng.choices(values, weights=weights)[0]
+
+
+def zipf_weights(count, exponent):
+    return [1.0 / (rank ** exponent) for rank in range(1, count + 1)]
+
+
+class Generator:
+    def __init__(self, args):
+        self.rng = random.Random(args.seed)
+        self.regions = list(range(1, args.regions + 1))
+        self.region_weights = zipf_weights(args.regions, args.region_skew)
+        self.start_date = datetime.date.fromisoformat(args.start_date)
+        self.days = args.days
+
+    def region(self):
+        return self.rng.choices(self.regions, weights=self.region_weights)[0]
+
+    def courier(self):
+        home = self.region()
+        regions = {home}
+        # Couriers usually serve their home region and a few neighbours.
+        for _ in range(self.rng.choices([0, 1, 2], weights=[5, 3, 2])[0]):
+            neighbour = home + self.rng.randint(-2, 2)
+            if 1 <= neighbour <= len(self.regions):
+                regions.add(neighbour)
+        shift = weighted_choice(self.rng, SHIFTS)
+        return {
+            'courier_type': weighted_choice(self.rng, COURIER_TYPES),
+            'regions': sorted(regions),
+            'working_hours': [interval(b, e) for b, e in shift],
+        }
+
+    def order(self):
+        begin = weighted_choice(self.rng, ORDER_HOURS) * 60
+        begin += self.rng.choice([0, 30])
+        end = min(begin + self.rng.choice([60, 90, 120, 180]), 23 * 60 + 59)
+        weight = round(min(self.rng.lognormvariate(0.7, 0.6), 40.0), 2)
+        cost = int(150 + weight * self.rng.uniform(20, 60))
+        return {
+            'weight': weight,
+            'regions': self.region(),
+            'delivery_hours': [interval(begin, end)],
+            'cost': cost,
+        }
+
+    def completions(self, couriers, orders, count):
+        by_region = {}
+        for index, courier in enumerate(couriers):
+            for region in courier['regions']:
+                by_region.setdefault(region, []).append(index)
+
+        result = []
+        order_indexes = list(range(len(orders)))
+        self.rng.shuffle(order_indexes)
+        for order_index in order_indexes:
+            if len(result) == count:
+                break
+            order = orders[order_index]
+            candidates = by_region.get(order['regions'], [])
+            if not candidates:
+                continue
+            courier_index = self.rng.choice(candidates)
+            moment = self.complete_minute(
+                couriers[courier_index]['working_hours'],
+                order['delivery_hours'],
+            )
+            if moment is None:
+                continue
+            day = self.start_date + datetime.timedelta(
+                days=self.rng.randrange(self.days))
+            result.append({
+                'courier': courier_index,
+                'order': order_index,
+                'complete_time': '{} {}:{:02d}'.format(
+                    day.isoformat(), hhmm(moment), self.rng.randrange(60)),
+            })
+        return result
+
+    def complete_minute(self, working_hours, delivery_hours):
+        def parse(value):
+            begin, end = value.split('-')
+            return (int(begin[:2]) * 60 + int(begin[3:]),
+                    int(end[:2]) * 60 + int(end[3:]))
+
+        overlaps = []
+        for work in map(parse, working_hours):
+            for delivery in map(parse, delivery_hours):
+                begin = max(work[0], delivery[0])
+                end = min(work[1], delivery[1])
+                if begin < end:
+                    overlaps.append((begin, end))
+        if not overlaps:
+            return None
+        begin, end = self.rng.choice(overlaps)
+        return self.rng.randrange(begin, end)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--couriers', type=int, default=1000)
+    parser.add_argument('--orders', type=int, default=20000)
+    parser.add_argument('--completions', type=int, default=10000)
+    parser.add_argument('--regions', type=int, default=50)
+    parser.add_argument('--region-skew', type=float, default=1.1,
+                        help='Zipf exponent of region popularity')
+    parser.add_argument('--start-date', default='2023-04-01')
+    parser.add_argument('--days', type=int, default=30)
+    parser.add_argument('--seed', type=int, default=42)
+    parser.add_argument('--out', type=pathlib.Path,
+                        default=pathlib.Path('load_dataset'))
+    args = parser.parse_args()
+
+    generator = Generator(args)
+    couriers = [generator.courier() for _ in range(args.couriers)]
+    orders = [generator.order() for _ in range(args.orders)]
+    completions = generator.completions(couriers, orders, args.completions)
+
+    args.out.mkdir(parents=True, exist_ok=True)
+    for name, data in (('couriers.json', couriers), ('orders.json', orders),
+                       ('completions.json', completions)):
+        with open(args.out / name, 'w') as file:
+            json.dump(data, file)
+
+    print('generated {} couriers, {} orders, {} completions in {}'.format(
+        len(couriers), len(orders), len(completions), args.out))
+
+
+if __name__ == '__main__':
+    main()